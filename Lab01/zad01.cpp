@@ -1,11 +1,42 @@
 #include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <thread>
 #include <vector>
+#include "../common/energy_meter.h"
+#include "../common/parallel_backend.h"
+
+// build: g++ -O2 zad01.cpp -o zad01 -pthread
+// all backends: g++ -O2 -fopenmp -DUSE_STD_PAR zad01.cpp -o zad01 -pthread -ltbb
+// run:   ./zad01 [--seed N] [--freivalds-rounds K] [--energy] [--backend threads|openmp|stealing|par|all]
 
 int num_threads = 1;
 const int N = 2048;
 int A[N][N], B[N][N], C[N][N], BT[N][N];
 
+// Seeded input: element (i, j) is a hash of (seed, i, j) in -9 .. 9, so the
+// matrices do not depend on how many threads fill them
+unsigned long long seed = 12345;
+const int VALUE_RANGE = 9;
+
+// Freivalds check of every product: k random 0/1 vectors r, C r == A (B r);
+// a wrong C survives a round with probability at most 1/2, so 2^-k overall
+int freivaldsRounds = 20;
+int verifyThreads = 1;
+
+// --energy: RAPL joules of every product, ranked by GFLOP per joule
+bool energyMode = false;
+EnergyMeter energyMeter;
+EnergyReport energyReport = {"GFLOP", {}};
+
+// --backend: the transposed static product on each parallel-for backend
+// (common/parallel_backend.h), one row per chunk
+unsigned backendMask = 0;
+const int backendThreadCounts[] = {1, 2, 4, 8, 16};
+const int numBackendThreadCounts = 5;
+
 // Dynamic arrays for funcDynamic
 int** A_dyn = nullptr;
 int** B_dyn = nullptr;
@@ -50,6 +81,128 @@ void funcDynamic(int tid, bool transposed = false) {
     }
 }
 
+uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Random bits for element (i, j) of matrix number `matrix` (A = 0, B = 1,
+// Freivalds vector k = 2 + k)
+uint64_t randomBits(int matrix, int i, int j) {
+    return mix64(seed ^ mix64(((uint64_t)matrix * N + i) * N + j));
+}
+
+int randomValue(int matrix, int i, int j) {
+    return (int)(randomBits(matrix, i, j) % (2 * VALUE_RANGE + 1)) - VALUE_RANGE;
+}
+
+// Rows [lb, ub) of A, B and their dynamic copies
+void funcInit(int tid) {
+    int lb = (tid * N) / num_threads;
+    int ub = ((tid + 1) * N) / num_threads;
+
+    for(int i = lb; i < ub; i++) {
+        for(int j = 0; j < N; j++) {
+            A[i][j] = A_dyn[i][j] = randomValue(0, i, j);
+            B[i][j] = B_dyn[i][j] = randomValue(1, i, j);
+        }
+    }
+}
+
+// Phase 1 of Freivalds for rows [lb, ub): Br and Cr for all k vectors at once,
+// so every row of B and C is read once. r[k][j] is bit j of round k's vector.
+void funcFreivaldsBC(int tid, int** b, int** c, const std::vector<std::vector<int> >* r,
+                     std::vector<std::vector<long long> >* br, std::vector<std::vector<long long> >* cr) {
+    int lb = (tid * N) / verifyThreads;
+    int ub = ((tid + 1) * N) / verifyThreads;
+
+    for(int i = lb; i < ub; i++) {
+        for(int k = 0; k < freivaldsRounds; k++) {
+            const int* rk = (*r)[k].data();
+            long long sumB = 0, sumC = 0;
+            for(int j = 0; j < N; j++) {
+                sumB += (long long)b[i][j] * rk[j];
+                sumC += (long long)c[i][j] * rk[j];
+            }
+            (*br)[k][i] = sumB;
+            (*cr)[k][i] = sumC;
+        }
+    }
+}
+
+// Phase 2 for rows [lb, ub): compare A (Br) with Cr; counts mismatching rows
+void funcFreivaldsA(int tid, int** a, const std::vector<std::vector<long long> >* br,
+                    const std::vector<std::vector<long long> >* cr, long long* mismatches) {
+    int lb = (tid * N) / verifyThreads;
+    int ub = ((tid + 1) * N) / verifyThreads;
+    long long bad = 0;
+
+    for(int i = lb; i < ub; i++) {
+        for(int k = 0; k < freivaldsRounds; k++) {
+            const long long* brk = (*br)[k].data();
+            long long sum = 0;
+            for(int j = 0; j < N; j++) {
+                sum += a[i][j] * brk[j];
+            }
+            if (sum != (*cr)[k][i]) {
+                bad++;
+            }
+        }
+    }
+    mismatches[tid] = bad;
+}
+
+// O(k n^2) randomized check of c == a * b, parallel over rows
+bool verifyProduct(int** a, int** b, int** c, double* seconds) {
+    const auto start{std::chrono::steady_clock::now()};
+    std::vector<std::vector<int> > r(freivaldsRounds, std::vector<int>(N));
+    for(int k = 0; k < freivaldsRounds; k++) {
+        for(int j = 0; j < N; j++) {
+            r[k][j] = (int)(randomBits(2 + k, 0, j) & 1);
+        }
+    }
+    std::vector<std::vector<long long> > br(freivaldsRounds, std::vector<long long>(N));
+    std::vector<std::vector<long long> > cr(freivaldsRounds, std::vector<long long>(N));
+    std::vector<long long> mismatches(verifyThreads, 0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < verifyThreads; ++i) {
+        threads.push_back(std::thread(funcFreivaldsBC, i, b, c, &r, &br, &cr));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    threads.clear();
+    for (int i = 0; i < verifyThreads; ++i) {
+        threads.push_back(std::thread(funcFreivaldsA, i, a, &br, &cr, mismatches.data()));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    long long bad = 0;
+    for (long long m : mismatches) {
+        bad += m;
+    }
+    const std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - start};
+    *seconds = elapsed.count();
+    return bad == 0;
+}
+
+// Row pointers into the static arrays, so both layouts share verifyProduct
+int* A_rows[N];
+int* B_rows[N];
+int* C_rows[N];
+
+void printVerification(int** a, int** b, int** c) {
+    double seconds;
+    bool ok = verifyProduct(a, b, c, &seconds);
+    std::cout << "  Freivalds (" << freivaldsRounds << " rounds, " << verifyThreads << " threads): "
+              << (ok ? "OK" : "MISMATCH") << " in " << seconds << "s\n";
+}
+
 void transpose() {
     for(int i = 0; i < N; i++) {
         for(int j = 0; j < N; j++) {
@@ -58,6 +211,27 @@ void transpose() {
     }
 }
 
+// Rows [first, last) of C = A * B from the transposed B
+void funcRows(long long first, long long last) {
+    for(long long i = first; i < last; i++) {
+        for(int j = 0; j < N; j++) {
+            int sum = 0;
+            for(int k = 0; k < N; k++) {
+                sum += A[i][k] * BT[j][k];
+            }
+            C[i][j] = sum;
+        }
+    }
+}
+
+// Zero C (or C_dyn) before a timed product, so Freivalds cannot pass on rows
+// left over from the previous run
+void clearProduct(bool dynamic) {
+    for(int i = 0; i < N; i++) {
+        memset(dynamic ? C_dyn[i] : C[i], 0, N * sizeof(int));
+    }
+}
+
 void transposeDynamic() {
     for(int i = 0; i < N; i++) {
         for(int j = 0; j < N; j++) {
@@ -94,15 +268,78 @@ void freeDynamicArrays() {
     delete[] BT_dyn;
 }
 
-int main() {
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--freivalds-rounds") == 0 && i + 1 < argc) {
+            freivaldsRounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--energy") == 0) {
+            energyMode = true;
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (!parseBackends(argv[++i], &backendMask)) {
+                std::cout << "Unknown backend " << argv[i] << " (expected threads, openmp, stealing, par or all)\n";
+                return 1;
+            }
+        }
+    }
+    if (freivaldsRounds < 1) {
+        std::cout << "--freivalds-rounds must be at least 1\n";
+        return 1;
+    }
+    verifyThreads = std::thread::hardware_concurrency() > 0 ? (int)std::thread::hardware_concurrency() : 1;
+
+    if (energyMode) {
+        energyMeter.open();
+    }
+
     // Allocate dynamic arrays
     allocateDynamicArrays();
+    for(int i = 0; i < N; i++) {
+        A_rows[i] = A[i];
+        B_rows[i] = B[i];
+        C_rows[i] = C[i];
+    }
+
+    // Seeded random A and B, filled in parallel
+    {
+        num_threads = verifyThreads;
+        std::vector<std::thread> threads;
+        const auto start{std::chrono::steady_clock::now()};
+        for (int i = 0; i < num_threads; ++i) {
+            threads.push_back(std::thread(funcInit, i));
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        const std::chrono::duration<double> elapsed_seconds{std::chrono::steady_clock::now() - start};
+        std::cout << "Matrices " << N << " x " << N << ", seed " << seed << ", values -" << VALUE_RANGE << " .. "
+                  << VALUE_RANGE << ", initialized in " << elapsed_seconds.count() << "s\n";
+    }
+
+    if (backendMask != 0) {
+        transpose();
+        bool ok = runBackendComparison("matrix product (B transposed)", backendMask, backendThreadCounts,
+                                       numBackendThreadCounts, N, 1, 2.0 * N * N * N / 1e9, "GFLOP",
+                                       [](long long first, long long last, int, int) { funcRows(first, last); },
+                                       [] {
+                                           // cleared after the check, so the next run cannot pass on this product
+                                           double seconds;
+                                           bool correct = verifyProduct(A_rows, B_rows, C_rows, &seconds);
+                                           memset(C, 0, sizeof(C));
+                                           return correct;
+                                       });
+        freeDynamicArrays();
+        return ok ? 0 : 1;
+    }
     
     std::cout << "Static Arrays:\n";
     for(int v = 1; v <= 16; v *= 2) {
         num_threads = v;
+        clearProduct(false);
         std::vector<std::thread> threads;
         const auto start{std::chrono::steady_clock::now()};
+        energyMeter.start();
 
         for (int i = 0; i < num_threads; ++i) {
             threads.push_back(std::thread(funcStatic, i, false));
@@ -113,8 +350,10 @@ int main() {
         }
 
         const auto finish{std::chrono::steady_clock::now()};
+        energyReport.add("static, " + std::to_string(num_threads) + " threads", energyMeter.stop(), 2.0 * N * N * N / 1e9);
         const std::chrono::duration<double> elapsed_seconds{finish - start};
         std::cout << "Threads: " << num_threads << ", Elapsed time: " << elapsed_seconds.count() << "s\n";
+        printVerification(A_rows, B_rows, C_rows);
     }
 
     transpose();
@@ -122,8 +361,10 @@ int main() {
     std::cout << "Static Arrays Transpose:\n";
     for(int v = 1; v <= 16; v *= 2) {
         num_threads = v;
+        clearProduct(false);
         std::vector<std::thread> threads;
         const auto start{std::chrono::steady_clock::now()};
+        energyMeter.start();
 
         for (int i = 0; i < num_threads; ++i) {
             threads.push_back(std::thread(funcStatic, i, true));
@@ -134,15 +375,19 @@ int main() {
         }
 
         const auto finish{std::chrono::steady_clock::now()};
+        energyReport.add("static transposed, " + std::to_string(num_threads) + " threads", energyMeter.stop(), 2.0 * N * N * N / 1e9);
         const std::chrono::duration<double> elapsed_seconds{finish - start};
         std::cout << "Threads: " << num_threads << ", Elapsed time: " << elapsed_seconds.count() << "s\n";
+        printVerification(A_rows, B_rows, C_rows);
     }
 
     std::cout << "Dynamic Arrays:\n";
     for(int v = 1; v <= 16; v *= 2) {
         num_threads = v;
+        clearProduct(true);
         std::vector<std::thread> threads;
         const auto start{std::chrono::steady_clock::now()};
+        energyMeter.start();
 
         for (int i = 0; i < num_threads; ++i) {
             threads.push_back(std::thread(funcDynamic, i, false));
@@ -153,8 +398,10 @@ int main() {
         }
 
         const auto finish{std::chrono::steady_clock::now()};
+        energyReport.add("dynamic, " + std::to_string(num_threads) + " threads", energyMeter.stop(), 2.0 * N * N * N / 1e9);
         const std::chrono::duration<double> elapsed_seconds{finish - start};
         std::cout << "Threads: " << num_threads << ", Elapsed time: " << elapsed_seconds.count() << "s\n";
+        printVerification(A_dyn, B_dyn, C_dyn);
     }
 
     transposeDynamic();
@@ -162,8 +409,10 @@ int main() {
     std::cout << "Dynamic Arrays Transpose:\n";
     for(int v = 1; v <= 16; v *= 2) {
         num_threads = v;
+        clearProduct(true);
         std::vector<std::thread> threads;
         const auto start{std::chrono::steady_clock::now()};
+        energyMeter.start();
 
         for (int i = 0; i < num_threads; ++i) {
             threads.push_back(std::thread(funcDynamic, i, true));
@@ -174,8 +423,14 @@ int main() {
         }
 
         const auto finish{std::chrono::steady_clock::now()};
+        energyReport.add("dynamic transposed, " + std::to_string(num_threads) + " threads", energyMeter.stop(), 2.0 * N * N * N / 1e9);
         const std::chrono::duration<double> elapsed_seconds{finish - start};
         std::cout << "Threads: " << num_threads << ", Elapsed time: " << elapsed_seconds.count() << "s\n";
+        printVerification(A_dyn, B_dyn, C_dyn);
+    }
+
+    if (energyMode) {
+        printEnergyReport(energyReport, "Matrix products");
     }
 
     // Free dynamic arrays
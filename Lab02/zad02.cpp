@@ -9,6 +9,52 @@
  create 24 bit color graphic file ,  portable pixmap file = PPM 
  see http://en.wikipedia.org/wiki/Portable_pixmap
  to see the file use external application ( graphic viewer)
+ -------------------------------
+ 3. --format ppm|qoi|png selects the output encoder (common/image_encoder.h)
+ 4. --deep <centerX> <centerY> <zoom> [--iterations N] [--size W H] renders a
+    deep zoom with perturbation theory (common/perturbation.h)
+ 5. --animate <keyframes> [--frames N] [--size W H] renders a zoom sequence;
+    keyframe lines are "centerX centerY zoom iterations"
+ 6. --serve <socket> [--cache-mb N] runs a tile render daemon on a Unix socket:
+      GET z x y iterations       -> "TILE z x y iterations cached ms bytes\n" + counts
+      PREFETCH z x y iterations  -> "QUEUED\n" or "CACHED\n"
+      STATS / QUIT (this connection) / SHUTDOWN (the daemon)
+    at most SERVICE_PREFETCH_LIMIT prefetches wait; a new one drops the oldest;
+    a level z tile is 1/2^z of the default view, counts are 256*256 uint32 LE;
+    SHUTDOWN, SIGINT or SIGTERM stops accepting, closes the connections,
+    joins the render threads and removes the socket file
+ 7. --mmap [--populate] [--hugepages] renders the thread sweep straight into
+    memory-mapped PPM files (common/mapped_image.h)
+ 8. --trace <file.json> records one span per row of the thread sweep and
+    writes a Chrome / Perfetto timeline (common/trace.h)
+ 9. --mpi renders row bands on MPI worker ranks and sweeps the worker count
+    (common/distributed_render.h); needs the USE_MPI build below
+ 10. --pipeline renders the images of the thread sweep through a coroutine
+    compute -> colorize -> encode -> write pipeline and compares it with the
+    serialized flow (common/render_pipeline.h); needs a C++20 build
+ 11. --fractal mandelbrot|multibrot|burning-ship|julia [--power d] [--julia-c re im]
+    renders the thread sweep (and --stream, --mmap, --pipeline, --mpi) with a
+    compile-time specialised kernel (common/fractal_kernels.h);
+    --fractal-bench times every kernel against a runtime-parameter loop
+ 12. --buddhabrot | --anti-buddhabrot [--uniform] [--samples N] renders the
+    orbit density with Metropolis-Hastings (or uniform) sampling and reports
+    samples/s for 1 .. 64 threads with per-thread, per-node and shared atomic
+    histograms (common/buddhabrot.h)
+ 13. --checksum [--expect-mask hex] hashes the PPM files of the thread sweep
+    (and --stream, --mmap, --pipeline) in parallel and checks that their
+    interior masks agree with each other and with a reference run
+    (common/image_checksum.h)
+ 14. --energy measures package and DRAM joules of every thread count through
+    RAPL (common/energy_meter.h) and names the most energy-efficient one
+ 15. --backend threads|openmp|stealing|par|all renders the image on each
+    parallel-for backend for 1 .. 64 threads and reports kernel time next to
+    the scheduling overhead of an empty body (common/parallel_backend.h);
+    openmp and par need the backends build below
+ build: g++ -O2 zad02.cpp -o zad02 -pthread -lz
+ c++20: g++ -std=c++20 -O2 zad02.cpp -o zad02 -pthread -lz
+ mpi:   mpicxx -O2 -DUSE_MPI zad02.cpp -o zad02_mpi -pthread -lz
+        mpirun -np 5 ./zad02_mpi --mpi
+ backends: g++ -O2 -fopenmp -DUSE_STD_PAR zad02.cpp -o zad02 -pthread -lz -ltbb
   */
  #include <stdio.h>
  #include <math.h>
@@ -17,6 +63,37 @@
  #include <algorithm>
  #include <chrono>
  #include <string>
+ #include <string.h>
+ #include <stdlib.h>
+ #include <atomic>
+ #include <condition_variable>
+ #include <memory>
+ #include <mutex>
+ #include <deque>
+ #include <list>
+ #include <unordered_map>
+ #include <signal.h>
+ #include <unistd.h>
+ #include <poll.h>
+ #include <sys/socket.h>
+ #include <sys/un.h>
+ #include "../common/image_encoder.h"
+ #include "../common/mandelbrot_kernels.h"
+ #include "../common/fractal_kernels.h"
+ #include "../common/perturbation.h"
+ #include "../common/stream_writer.h"
+ #include "../common/mapped_image.h"
+ #include "../common/trace.h"
+ #include "../common/buddhabrot.h"
+ #include "../common/image_checksum.h"
+ #include "../common/energy_meter.h"
+ #include "../common/parallel_backend.h"
+ #ifdef USE_MPI
+ #include "../common/distributed_render.h"
+ #endif
+ #if __cplusplus >= 202002L
+ #include "../common/render_pipeline.h"
+ #endif
 
  // Global variables
  /* screen ( integer) coordinate */
@@ -30,107 +107,1851 @@
  /* */
  double PixelWidth = (CxMax - CxMin) / iXmax;
  double PixelHeight = (CyMax - CyMin) / iYmax;
- /* color component ( R or G or B) is coded from 0 to 255 */
- /* it is 24 bit color RGB file */
- const int MaxColorComponentValue = 255; 
- char *comment = "# "; /* comment should start with # */
+ const char *comment = "Mandelbrot set"; /* written after "# " in the PPM header */
 
  /* */
  const int IterationMax = 200;
  /* bail-out value , radius of circle ;  */
  const double EscapeRadius = 2;
  double ER2 = EscapeRadius * EscapeRadius;
+ /* arithmetic of the escape-time kernel, chosen from the pixel spacing unless --precision is given */
+ const char* precisionReason = NULL;
+ PrecisionTier precision = choosePrecision(PixelWidth, PixelHeight, CxMin, CxMax, CyMin, CyMax, &precisionReason);
+
+ // Fractal family (--fractal, --power, --julia-c): anything but the plain
+ // Mandelbrot set runs the instantiation fractalRowKernel() picks; Julia sets
+ // are drawn on the same grid moved to be centred on 0
+ FractalSpec fractal = {FRACTAL_MULTIBROT, 2, false, FRACTAL_DEFAULT_JULIA_RE, FRACTAL_DEFAULT_JULIA_IM};
+ FractalRowKernel fractalKernel = NULL;
+ double fractalCxMin = CxMin;
+ double fractalER2 = ER2;
+ char fractalComment[128];
 
  // Number of test configurations
  const int numConfigs = 7; // 1, 2, 4, 8, 16, 32, 64 threads
 
- // Allocate memory for all images - array of pointers to images
- unsigned char* images[numConfigs];
- int threadCounts[numConfigs] = {1, 2, 4, 8, 16, 32, 64};
- long long executionTimes[numConfigs];
+ // Allocate memory for all images - array of pointers to images
+ unsigned char* images[numConfigs];
+ int threadCounts[numConfigs] = {1, 2, 4, 8, 16, 32, 64};
+ long long executionTimes[numConfigs];
+
+ // Energy (--energy): RAPL joules of every thread count of the sweep
+ bool energyMode = false;
+ EnergyMeter energyMeter;
+ EnergyReport energyReport = {"Mpixel", {}};
+
+ // Backends (--backend): rows per chunk of the openmp, stealing and par backends
+ const int BACKEND_GRAIN_ROWS = 4;
+
+ // Streaming mode (--stream): rows per block handed to the writer thread
+ const int STREAM_BLOCK_ROWS = 4;
+ long long endToEndTimes[numConfigs];
+
+ // Mapped mode (--mmap): rows per block rendered into the mapped file
+ const int MAPPED_BLOCK_ROWS = 16;
+ unsigned mappedFlags = MAPPED_RELEASE;
+
+ // Precision benchmark (--precision-bench): views rendered in every tier and
+ // compared against the double-double result
+ struct BenchView
+ {
+     const char* name;
+     double centerX;
+     double centerY;
+     double pixelSpacing;
+     int iterations;
+ };
+ const int PRECISION_BENCH_SIZE = 1000;
+ const BenchView PRECISION_BENCH_VIEWS[] =
+ {
+     { "default view",      -0.5,               0.0,               4.0 / PRECISION_BENCH_SIZE, IterationMax },
+     { "seahorse x1e6",     -0.743643887037151, 0.131825904205330, 4.0e-6 / PRECISION_BENCH_SIZE, 1000 },
+     { "seahorse x1e12",    -0.743643887037151, 0.131825904205330, 4.0e-12 / PRECISION_BENCH_SIZE, 2000 }
+ };
+ const int NUM_BENCH_VIEWS = sizeof(PRECISION_BENCH_VIEWS) / sizeof(PRECISION_BENCH_VIEWS[0]);
+
+ // Output encoder (--format) and its statistics per configuration
+ ImageFormat outputFormat = FORMAT_PPM;
+ EncodeStats encodeStats[numConfigs];
+
+ // Deep zoom (--deep): zoom 1 shows the same height as CyMax - CyMin
+ struct DeepView
+ {
+     const char* centerX;
+     const char* centerY;
+     double zoom;
+     int width;
+     int height;
+     int iterations;
+ };
+ const int DEEP_DEFAULT_SIZE = 1000;
+ const int DEEP_DEFAULT_ITERATIONS = 10000;
+
+ // Zoom animation (--animate): frames are split into tiles, and all tiles of
+ // up to ANIMATION_FRAMES_IN_FLIGHT frames share one pool of workers
+ const int ANIMATION_TILE = 64;
+ const int ANIMATION_FRAMES_IN_FLIGHT = 3;
+ const int ANIMATION_DEFAULT_FRAMES = 100;
+ const int MAX_KEYFRAMES = 256;
+
+ struct Keyframe
+ {
+     char centerX[256];
+     char centerY[256];
+     double zoom;
+     int iterations;
+ };
+
+ // Tile daemon (--serve): iteration-count tiles keyed by (level, x, y, iterations)
+ const int SERVICE_TILE = 256;
+ const int SERVICE_MAX_LEVEL = 50;
+ const int SERVICE_DEFAULT_CACHE_MB = 512;
+ const int SERVICE_POLL_MS = 200;          // how often the accept loop checks for shutdown
+ const size_t SERVICE_PREFETCH_LIMIT = 1024;  // waiting prefetches; the oldest is dropped beyond it
+ std::atomic<bool> serviceShutdown(false);  // SHUTDOWN command, SIGINT or SIGTERM
+
+ struct AnimationFrame
+ {
+     BigFixed cx;
+     BigFixed cy;
+     double zoom;
+     int iterations;
+     double pixelSpacing;
+     double offsetX;    // frame center minus reference point
+     double offsetY;
+     std::shared_ptr<ReferenceOrbit> orbit;
+     SeriesApproximation series;
+     unsigned char* image;
+     int nextTile;
+     int tilesDone;
+     bool ready;        // reference orbit and series are set up
+ };
+
+ // Colour of a worker thread: hues spread evenly over the thread count
+ void computeThreadColor(int threadId, int totalThreads, unsigned char* threadColor)
+ {
+     // Use HSV to RGB conversion for distinct colors
+     float hue = (float)threadId / totalThreads;
+     float saturation = 0.7f;
+     float value = 0.9f;
+     
+     // Simple HSV to RGB conversion
+     int h_i = (int)(hue * 6);
+     float f = hue * 6 - h_i;
+     float p = value * (1 - saturation);
+     float q = value * (1 - f * saturation);
+     float t = value * (1 - (1 - f) * saturation);
+     
+     float r, g, b;
+     switch(h_i) {
+         case 0: r = value; g = t; b = p; break;
+         case 1: r = q; g = value; b = p; break;
+         case 2: r = p; g = value; b = t; break;
+         case 3: r = p; g = q; b = value; break;
+         case 4: r = t; g = p; b = value; break;
+         default: r = value; g = p; b = q; break;
+     }
+     
+     threadColor[0] = (unsigned char)(r * 255);
+     threadColor[1] = (unsigned char)(g * 255);
+     threadColor[2] = (unsigned char)(b * 255);
+ }
+
+ // Escape-time iteration counts of row iY in the selected precision
+ void computeRowIterations(int iY, int* iterations)
+ {
+     double Cy = CyMin + iY * PixelHeight;
+     DD CyExact = ddGridCoordinate(ddFromDouble(CyMin), iY, PixelHeight);
+     if (fabs(Cy) < PixelHeight/2) /* Main antenna */
+     {
+         Cy = 0.0;
+         CyExact = ddFromDouble(0.0);
+     }
+     
+     if (fractalKernel != NULL)
+     {
+         fractalKernel(fractalCxMin, PixelWidth, Cy, fractal.juliaRe, fractal.juliaIm,
+                       iXmax, IterationMax, fractalER2, iterations);
+         return;
+     }
+     escapeRow(precision, ddFromDouble(CxMin), PixelWidth,
+               precision == PRECISION_DOUBLE_DOUBLE ? CyExact : ddFromDouble(Cy),
+               iXmax, IterationMax, ER2, iterations);
+ }
+
+ // Colour one row: interior black, exterior in the thread's colour
+ void colorRow(const int* iterations, const unsigned char* threadColor, unsigned char* row)
+ {
+     for(int iX = 0; iX < iXmax; iX++)
+     {
+         /* compute pixel color (24 bit = 3 bytes) */
+         unsigned char* pixel = row + iX * 3;
+         if (iterations[iX] == IterationMax)
+         {
+             /*  interior of Mandelbrot set = black */
+             pixel[0] = 0;
+             pixel[1] = 0;
+             pixel[2] = 0;
+         }
+         else
+         {
+             /* exterior of Mandelbrot set = colored by thread */
+             pixel[0] = threadColor[0];  /* Red */
+             pixel[1] = threadColor[1];  /* Green */
+             pixel[2] = threadColor[2];  /* Blue */
+         }
+     }
+ }
+
+ // Function to compute a range of rows for the Mandelbrot set
+ // image points at the first pixel of startRow
+ void computeRows(unsigned char* image, int startRow, int endRow, int threadId, int totalThreads)
+ {
+     std::vector<int> rowIterations(iXmax);
+     
+     // Generate a unique color for this thread
+     unsigned char threadColor[3];
+     computeThreadColor(threadId, totalThreads, threadColor);
+     traceThreadName("%d threads: worker %d", totalThreads, threadId);
+     
+     for(int iY = startRow; iY < endRow; iY++)
+     {
+         TraceScope span("row", iY, iY + 1);
+         /* Mandelbrot iteration for the whole row in the selected precision */
+         computeRowIterations(iY, rowIterations.data());
+         colorRow(rowIterations.data(), threadColor, image + (size_t)(iY - startRow) * iXmax * 3);
+     }
+ }
+
+ // Streaming worker: claim the next row block, render it into its ring slot
+ void streamRows(StreamWriter* writer, std::atomic<int>* nextBlock, int threadId, int totalThreads)
+ {
+     for (int b = (*nextBlock)++; b < writer->blockCount(); b = (*nextBlock)++)
+     {
+         unsigned char* block = writer->acquire(b);
+         computeRows(block, writer->firstRow(b), writer->lastRow(b), threadId, totalThreads);
+         writer->publish(b);
+     }
+ }
+
+ // Render one image through the streaming writer: workers claim row blocks in
+ // order, so the writer never waits on a block that nobody is computing
+ void renderStreaming(int configIndex, unsigned int numThreads)
+ {
+     char filename[100];
+     sprintf(filename, "mandelbrot_%d_threads.ppm", threadCounts[configIndex]);
+
+     auto startTime = std::chrono::high_resolution_clock::now();
+     int64_t regionStart = traceNow();
+
+     StreamWriter writer(filename, comment, iXmax, iYmax, STREAM_BLOCK_ROWS, 2 * numThreads);
+     std::atomic<int> nextBlock(0);
+
+     std::vector<std::thread> threads;
+     for (unsigned int t = 0; t < numThreads; t++)
+     {
+         threads.push_back(std::thread(streamRows, &writer, &nextBlock, t, numThreads));
+     }
+
+     for (auto& thread : threads)
+     {
+         thread.join();
+     }
+
+     auto computeEnd = std::chrono::high_resolution_clock::now();
+     char regionName[32];
+     snprintf(regionName, sizeof(regionName), "%u threads", numThreads);
+     traceRegion(regionName, regionStart);
+     bool written = writer.finish();
+     auto endTime = std::chrono::high_resolution_clock::now();
+
+     executionTimes[configIndex] = std::chrono::duration_cast<std::chrono::milliseconds>(computeEnd - startTime).count();
+     endToEndTimes[configIndex] = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
+
+     printf("Computation complete in %lld ms, end-to-end %lld ms (ring buffer %.1f MB)\n",
+            executionTimes[configIndex], endToEndTimes[configIndex], writer.footprint() / (1024.0 * 1024.0));
+     if (written)
+         printf("Image streamed to %s\n", filename);
+     else
+         printf("Failed to write %s\n", filename);
+ }
+
+ // Mapped worker: claim the next row block and render it in place
+ void mappedRows(MappedImage* mapped, std::atomic<int>* nextBlock, int threadId, int totalThreads)
+ {
+     int numBlocks = (iYmax + MAPPED_BLOCK_ROWS - 1) / MAPPED_BLOCK_ROWS;
+     for (int b = (*nextBlock)++; b < numBlocks; b = (*nextBlock)++)
+     {
+         int firstRow = b * MAPPED_BLOCK_ROWS;
+         int endRow = std::min(firstRow + MAPPED_BLOCK_ROWS, iYmax);
+         computeRows(mapped->row(firstRow), firstRow, endRow, threadId, totalThreads);
+         mapped->rowsDone(firstRow, endRow);
+     }
+ }
+
+ // Render one image straight into its memory-mapped PPM file; blocks are
+ // claimed in order so the release watermark advances steadily. False when the
+ // file cannot be created or mapped, so no timing is recorded
+ bool renderMapped(int configIndex, unsigned int numThreads)
+ {
+     char filename[100];
+     sprintf(filename, "mandelbrot_%d_threads.ppm", threadCounts[configIndex]);
+
+     auto startTime = std::chrono::high_resolution_clock::now();
+     int64_t regionStart = traceNow();
+
+     MappedImage mapped;
+     if (!mapped.open(filename, comment, iXmax, iYmax, mappedFlags))
+         return false;
+     std::atomic<int> nextBlock(0);
+
+     std::vector<std::thread> threads;
+     for (unsigned int t = 0; t < numThreads; t++)
+     {
+         threads.push_back(std::thread(mappedRows, &mapped, &nextBlock, t, numThreads));
+     }
+
+     for (auto& thread : threads)
+     {
+         thread.join();
+     }
+
+     auto computeEnd = std::chrono::high_resolution_clock::now();
+     char regionName[32];
+     snprintf(regionName, sizeof(regionName), "%u threads", numThreads);
+     traceRegion(regionName, regionStart);
+     bool written = mapped.close();
+     auto endTime = std::chrono::high_resolution_clock::now();
+
+     executionTimes[configIndex] = std::chrono::duration_cast<std::chrono::milliseconds>(computeEnd - startTime).count();
+     endToEndTimes[configIndex] = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
+
+     printf("Computation complete in %lld ms, end-to-end %lld ms (%.1f MB mapped, %.1f MB released early)\n",
+            executionTimes[configIndex], endToEndTimes[configIndex],
+            mapped.fileBytes() / (1024.0 * 1024.0), mapped.released() / (1024.0 * 1024.0));
+     if (written)
+         printf("Image rendered into %s\n", filename);
+     else
+         printf("Failed to write %s\n", filename);
+     return true;
+ }
+
+ #ifdef USE_MPI
+ // Distributed mode (--mpi): bands of MPI_BAND_ROWS rows, split between the
+ // local threads of the worker rank and coloured by rank
+ const int MPI_BAND_ROWS = 64;
+ int distributedThreads = 1;
+
+ void renderBand(int firstRow, int endRow, int worker, int numWorkers, unsigned char* rgb)
+ {
+     std::vector<std::thread> threads;
+     int rows = endRow - firstRow;
+     for (int t = 0; t < distributedThreads; t++)
+     {
+         int startRow = firstRow + rows * t / distributedThreads;
+         int stopRow = firstRow + rows * (t + 1) / distributedThreads;
+         if (stopRow > startRow)
+         {
+             unsigned char* out = rgb + (size_t)(startRow - firstRow) * iXmax * 3;
+             threads.push_back(std::thread(computeRows, out, startRow, stopRow, worker, numWorkers));
+         }
+     }
+     for (auto& thread : threads)
+     {
+         thread.join();
+     }
+ }
+ #endif
+
+ #if __cplusplus >= 202002L
+ // Pipeline mode (--pipeline): image i is the one of configuration i of the
+ // thread sweep, coloured by the thread its static row split gives each row
+ const int PIPELINE_BAND_ROWS = 16;
+
+ void pipelineComputeRows(int image, int firstRow, int endRow, int* values)
+ {
+     (void)image;
+     for (int iY = firstRow; iY < endRow; iY++)
+     {
+         computeRowIterations(iY, values + (size_t)(iY - firstRow) * iXmax);
+     }
+ }
+
+ void pipelineColorizeRows(int image, int firstRow, int endRow, int worker, int numWorkers,
+                           const int* values, unsigned char* rgb)
+ {
+     (void)worker;
+     (void)numWorkers;
+     int totalThreads = threadCounts[image];
+     int rowsPerThread = iYmax / totalThreads;
+     for (int iY = firstRow; iY < endRow; iY++)
+     {
+         unsigned char threadColor[3];
+         computeThreadColor(std::min(iY / rowsPerThread, totalThreads - 1), totalThreads, threadColor);
+         colorRow(values + (size_t)(iY - firstRow) * iXmax, threadColor, rgb + (size_t)(iY - firstRow) * iXmax * 3);
+     }
+ }
+ #endif
+
+ // Iteration counts of a benchmark view, rows interleaved between threads
+ void benchRows(PrecisionTier tier, const BenchView* view, int* iterations, int threadId, int totalThreads)
+ {
+     double half = -0.5 * PRECISION_BENCH_SIZE * view->pixelSpacing;
+     DD cxMin = ddAdd(ddFromDouble(view->centerX), ddFromDouble(half));
+     DD cyMin = ddAdd(ddFromDouble(view->centerY), ddFromDouble(half));
+     for (int iY = threadId; iY < PRECISION_BENCH_SIZE; iY += totalThreads)
+     {
+         DD cy = ddGridCoordinate(cyMin, iY, view->pixelSpacing);
+         escapeRow(tier, cxMin, view->pixelSpacing, cy, PRECISION_BENCH_SIZE,
+                   view->iterations, ER2, iterations + (size_t)iY * PRECISION_BENCH_SIZE);
+     }
+ }
+
+ // Render every benchmark view in all three tiers and diff against double-double
+ void runPrecisionBenchmark()
+ {
+     unsigned int numThreads = std::thread::hardware_concurrency();
+     if (numThreads == 0)
+         numThreads = 1;
+     size_t pixels = (size_t)PRECISION_BENCH_SIZE * PRECISION_BENCH_SIZE;
+     std::vector<int> reference(pixels);
+     std::vector<int> result(pixels);
+
+     printf("\n=== Precision tiers: %d x %d pixels, %u thread(s) ===\n", PRECISION_BENCH_SIZE, PRECISION_BENCH_SIZE, numThreads);
+     printf("View            | Spacing  | Auto          | Tier          | Time (ms) | Mpixel/s | Diff pixels | Set flips\n");
+     printf("--------------------------------------------------------------------------------------------------------\n");
+
+     for (int v = 0; v < NUM_BENCH_VIEWS; v++)
+     {
+         const BenchView* view = &PRECISION_BENCH_VIEWS[v];
+         double half = 0.5 * PRECISION_BENCH_SIZE * view->pixelSpacing;
+         PrecisionTier autoTier = choosePrecision(view->pixelSpacing, view->pixelSpacing,
+                                                  view->centerX - half, view->centerX + half,
+                                                  view->centerY - half, view->centerY + half);
+
+         // Double-double first, it is the reference for the other two
+         const PrecisionTier tiers[] = {PRECISION_DOUBLE_DOUBLE, PRECISION_DOUBLE, PRECISION_FLOAT};
+         for (PrecisionTier tier : tiers)
+         {
+             std::vector<int>& out = tier == PRECISION_DOUBLE_DOUBLE ? reference : result;
+             auto startTime = std::chrono::high_resolution_clock::now();
+
+             std::vector<std::thread> threads;
+             for (unsigned int t = 0; t < numThreads; t++)
+             {
+                 threads.push_back(std::thread(benchRows, tier, view, out.data(), t, numThreads));
+             }
+             for (auto& thread : threads)
+             {
+                 thread.join();
+             }
+
+             auto endTime = std::chrono::high_resolution_clock::now();
+             double ms = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+             size_t differing = 0;
+             size_t flips = 0;
+             for (size_t i = 0; i < pixels; i++)
+             {
+                 differing += out[i] != reference[i];
+                 flips += (out[i] == view->iterations) != (reference[i] == view->iterations);
+             }
+
+             printf("%-15s | %8.1e | %-13s | %-13s | %9.1f | %8.2f | %10.4f%% | %8.4f%%\n",
+                    view->name, view->pixelSpacing, precisionName(autoTier), precisionName(tier),
+                    ms, pixels / (ms * 1000.0), 100.0 * differing / pixels, 100.0 * flips / pixels);
+         }
+     }
+ }
+
+ // Fractal benchmark (--fractal-bench): every family at a few exponents,
+ // specialised kernels against fractalRowGeneric on the same grid
+ const int FRACTAL_BENCH_POWERS[] = {2, 3, 5, 8};
+ const int NUM_FRACTAL_BENCH_POWERS = sizeof(FRACTAL_BENCH_POWERS) / sizeof(FRACTAL_BENCH_POWERS[0]);
+
+ // Rows interleaved between threads; kernel NULL runs the generic loop
+ void fractalBenchRows(const FractalSpec* spec, FractalRowKernel kernel, int* iterations, int threadId, int totalThreads)
+ {
+     double spacing = 4.0 / PRECISION_BENCH_SIZE;
+     double er2 = fractalEscapeRadius2(*spec, ER2);
+     for (int iY = threadId; iY < PRECISION_BENCH_SIZE; iY += totalThreads)
+     {
+         double y = -2.0 + iY * spacing;
+         int* row = iterations + (size_t)iY * PRECISION_BENCH_SIZE;
+         if (kernel != NULL)
+             kernel(-2.0, spacing, y, spec->juliaRe, spec->juliaIm, PRECISION_BENCH_SIZE, IterationMax, er2, row);
+         else
+             fractalRowGeneric(*spec, -2.0, spacing, y, PRECISION_BENCH_SIZE, IterationMax, er2, row);
+     }
+ }
+
+ double timeFractalKernel(const FractalSpec& spec, FractalRowKernel kernel, int* iterations, unsigned int numThreads)
+ {
+     auto startTime = std::chrono::high_resolution_clock::now();
+     std::vector<std::thread> threads;
+     for (unsigned int t = 0; t < numThreads; t++)
+     {
+         threads.push_back(std::thread(fractalBenchRows, &spec, kernel, iterations, t, numThreads));
+     }
+     for (auto& thread : threads)
+     {
+         thread.join();
+     }
+     auto endTime = std::chrono::high_resolution_clock::now();
+     return std::chrono::duration<double, std::milli>(endTime - startTime).count();
+ }
+
+ void runFractalBenchmark()
+ {
+     unsigned int numThreads = std::thread::hardware_concurrency();
+     if (numThreads == 0)
+         numThreads = 1;
+     size_t pixels = (size_t)PRECISION_BENCH_SIZE * PRECISION_BENCH_SIZE;
+     std::vector<int> reference(pixels);
+     std::vector<int> result(pixels);
+
+     printf("\n=== Fractal kernels: %d x %d pixels of [-2, 2]^2, %d iterations, %u thread(s) ===\n",
+            PRECISION_BENCH_SIZE, PRECISION_BENCH_SIZE, IterationMax, numThreads);
+     printf("Fractal                                  | Generic (ms) | Double (ms) | Speedup | Float (ms) | Speedup | Diff pixels\n");
+     printf("---------------------------------------------------------------------------------------------------------------------\n");
+
+     const FractalFormula formulas[] = {FRACTAL_MULTIBROT, FRACTAL_BURNING_SHIP};
+     for (FractalFormula formula : formulas)
+     {
+         for (int julia = 0; julia < 2; julia++)
+         {
+             for (int p = 0; p < NUM_FRACTAL_BENCH_POWERS; p++)
+             {
+                 FractalSpec spec = {formula, FRACTAL_BENCH_POWERS[p], julia != 0, fractal.juliaRe, fractal.juliaIm};
+                 char name[128];
+                 fractalName(spec, name, sizeof(name));
+
+                 double genericMs = timeFractalKernel(spec, NULL, reference.data(), numThreads);
+                 double doubleMs = timeFractalKernel(spec, fractalRowKernel(spec, PRECISION_DOUBLE), result.data(), numThreads);
+                 size_t differing = 0;
+                 for (size_t i = 0; i < pixels; i++)
+                 {
+                     differing += result[i] != reference[i];
+                 }
+                 double floatMs = timeFractalKernel(spec, fractalRowKernel(spec, PRECISION_FLOAT), result.data(), numThreads);
+
+                 printf("%-40.40s | %12.1f | %11.1f | %6.2fx | %10.1f | %6.2fx | %10.4f%%\n", name, genericMs,
+                        doubleMs, genericMs / doubleMs, floatMs, genericMs / floatMs, 100.0 * differing / pixels);
+             }
+         }
+     }
+     printf("Diff pixels: double kernel against the generic loop (rounding only, d = 2 and 3 match exactly)\n");
+ }
+
+ // Colour of a deep zoom pixel: interior black, exterior in iteration bands
+ void colorByIteration(int iteration, int maxIter, unsigned char* rgb)
+ {
+     if (iteration >= maxIter)
+     {
+         rgb[0] = rgb[1] = rgb[2] = 0;
+         return;
+     }
+
+     float hue = (float)(iteration % 64) / 64.0f;
+     float saturation = 0.7f;
+     float value = 0.9f;
+
+     int h_i = (int)(hue * 6);
+     float f = hue * 6 - h_i;
+     float p = value * (1 - saturation);
+     float q = value * (1 - f * saturation);
+     float t = value * (1 - (1 - f) * saturation);
+
+     float r, g, b;
+     switch(h_i) {
+         case 0: r = value; g = t; b = p; break;
+         case 1: r = q; g = value; b = p; break;
+         case 2: r = p; g = value; b = t; break;
+         case 3: r = p; g = q; b = value; break;
+         case 4: r = t; g = p; b = value; break;
+         default: r = value; g = p; b = q; break;
+     }
+
+     rgb[0] = (unsigned char)(r * 255);
+     rgb[1] = (unsigned char)(g * 255);
+     rgb[2] = (unsigned char)(b * 255);
+ }
+
+ // Deep zoom worker: rows are claimed one by one, deltas are relative to the reference
+ void deepRows(const DeepView* view, const ReferenceOrbit* orbit, const SeriesApproximation* series,
+               double pixelSpacing, unsigned char* image, std::atomic<int>* nextRow, PerturbationStats* stats)
+ {
+     for (int iY = (*nextRow)++; iY < view->height; iY = (*nextRow)++)
+     {
+         double dcy = (iY - view->height / 2) * pixelSpacing;
+         for (int iX = 0; iX < view->width; iX++)
+         {
+             double dcx = (iX - view->width / 2) * pixelSpacing;
+             int iteration = perturbPixel(*orbit, *series, dcx, dcy, view->iterations, ER2, stats);
+             colorByIteration(iteration, view->iterations, image + ((size_t)iY * view->width + iX) * 3);
+         }
+     }
+ }
+
+ int renderDeepZoom(const DeepView& view)
+ {
+     int limbs = bigLimbsForZoom(view.zoom, view.height);
+     BigFixed cx, cy;
+     if (!bigParse(view.centerX, limbs, &cx) || !bigParse(view.centerY, limbs, &cy))
+     {
+         printf("Center must be plain decimal numbers, got %s %s\n", view.centerX, view.centerY);
+         return 1;
+     }
+
+     double pixelSpacing = (CyMax - CyMin) / view.zoom / view.height;
+     unsigned int numThreads = std::thread::hardware_concurrency();
+     if (numThreads == 0)
+         numThreads = 1;
+
+     printf("\n=== Deep zoom: %d x %d pixels, zoom %.3e, %d iterations ===\n",
+            view.width, view.height, view.zoom, view.iterations);
+     printf("Reference precision: %d bits, pixel spacing %.3e\n", 32 * (limbs - 1), pixelSpacing);
+
+     auto startTime = std::chrono::high_resolution_clock::now();
+
+     ReferenceOrbit orbit;
+     computeReferenceOrbit(cx, cy, view.iterations, &orbit);
+
+     double halfX = 0.5 * view.width * pixelSpacing;
+     double halfY = 0.5 * view.height * pixelSpacing;
+     SeriesApproximation series;
+     computeSeries(orbit, sqrt(halfX * halfX + halfY * halfY), &series);
+
+     auto orbitTime = std::chrono::high_resolution_clock::now();
+
+     unsigned char* image = new unsigned char[(size_t)view.width * view.height * 3];
+     std::vector<PerturbationStats> stats(numThreads, PerturbationStats{0, 0});
+     std::atomic<int> nextRow(0);
+     std::vector<std::thread> threads;
+     for (unsigned int t = 0; t < numThreads; t++)
+     {
+         threads.push_back(std::thread(deepRows, &view, &orbit, &series, pixelSpacing, image, &nextRow, &stats[t]));
+     }
+     for (auto& thread : threads)
+     {
+         thread.join();
+     }
+
+     auto endTime = std::chrono::high_resolution_clock::now();
+
+     PerturbationStats total = {0, 0};
+     for (const PerturbationStats& s : stats)
+     {
+         total.rebases += s.rebases;
+         total.iterations += s.iterations;
+     }
+
+     double orbitMs = std::chrono::duration<double, std::milli>(orbitTime - startTime).count();
+     double pixelMs = std::chrono::duration<double, std::milli>(endTime - orbitTime).count();
+     double pixels = (double)view.width * view.height;
+     printf("Reference orbit: %d iterations in %.1f ms%s\n", orbit.last, orbitMs,
+            orbit.last < view.iterations ? " (escaped, pixels rebase past its end)" : "");
+     printf("Series approximation skips %d iterations per pixel\n", series.skip);
+     printf("Pixels: %.1f ms on %u thread(s), %.2f Mpixel/s, %.1f M delta iterations/s\n",
+            pixelMs, numThreads, pixels / (pixelMs * 1000.0), total.iterations / (pixelMs * 1000.0));
+     printf("Glitches corrected by rebasing: %lld\n", total.rebases);
+
+     char filename[128];
+     imageFilename(filename, sizeof(filename), "mandelbrot_deep", outputFormat);
+     EncodeStats encoded;
+     if (writeImage(filename, comment, image, view.width, view.height, outputFormat, numThreads, &encoded))
+     {
+         printf("Image saved to %s (", filename);
+         printEncodeStats(encoded);
+         printf(")\n");
+     }
+
+     delete[] image;
+     return 0;
+ }
+
+ // Frame f of the path: zoom is interpolated geometrically, the center so that
+ // it moves uniformly on screen
+ void interpolateFrame(const Keyframe* keys, const BigFixed* keyX, const BigFixed* keyY,
+                       int numKeys, int f, int numFrames, AnimationFrame* frame)
+ {
+     double t = numFrames > 1 ? (double)f * (numKeys - 1) / (numFrames - 1) : 0.0;
+     int k = (int)t;
+     if (k > numKeys - 2)
+         k = numKeys - 2;
+     if (k < 0)
+     {
+         frame->cx = keyX[0];
+         frame->cy = keyY[0];
+         frame->zoom = keys[0].zoom;
+         frame->iterations = keys[0].iterations;
+         return;
+     }
+     double u = t - k;
+
+     double z0 = keys[k].zoom;
+     double z1 = keys[k + 1].zoom;
+     frame->zoom = exp(log(z0) + (log(z1) - log(z0)) * u);
+     frame->iterations = (int)(keys[k].iterations + (keys[k + 1].iterations - keys[k].iterations) * u + 0.5);
+     double w = z0 == z1 ? u : (1.0 - z0 / frame->zoom) / (1.0 - z0 / z1);
+
+     BigFixed diff = BigFixed(), weight, step = BigFixed();
+     bigFromDouble(w, keyX[k].limbs, &weight);
+     bigSub(keyX[k + 1], keyX[k], &diff);
+     bigMul(diff, weight, &step);
+     bigAdd(keyX[k], step, &frame->cx);
+     bigSub(keyY[k + 1], keyY[k], &diff);
+     bigMul(diff, weight, &step);
+     bigAdd(keyY[k], step, &frame->cy);
+ }
+
+ class AnimationScheduler
+ {
+ public:
+     AnimationScheduler(const Keyframe* keys, int numKeys, int numFrames, int width, int height)
+         : keys(keys), numKeys(numKeys), numFrames(numFrames), width(width), height(height)
+     {
+         double maxZoom = 1.0;
+         for (int k = 0; k < numKeys; k++)
+         {
+             maxZoom = fmax(maxZoom, keys[k].zoom);
+             maxIterations = keys[k].iterations > maxIterations ? keys[k].iterations : maxIterations;
+         }
+         limbs = bigLimbsForZoom(maxZoom, height);
+         for (int k = 0; k < numKeys; k++)
+         {
+             validKeys = validKeys && bigParse(keys[k].centerX, limbs, &keyX[k]) && bigParse(keys[k].centerY, limbs, &keyY[k]);
+         }
+         tilesX = (width + ANIMATION_TILE - 1) / ANIMATION_TILE;
+         tilesY = (height + ANIMATION_TILE - 1) / ANIMATION_TILE;
+         frames.resize(numFrames);
+     }
+
+     bool valid() const { return validKeys; }
+
+     // Worker: render tiles of the oldest frames first, set up new frames
+     // when the window has room, sleep when there is nothing to do
+     void work()
+     {
+         std::unique_lock<std::mutex> lock(mutex);
+         while (true)
+         {
+             int frameIndex = -1;
+             int tile = -1;
+             for (int f = firstUnwritten; f < nextAdmit; f++)
+             {
+                 AnimationFrame& frame = frames[f];
+                 if (frame.ready && frame.nextTile < tilesX * tilesY)
+                 {
+                     frameIndex = f;
+                     tile = frame.nextTile++;
+                     break;
+                 }
+             }
+
+             if (tile >= 0)
+             {
+                 lock.unlock();
+                 renderTile(frames[frameIndex], tile % tilesX, tile / tilesX);
+                 lock.lock();
+                 if (++frames[frameIndex].tilesDone == tilesX * tilesY)
+                     wake.notify_all();
+                 continue;
+             }
+
+             if (nextAdmit < numFrames && nextAdmit - firstUnwritten < ANIMATION_FRAMES_IN_FLIGHT && !settingUp)
+             {
+                 int f = nextAdmit++;
+                 settingUp = true;
+                 lock.unlock();
+                 setupFrame(f);
+                 lock.lock();
+                 settingUp = false;
+                 frames[f].ready = true;
+                 wake.notify_all();
+                 continue;
+             }
+
+             if (nextAdmit == numFrames && allTilesTaken())
+                 return;
+             wake.wait(lock);
+         }
+     }
+
+     // Writer: encode and write finished frames in order, freeing their slot
+     void write(ImageFormat format)
+     {
+         for (int f = 0; f < numFrames; f++)
+         {
+             {
+                 std::unique_lock<std::mutex> lock(mutex);
+                 wake.wait(lock, [&]() { return frames[f].ready && frames[f].tilesDone == tilesX * tilesY; });
+             }
+
+             char basename[64];
+             char filename[96];
+             sprintf(basename, "zoom_%05d", f);
+             imageFilename(filename, sizeof(filename), basename, format);
+             EncodeStats stats;
+             if (writeImage(filename, comment, frames[f].image, width, height, format, 1, &stats))
+                 encodedBytes += stats.encodedBytes;
+
+             std::lock_guard<std::mutex> lock(mutex);
+             delete[] frames[f].image;
+             frames[f].image = NULL;
+             frames[f].orbit.reset();
+             firstUnwritten = f + 1;
+             wake.notify_all();
+         }
+     }
+
+     int referenceOrbits = 0;
+     int reusedOrbits = 0;
+     std::atomic<long long> interiorTiles{0};
+     std::atomic<long long> rebases{0};
+     size_t encodedBytes = 0;
+
+ private:
+     bool allTilesTaken() const
+     {
+         for (int f = firstUnwritten; f < nextAdmit; f++)
+         {
+             if (!frames[f].ready || frames[f].nextTile < tilesX * tilesY)
+                 return false;
+         }
+         return true;
+     }
+
+     // Runs for one frame at a time and in frame order, so it can reuse the
+     // previous reference orbit when that point is still inside the view.
+     // Orbits run to the longest iteration count of the path for that reason.
+     void setupFrame(int f)
+     {
+         AnimationFrame& frame = frames[f];
+         interpolateFrame(keys, keyX, keyY, numKeys, f, numFrames, &frame);
+         frame.pixelSpacing = (CyMax - CyMin) / frame.zoom / height;
+         frame.image = new unsigned char[(size_t)width * height * 3];
+         frame.nextTile = 0;
+         frame.tilesDone = 0;
+
+         double halfX = 0.5 * width * frame.pixelSpacing;
+         double halfY = 0.5 * height * frame.pixelSpacing;
+         double halfDiagonal = sqrt(halfX * halfX + halfY * halfY);
+
+         bool reuse = false;
+         if (lastOrbit)
+         {
+             BigFixed d = BigFixed();
+             bigSub(frame.cx, lastOrbit->cx, &d);
+             frame.offsetX = bigToDouble(d);
+             bigSub(frame.cy, lastOrbit->cy, &d);
+             frame.offsetY = bigToDouble(d);
+             bool inside = sqrt(frame.offsetX * frame.offsetX + frame.offsetY * frame.offsetY) <= halfDiagonal;
+             bool sameCenter = frame.offsetX == 0.0 && frame.offsetY == 0.0;
+             bool longEnough = lastOrbit->last >= frame.iterations;
+             bool escaped = lastOrbit->last < lastOrbit->maxIter;
+             reuse = (inside && longEnough) || (sameCenter && escaped);
+         }
+
+         if (!reuse)
+         {
+             std::shared_ptr<ReferenceOrbit> orbit = std::make_shared<ReferenceOrbit>();
+             computeReferenceOrbit(frame.cx, frame.cy, maxIterations, orbit.get());
+             lastOrbit = orbit;
+             frame.offsetX = 0.0;
+             frame.offsetY = 0.0;
+             referenceOrbits++;
+         }
+         else
+         {
+             reusedOrbits++;
+         }
+         frame.orbit = lastOrbit;
+
+         double offset = sqrt(frame.offsetX * frame.offsetX + frame.offsetY * frame.offsetY);
+         computeSeries(*frame.orbit, offset + halfDiagonal, &frame.series);
+     }
+
+     int pixel(const AnimationFrame& frame, int iX, int iY, PerturbationStats* stats)
+     {
+         double dcx = frame.offsetX + (iX - width / 2) * frame.pixelSpacing;
+         double dcy = frame.offsetY + (iY - height / 2) * frame.pixelSpacing;
+         int iteration = perturbPixel(*frame.orbit, frame.series, dcx, dcy, frame.iterations, ER2, stats);
+         colorByIteration(iteration, frame.iterations, frame.image + ((size_t)iY * width + iX) * 3);
+         return iteration;
+     }
+
+     // Border first: the set has no holes, so a tile whose border pixels all
+     // reach the iteration limit is interior everywhere and its inside is
+     // filled black without iterating. That is the only shortcut: as soon as
+     // one border pixel escapes (a tile on the edge of the set, or entirely
+     // outside it) every inside pixel is iterated
+     void renderTile(AnimationFrame& frame, int tx, int ty)
+     {
+         int x0 = tx * ANIMATION_TILE;
+         int y0 = ty * ANIMATION_TILE;
+         int x1 = x0 + ANIMATION_TILE < width ? x0 + ANIMATION_TILE : width;
+         int y1 = y0 + ANIMATION_TILE < height ? y0 + ANIMATION_TILE : height;
+         PerturbationStats stats = {0, 0};
+
+         bool interior = true;
+         for (int iX = x0; iX < x1; iX++)
+         {
+             interior &= pixel(frame, iX, y0, &stats) == frame.iterations;
+             if (y1 - 1 > y0)
+                 interior &= pixel(frame, iX, y1 - 1, &stats) == frame.iterations;
+         }
+         for (int iY = y0 + 1; iY < y1 - 1; iY++)
+         {
+             interior &= pixel(frame, x0, iY, &stats) == frame.iterations;
+             if (x1 - 1 > x0)
+                 interior &= pixel(frame, x1 - 1, iY, &stats) == frame.iterations;
+         }
+
+         for (int iY = y0 + 1; iY < y1 - 1; iY++)
+         {
+             for (int iX = x0 + 1; iX < x1 - 1; iX++)
+             {
+                 if (interior)
+                 {
+                     unsigned char* rgb = frame.image + ((size_t)iY * width + iX) * 3;
+                     rgb[0] = rgb[1] = rgb[2] = 0;
+                 }
+                 else
+                 {
+                     pixel(frame, iX, iY, &stats);
+                 }
+             }
+         }
+
+         if (interior)
+             interiorTiles++;
+         rebases += stats.rebases;
+     }
+
+     const Keyframe* keys;
+     int numKeys;
+     int numFrames;
+     int width;
+     int height;
+     int limbs;
+     int maxIterations = 1;  // reference orbits are long enough for every frame
+     bool validKeys = true;
+     BigFixed keyX[MAX_KEYFRAMES];
+     BigFixed keyY[MAX_KEYFRAMES];
+     int tilesX;
+     int tilesY;
+
+     std::mutex mutex;
+     std::condition_variable wake;
+     std::vector<AnimationFrame> frames;
+     int nextAdmit = 0;       // next frame to set up
+     int firstUnwritten = 0;  // frames below this are on disk
+     bool settingUp = false;
+     std::shared_ptr<ReferenceOrbit> lastOrbit;
+ };
+
+ void animationWorker(AnimationScheduler* scheduler)
+ {
+     scheduler->work();
+ }
+
+ void animationWriter(AnimationScheduler* scheduler, ImageFormat format)
+ {
+     scheduler->write(format);
+ }
+
+ // Read "centerX centerY zoom iterations" lines, '#' starts a comment
+ int readKeyframes(const char* path, Keyframe* keys)
+ {
+     FILE* fp = fopen(path, "r");
+     if (fp == NULL)
+     {
+         printf("Cannot open keyframe file %s\n", path);
+         return 0;
+     }
+
+     int numKeys = 0;
+     char line[1024];
+     while (fgets(line, sizeof(line), fp) != NULL && numKeys < MAX_KEYFRAMES)
+     {
+         if (line[0] == '#')
+             continue;
+         Keyframe* key = &keys[numKeys];
+         if (sscanf(line, "%255s %255s %lf %d", key->centerX, key->centerY, &key->zoom, &key->iterations) == 4)
+         {
+             if (key->zoom < 1.0 || key->iterations < 1)
+             {
+                 printf("Keyframe %d needs zoom >= 1 and iterations >= 1\n", numKeys + 1);
+                 fclose(fp);
+                 return 0;
+             }
+             numKeys++;
+         }
+     }
+     fclose(fp);
+     return numKeys;
+ }
+
+ int renderAnimation(const char* keyframePath, int numFrames, int width, int height)
+ {
+     static Keyframe keys[MAX_KEYFRAMES];
+     int numKeys = readKeyframes(keyframePath, keys);
+     if (numKeys == 0)
+     {
+         printf("No keyframes in %s\n", keyframePath);
+         return 1;
+     }
+
+     AnimationScheduler* scheduler = new AnimationScheduler(keys, numKeys, numFrames, width, height);
+     if (!scheduler->valid())
+     {
+         printf("Keyframe centers must be plain decimal numbers\n");
+         delete scheduler;
+         return 1;
+     }
+
+     unsigned int numThreads = std::thread::hardware_concurrency();
+     if (numThreads == 0)
+         numThreads = 1;
+
+     printf("\n=== Zoom animation: %d frame(s) from %d keyframe(s), %d x %d pixels, %u worker(s) ===\n",
+            numFrames, numKeys, width, height, numThreads);
+
+     auto startTime = std::chrono::high_resolution_clock::now();
+
+     std::thread writer(animationWriter, scheduler, outputFormat);
+     std::vector<std::thread> threads;
+     for (unsigned int t = 0; t < numThreads; t++)
+     {
+         threads.push_back(std::thread(animationWorker, scheduler));
+     }
+     for (auto& thread : threads)
+     {
+         thread.join();
+     }
+     writer.join();
+
+     auto endTime = std::chrono::high_resolution_clock::now();
+     double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+     printf("Rendered and wrote %d frame(s) in %.2f s: %.1f frames/minute\n", numFrames, seconds, numFrames * 60.0 / seconds);
+     printf("Reference orbits computed: %d, reused from the previous frame: %d\n",
+            scheduler->referenceOrbits, scheduler->reusedOrbits);
+     printf("Interior tiles filled from their border: %lld, glitches rebased: %lld\n",
+            scheduler->interiorTiles.load(), scheduler->rebases.load());
+     printf("Output: zoom_%%05d.%s, %.1f MB\n", imageFormatExtension(outputFormat), scheduler->encodedBytes / (1024.0 * 1024.0));
+
+     delete scheduler;
+     return 0;
+ }
+
+ struct TileKey
+ {
+     int level;
+     long long tx;
+     long long ty;
+     int iterations;
+
+     bool operator==(const TileKey& o) const
+     {
+         return level == o.level && tx == o.tx && ty == o.ty && iterations == o.iterations;
+     }
+ };
 
- // Function to compute a range of rows for the Mandelbrot set
- void computeRows(unsigned char* image, int startRow, int endRow, int threadId, int totalThreads)
+ struct TileKeyHash
  {
-     // Local variables used in thread function
-     double Cx, Cy;
-     double Zx, Zy;
-     double Zx2, Zy2;
-     int Iteration;
-     
-     // Generate a unique color for this thread
-     unsigned char threadColor[3];
-     // Use HSV to RGB conversion for distinct colors
-     float hue = (float)threadId / totalThreads;
-     float saturation = 0.7f;
-     float value = 0.9f;
-     
-     // Simple HSV to RGB conversion
-     int h_i = (int)(hue * 6);
-     float f = hue * 6 - h_i;
-     float p = value * (1 - saturation);
-     float q = value * (1 - f * saturation);
-     float t = value * (1 - (1 - f) * saturation);
-     
-     float r, g, b;
-     switch(h_i) {
-         case 0: r = value; g = t; b = p; break;
-         case 1: r = q; g = value; b = p; break;
-         case 2: r = p; g = value; b = t; break;
-         case 3: r = p; g = q; b = value; break;
-         case 4: r = t; g = p; b = value; break;
-         default: r = value; g = p; b = q; break;
+     size_t operator()(const TileKey& k) const
+     {
+         unsigned long long h = (unsigned long long)k.level * 0x9e3779b97f4a7c15ULL;
+         h ^= (unsigned long long)k.tx + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+         h ^= (unsigned long long)k.ty + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+         h ^= (unsigned long long)k.iterations + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+         return (size_t)h;
      }
-     
-     threadColor[0] = (unsigned char)(r * 255);
-     threadColor[1] = (unsigned char)(g * 255);
-     threadColor[2] = (unsigned char)(b * 255);
-     
-     for(int iY = startRow; iY < endRow; iY++)
+ };
+
+ enum TileState
+ {
+     TILE_QUEUED,
+     TILE_RENDERING,
+     TILE_READY
+ };
+
+ struct TileEntry
+ {
+     TileState state;
+     bool visible;                      // requested on screen, not only prefetched
+     std::vector<unsigned int> counts;
+     double renderMs;
+     std::list<TileKey>::iterator lru;  // valid once READY
+ };
+
+ // Render daemon state: cache, LRU order and the two priority queues share one mutex
+ class TileService
+ {
+ public:
+     explicit TileService(size_t budgetBytes) : budget(budgetBytes) {}
+
+     // Block until the tile is rendered (NULL if the service stops first);
+     // on-screen requests jump the prefetch queue
+     std::shared_ptr<TileEntry> get(const TileKey& key, bool* cached)
+     {
+         std::unique_lock<std::mutex> lock(mutex);
+         std::shared_ptr<TileEntry> entry = lookup(key, true);
+         *cached = entry->state == TILE_READY;
+         if (entry->state == TILE_READY)
+         {
+             hits++;
+             lru.splice(lru.begin(), lru, entry->lru);
+             return entry;
+         }
+         misses++;
+         tileReady.wait(lock, [&]() { return entry->state == TILE_READY || stopping; });
+         if (entry->state != TILE_READY)
+             return nullptr;  // the service is shutting down
+         return entry;
+     }
+
+     // Queue a tile behind all on-screen work; returns true if already cached
+     bool prefetch(const TileKey& key)
+     {
+         std::lock_guard<std::mutex> lock(mutex);
+         std::shared_ptr<TileEntry> entry = lookup(key, false);
+         return entry->state == TILE_READY;
+     }
+
+     void renderLoop()
+     {
+         std::vector<int> row(SERVICE_TILE);
+         while (true)
+         {
+             TileKey key;
+             std::shared_ptr<TileEntry> entry;
+             {
+                 std::unique_lock<std::mutex> lock(mutex);
+                 workAvailable.wait(lock, [&]() { return stopping || !visibleQueue.empty() || !prefetchQueue.empty(); });
+                 if (stopping)
+                     return;
+                 std::deque<TileKey>& queue = !visibleQueue.empty() ? visibleQueue : prefetchQueue;
+                 key = queue.front();
+                 queue.pop_front();
+                 auto it = tiles.find(key);
+                 if (it == tiles.end() || it->second->state != TILE_QUEUED)
+                     continue;  // promoted copy already taken, or evicted
+                 entry = it->second;
+                 entry->state = TILE_RENDERING;
+             }
+
+             auto startTime = std::chrono::steady_clock::now();
+             std::vector<unsigned int> counts((size_t)SERVICE_TILE * SERVICE_TILE);
+             renderTile(key, row.data(), counts.data());
+             double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+             std::lock_guard<std::mutex> lock(mutex);
+             entry->counts.swap(counts);
+             entry->renderMs = ms;
+             entry->state = TILE_READY;
+             lru.push_front(key);
+             entry->lru = lru.begin();
+             bytes += entry->counts.size() * sizeof(unsigned int);
+             rendered++;
+             renderMsTotal += ms;
+             if (entry->visible)
+             {
+                 visibleRendered++;
+                 visibleMsTotal += ms;
+             }
+             evict();
+             tileReady.notify_all();
+         }
+     }
+
+     // Let the render loops return and wake every client waiting for a tile
+     void stop()
      {
-         Cy = CyMin + iY * PixelHeight;
-         if (fabs(Cy) < PixelHeight/2) Cy = 0.0; /* Main antenna */
-         
-         for(int iX = 0; iX < iXmax; iX++)
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+         workAvailable.notify_all();
+         tileReady.notify_all();
+     }
+
+     void stats(char* line, size_t size)
+     {
+         std::lock_guard<std::mutex> lock(mutex);
+         snprintf(line, size,
+                  "STATS tiles=%zu bytes=%zu budget=%zu hits=%lld misses=%lld evictions=%lld rendered=%lld "
+                  "avg_ms=%.2f avg_visible_ms=%.2f queued_visible=%zu queued_prefetch=%zu dropped_prefetch=%lld\n",
+                  lru.size(), bytes, budget, hits, misses, evictions, rendered,
+                  rendered > 0 ? renderMsTotal / rendered : 0.0,
+                  visibleRendered > 0 ? visibleMsTotal / visibleRendered : 0.0,
+                  visibleQueue.size(), prefetchQueue.size(), droppedPrefetches);
+     }
+
+ private:
+     // Find or create the entry (mutex held); a visible request promotes a
+     // tile that so far was only prefetched
+     std::shared_ptr<TileEntry> lookup(const TileKey& key, bool visible)
+     {
+         auto it = tiles.find(key);
+         if (it != tiles.end())
+         {
+             std::shared_ptr<TileEntry> entry = it->second;
+             if (visible && !entry->visible)
+             {
+                 entry->visible = true;
+                 if (entry->state == TILE_QUEUED)
+                 {
+                     visibleQueue.push_back(key);
+                     workAvailable.notify_one();
+                 }
+             }
+             return entry;
+         }
+
+         std::shared_ptr<TileEntry> entry = std::make_shared<TileEntry>();
+         entry->state = TILE_QUEUED;
+         entry->visible = visible;
+         entry->renderMs = 0.0;
+         if (!visible)
+             dropOldestPrefetches();
+         tiles[key] = entry;
+         (visible ? visibleQueue : prefetchQueue).push_back(key);
+         workAvailable.notify_one();
+         return entry;
+     }
+
+     // Make room for one more prefetch (mutex held): a dropped tile that is
+     // still waiting and was never requested on screen leaves the map as well
+     void dropOldestPrefetches()
+     {
+         while (prefetchQueue.size() >= SERVICE_PREFETCH_LIMIT)
          {
-             Cx = CxMin + iX * PixelWidth;
-             /* initial value of orbit = critical point Z= 0 */
-             Zx = 0.0;
-             Zy = 0.0;
-             Zx2 = Zx * Zx;
-             Zy2 = Zy * Zy;
-             
-             /* Mandelbrot iteration */
-             for (Iteration = 0; Iteration < IterationMax && ((Zx2 + Zy2) < ER2); Iteration++)
+             TileKey oldest = prefetchQueue.front();
+             prefetchQueue.pop_front();
+             auto it = tiles.find(oldest);
+             if (it != tiles.end() && it->second->state == TILE_QUEUED && !it->second->visible)
              {
-                 Zy = 2 * Zx * Zy + Cy;
-                 Zx = Zx2 - Zy2 + Cx;
-                 Zx2 = Zx * Zx;
-                 Zy2 = Zy * Zy;
+                 tiles.erase(it);
+                 droppedPrefetches++;
              }
-             
-             /* compute pixel color (24 bit = 3 bytes) */
-             int pixelIndex = (iY * iXmax + iX) * 3;
-             if (Iteration == IterationMax)
+         }
+     }
+
+     // Drop least recently used tiles until the cache fits its budget
+     void evict()
+     {
+         while (bytes > budget && lru.size() > 1)
+         {
+             TileKey victim = lru.back();
+             lru.pop_back();
+             auto it = tiles.find(victim);
+             bytes -= it->second->counts.size() * sizeof(unsigned int);
+             tiles.erase(it);
+             evictions++;
+         }
+     }
+
+     // Level z splits the default view into 2^z x 2^z tiles; tile corners are
+     // exact in double, pixels are placed in double-double
+     static void renderTile(const TileKey& key, int* row, unsigned int* counts)
+     {
+         double tileSize = ldexp(CyMax - CyMin, -key.level);
+         double spacing = tileSize / SERVICE_TILE;
+         DD x0 = ddTwoSum(CxMin, (double)key.tx * tileSize);
+         DD y0 = ddTwoSum(CyMin, (double)key.ty * tileSize);
+         PrecisionTier tier = choosePrecision(spacing, spacing, ddToDouble(x0), ddToDouble(x0) + tileSize,
+                                              ddToDouble(y0), ddToDouble(y0) + tileSize);
+
+         for (int iY = 0; iY < SERVICE_TILE; iY++)
+         {
+             DD cy = ddGridCoordinate(y0, iY, spacing);
+             escapeRow(tier, x0, spacing, cy, SERVICE_TILE, key.iterations, ER2, row);
+             for (int iX = 0; iX < SERVICE_TILE; iX++)
              {
-                 /*  interior of Mandelbrot set = black */
-                 image[pixelIndex] = 0;
-                 image[pixelIndex + 1] = 0;
-                 image[pixelIndex + 2] = 0;
+                 counts[(size_t)iY * SERVICE_TILE + iX] = (unsigned int)row[iX];
              }
-             else
+         }
+     }
+
+     std::mutex mutex;
+     std::condition_variable workAvailable;
+     std::condition_variable tileReady;
+     std::unordered_map<TileKey, std::shared_ptr<TileEntry>, TileKeyHash> tiles;
+     std::list<TileKey> lru;  // most recently used first, READY tiles only
+     std::deque<TileKey> visibleQueue;
+     std::deque<TileKey> prefetchQueue;
+     size_t bytes = 0;
+     size_t budget;
+     long long hits = 0;
+     long long misses = 0;
+     long long evictions = 0;
+     long long droppedPrefetches = 0;
+     long long rendered = 0;
+     long long visibleRendered = 0;
+     double renderMsTotal = 0.0;
+     double visibleMsTotal = 0.0;
+     bool stopping = false;
+ };
+
+ void tileRenderWorker(TileService* service)
+ {
+     service->renderLoop();
+ }
+
+ bool parseTileKey(const char* args, TileKey* key)
+ {
+     if (sscanf(args, "%d %lld %lld %d", &key->level, &key->tx, &key->ty, &key->iterations) != 4)
+         return false;
+     long long tiles = 1LL << (key->level >= 0 && key->level <= SERVICE_MAX_LEVEL ? key->level : 0);
+     return key->level >= 0 && key->level <= SERVICE_MAX_LEVEL && key->iterations > 0 &&
+            key->tx >= 0 && key->tx < tiles && key->ty >= 0 && key->ty < tiles;
+ }
+
+ // A client connection; the accept loop owns fd and shuts it down to end
+ // the connection, the client thread works on duplicates of it
+ struct ClientConnection
+ {
+     int fd;
+     std::thread thread;
+     std::atomic<bool> done{false};
+ };
+
+ void serviceSignal(int)
+ {
+     serviceShutdown.store(true);
+ }
+
+ // One client connection: line commands in, text and tile payloads out
+ void serveClient(TileService* service, ClientConnection* connection)
+ {
+     int inFd = dup(connection->fd);
+     int outFd = dup(connection->fd);
+     FILE* in = inFd >= 0 ? fdopen(inFd, "r") : NULL;
+     FILE* out = outFd >= 0 ? fdopen(outFd, "w") : NULL;
+     if (in == NULL || out == NULL)
+     {
+         if (in != NULL) fclose(in); else if (inFd >= 0) close(inFd);
+         if (out != NULL) fclose(out); else if (outFd >= 0) close(outFd);
+         connection->done.store(true);
+         return;
+     }
+
+     char line[256];
+     while (fgets(line, sizeof(line), in) != NULL)
+     {
+         TileKey key;
+         if (strncmp(line, "GET ", 4) == 0 && parseTileKey(line + 4, &key))
+         {
+             auto startTime = std::chrono::steady_clock::now();
+             bool cached = false;
+             std::shared_ptr<TileEntry> entry = service->get(key, &cached);
+             if (!entry)
              {
-                 /* exterior of Mandelbrot set = colored by thread */
-                 image[pixelIndex] = threadColor[0];     /* Red */
-                 image[pixelIndex + 1] = threadColor[1];  /* Green */
-                 image[pixelIndex + 2] = threadColor[2];  /* Blue */
+                 fprintf(out, "ERROR shutting down\n");
+                 break;
              }
+             double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+             size_t payload = entry->counts.size() * sizeof(unsigned int);
+             fprintf(out, "TILE %d %lld %lld %d %d %.2f %zu\n", key.level, key.tx, key.ty, key.iterations,
+                     cached ? 1 : 0, ms, payload);
+             fwrite(entry->counts.data(), 1, payload, out);
+         }
+         else if (strncmp(line, "PREFETCH ", 9) == 0 && parseTileKey(line + 9, &key))
+         {
+             fprintf(out, service->prefetch(key) ? "CACHED\n" : "QUEUED\n");
+         }
+         else if (strncmp(line, "STATS", 5) == 0)
+         {
+             char stats[512];
+             service->stats(stats, sizeof(stats));
+             fputs(stats, out);
+         }
+         else if (strncmp(line, "QUIT", 4) == 0)
+         {
+             break;
+         }
+         else if (strncmp(line, "SHUTDOWN", 8) == 0)
+         {
+             fprintf(out, "BYE\n");
+             serviceShutdown.store(true);
+             break;
+         }
+         else
+         {
+             fprintf(out, "ERROR expected GET|PREFETCH z x y iterations, STATS, QUIT or SHUTDOWN (0 <= z <= %d)\n",
+                     SERVICE_MAX_LEVEL);
+         }
+         if (fflush(out) != 0)
+             break;
+     }
+     fclose(out);
+     fclose(in);
+     connection->done.store(true);
+ }
+
+ // Join client threads that have returned and close their sockets
+ void reapConnections(std::list<std::unique_ptr<ClientConnection>>* connections)
+ {
+     for (auto it = connections->begin(); it != connections->end();)
+     {
+         if ((*it)->done.load())
+         {
+             (*it)->thread.join();
+             close((*it)->fd);
+             it = connections->erase(it);
+         }
+         else
+             it++;
+     }
+ }
+
+ int runTileService(const char* socketPath, size_t cacheMB)
+ {
+     struct sockaddr_un address;
+     memset(&address, 0, sizeof(address));
+     address.sun_family = AF_UNIX;
+     if (strlen(socketPath) >= sizeof(address.sun_path))
+     {
+         printf("Socket path too long: %s\n", socketPath);
+         return 1;
+     }
+     strcpy(address.sun_path, socketPath);
+
+     int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+     unlink(socketPath);
+     if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+     {
+         perror("Cannot listen on socket");
+         return 1;
+     }
+     signal(SIGPIPE, SIG_IGN);
+     // No SA_RESTART, so the signal also cuts the accept loop's poll short
+     struct sigaction stopAction;
+     memset(&stopAction, 0, sizeof(stopAction));
+     stopAction.sa_handler = serviceSignal;
+     sigemptyset(&stopAction.sa_mask);
+     sigaction(SIGINT, &stopAction, NULL);
+     sigaction(SIGTERM, &stopAction, NULL);
+
+     unsigned int numThreads = std::thread::hardware_concurrency();
+     if (numThreads == 0)
+         numThreads = 1;
+     TileService service(cacheMB * 1024 * 1024);
+     std::vector<std::thread> renderThreads;
+     for (unsigned int t = 0; t < numThreads; t++)
+     {
+         renderThreads.push_back(std::thread(tileRenderWorker, &service));
+     }
+
+     printf("Tile service on %s: %dx%d tiles, %u render thread(s), %zu MB cache\n",
+            socketPath, SERVICE_TILE, SERVICE_TILE, numThreads, cacheMB);
+     fflush(stdout);
+
+     std::list<std::unique_ptr<ClientConnection>> connections;
+     while (!serviceShutdown.load())
+     {
+         reapConnections(&connections);
+         struct pollfd incoming = { listener, POLLIN, 0 };
+         if (poll(&incoming, 1, SERVICE_POLL_MS) <= 0)
+             continue;  // timeout, or interrupted by SIGINT / SIGTERM
+         int client = accept(listener, NULL, NULL);
+         if (client < 0)
+             continue;
+         connections.push_back(std::unique_ptr<ClientConnection>(new ClientConnection()));
+         ClientConnection* connection = connections.back().get();
+         connection->fd = client;
+         connection->thread = std::thread(serveClient, &service, connection);
+     }
+
+     // Stop accepting, end every connection, then let the render threads finish
+     close(listener);
+     unlink(socketPath);
+     for (auto& connection : connections)
+     {
+         shutdown(connection->fd, SHUT_RDWR);
+     }
+     service.stop();
+     for (auto& connection : connections)
+     {
+         connection->thread.join();
+         close(connection->fd);
+     }
+     for (auto& thread : renderThreads)
+     {
+         thread.join();
+     }
+     char stats[512];
+     service.stats(stats, sizeof(stats));
+     printf("Tile service stopped, socket %s removed\n%s", socketPath, stats);
+     return 0;
+ }
+
+ // Checksums (--checksum): the sweep's files, compared by their black interior
+ bool verifySweepImages(ImageFormat format, const char* expectedMask)
+ {
+     if (format != FORMAT_PPM)
+     {
+         printf("--checksum reads PPM files, --format %s was written\n", imageFormatExtension(format));
+         return false;
+     }
+     std::vector<std::string> filenames;
+     for (int i = 0; i < numConfigs; i++)
+     {
+         char basename[100];
+         char filename[128];
+         sprintf(basename, "mandelbrot_%d_threads", threadCounts[i]);
+         imageFilename(filename, sizeof(filename), basename, format);
+         filenames.push_back(filename);
+     }
+     const unsigned char interior[3] = {0, 0, 0};
+     return verifyImageChecksums(filenames, interior, expectedMask);
+ }
+
+ // Backends (--backend): one image rendered on every selected backend; each
+ // render must have the interior mask of the first, and the image is filled
+ // white after the check so that rows left out cannot pass
+ bool runBackendRenders(unsigned backends)
+ {
+     unsigned char* image = new unsigned char[(size_t)iXmax * iYmax * 3];
+     const unsigned char interior[3] = {0, 0, 0};
+     int checksumThreads = std::max(1, (int)std::thread::hardware_concurrency());
+     bool haveMask = false;
+     uint64_t firstMask = 0;
+
+     auto renderRows = [image](long long first, long long last, int worker, int numWorkers)
+     {
+         std::vector<int> rowIterations(iXmax);
+         unsigned char threadColor[3];
+         computeThreadColor(worker, numWorkers, threadColor);
+         for (int iY = (int)first; iY < (int)last; iY++)
+         {
+             computeRowIterations(iY, rowIterations.data());
+             colorRow(rowIterations.data(), threadColor, image + (size_t)iY * iXmax * 3);
          }
+     };
+     auto checkImage = [&]()
+     {
+         uint64_t mask = imageChecksum(image, iXmax, iYmax, interior, checksumThreads).mask;
+         memset(image, 255, (size_t)iXmax * iYmax * 3);
+         if (!haveMask)
+         {
+             haveMask = true;
+             firstMask = mask;
+         }
+         return mask == firstMask;
+     };
+
+     bool ok = runBackendComparison(comment, backends, threadCounts, numConfigs, iYmax, BACKEND_GRAIN_ROWS,
+                                    (double)iXmax * iYmax / 1e6, "Mpixel", renderRows, checkImage);
+     printf("Interior mask: %016llx\n", (unsigned long long)firstMask);
+     delete[] image;
+     return ok;
+ }
+
+ // Buddhabrot team (--buddhabrot): one std::thread per team member
+ void launchBuddhaThreads(int numThreads, void (*body)(BuddhaRun* run, int thread), BuddhaRun* run)
+ {
+     std::vector<std::thread> threads;
+     for (int t = 0; t < numThreads; t++)
+     {
+         threads.push_back(std::thread(body, run, t));
+     }
+     for (auto& thread : threads)
+     {
+         thread.join();
      }
  }
 
- int main()
+ int main(int argc, char** argv)
  {
+        bool streaming = false;
+        bool mapped = false;
+        bool distributed = false;
+        bool pipeline = false;
+        bool precisionBench = false;
+        bool fractalBench = false;
+        FractalArgs fractalArgs = {0, false};
+        bool fractalValid = true;
+        bool deepZoom = false;
+        DeepView deepView = {NULL, NULL, 1.0, DEEP_DEFAULT_SIZE, DEEP_DEFAULT_SIZE, DEEP_DEFAULT_ITERATIONS};
+        const char* keyframePath = NULL;
+        int animationFrames = ANIMATION_DEFAULT_FRAMES;
+        const char* socketPath = NULL;
+        int cacheMB = SERVICE_DEFAULT_CACHE_MB;
+        const char* tracePath = NULL;
+        bool buddhabrot = false;
+        bool checksum = false;
+        const char* expectedMask = NULL;
+        unsigned backendMask = 0;
+        BuddhaConfig buddhaConfig = {BUDDHA_SIZE, BUDDHA_ITERATIONS, false, BUDDHA_METROPOLIS, BUDDHA_DEFAULT_SAMPLES};
+        for (int i = 1; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--stream") == 0)
+                streaming = true;
+            else if (strcmp(argv[i], "--mmap") == 0)
+                mapped = true;
+            else if (strcmp(argv[i], "--populate") == 0)
+                mappedFlags |= MAPPED_POPULATE;
+            else if (strcmp(argv[i], "--hugepages") == 0)
+                mappedFlags |= MAPPED_HUGEPAGES;
+            else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+                tracePath = argv[++i];
+            else if (strcmp(argv[i], "--mpi") == 0)
+                distributed = true;
+            else if (strcmp(argv[i], "--pipeline") == 0)
+                pipeline = true;
+            else if (strcmp(argv[i], "--precision-bench") == 0)
+                precisionBench = true;
+            else if (strcmp(argv[i], "--fractal-bench") == 0)
+                fractalBench = true;
+            else if (parseFractalArg(argc, argv, &i, &fractal, &fractalArgs, &fractalValid))
+            {
+                if (!fractalValid)
+                    return 1;
+            }
+            else if (strcmp(argv[i], "--energy") == 0)
+                energyMode = true;
+            else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            {
+                if (!parseBackends(argv[++i], &backendMask))
+                {
+                    printf("Unknown backend %s (expected threads, openmp, stealing, par or all)\n", argv[i]);
+                    return 1;
+                }
+            }
+            else if (strcmp(argv[i], "--checksum") == 0)
+                checksum = true;
+            else if (strcmp(argv[i], "--expect-mask") == 0 && i + 1 < argc)
+            {
+                checksum = true;
+                expectedMask = argv[++i];
+            }
+            else if (strcmp(argv[i], "--buddhabrot") == 0)
+                buddhabrot = true;
+            else if (strcmp(argv[i], "--anti-buddhabrot") == 0)
+            {
+                buddhabrot = true;
+                buddhaConfig.anti = true;
+                buddhaConfig.maxIter = BUDDHA_ANTI_ITERATIONS;
+            }
+            else if (strcmp(argv[i], "--uniform") == 0)
+                buddhaConfig.sampler = BUDDHA_UNIFORM;
+            else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+                buddhaConfig.samples = atoll(argv[++i]);
+            else if (strcmp(argv[i], "--deep") == 0 && i + 3 < argc)
+            {
+                deepZoom = true;
+                deepView.centerX = argv[++i];
+                deepView.centerY = argv[++i];
+                deepView.zoom = atof(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--animate") == 0 && i + 1 < argc)
+                keyframePath = argv[++i];
+            else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+                socketPath = argv[++i];
+            else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc)
+                cacheMB = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+                animationFrames = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+                deepView.iterations = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc)
+            {
+                deepView.width = atoi(argv[++i]);
+                deepView.height = atoi(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc)
+            {
+                if (strcmp(argv[++i], "auto") == 0)
+                    precision = choosePrecision(PixelWidth, PixelHeight, CxMin, CxMax, CyMin, CyMax, &precisionReason);
+                else if (parsePrecision(argv[i], &precision))
+                    precisionReason = "set by --precision";
+                else
+                {
+                    printf("Unknown precision %s (expected auto, float, double or dd)\n", argv[i]);
+                    return 1;
+                }
+            }
+            else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+            {
+                if (!parseImageFormat(argv[++i], &outputFormat))
+                {
+                    printf("Unknown format %s (expected ppm, qoi or png)\n", argv[i]);
+                    return 1;
+                }
+            }
+        }
+
+        if (!resolveFractalArgs(fractalArgs, &fractal))
+            return 1;
+        if (!fractalIsMandelbrot(fractal))
+        {
+            fractalKernel = fractalRowKernel(fractal, precision);
+            fractalER2 = fractalEscapeRadius2(fractal, ER2);
+            if (fractal.julia)
+                fractalCxMin = -0.5 * (CxMax - CxMin);
+            fractalName(fractal, fractalComment, sizeof(fractalComment));
+            comment = fractalComment;
+        }
+
+        if (distributed)
+        {
+ #ifdef USE_MPI
+            int provided;
+            MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+            distributedThreads = distributedLocalThreads();
+            std::vector<int> order((iYmax + MPI_BAND_ROWS - 1) / MPI_BAND_ROWS);
+            for (size_t b = 0; b < order.size(); b++)
+                order[b] = (int)b;
+            distributedSweep("mandelbrot", comment, iXmax, iYmax, MPI_BAND_ROWS, order, renderBand);
+            MPI_Finalize();
+            return 0;
+ #else
+            printf("--mpi needs the MPI build: mpicxx -O2 -DUSE_MPI zad02.cpp -o zad02_mpi -pthread -lz\n");
+            return 1;
+ #endif
+        }
+
+        if (socketPath != NULL)
+        {
+            if (cacheMB < 1)
+            {
+                printf("Cache budget must be at least 1 MB\n");
+                return 1;
+            }
+            return runTileService(socketPath, (size_t)cacheMB);
+        }
+
+        if (keyframePath != NULL)
+        {
+            if (animationFrames < 1 || deepView.width < 1 || deepView.height < 1)
+            {
+                printf("Animation needs at least one frame and a positive size\n");
+                return 1;
+            }
+            return renderAnimation(keyframePath, animationFrames, deepView.width, deepView.height);
+        }
+
+        if (deepZoom)
+        {
+            if (deepView.zoom < 1.0 || deepView.iterations < 1 || deepView.width < 1 || deepView.height < 1)
+            {
+                printf("Deep zoom needs zoom >= 1, iterations >= 1 and a positive size\n");
+                return 1;
+            }
+            return renderDeepZoom(deepView);
+        }
+
+        if (buddhabrot)
+        {
+            if (buddhaConfig.samples < 1)
+            {
+                printf("--samples must be at least 1\n");
+                return 1;
+            }
+            return runBuddhabrotScaling(buddhaConfig, threadCounts, numConfigs, outputFormat,
+                                        launchBuddhaThreads) ? 0 : 1;
+        }
+
+        if (backendMask != 0)
+        {
+            printf("Kernel precision: %s (%s)\n", precisionName(precision), precisionReason);
+            return runBackendRenders(backendMask) ? 0 : 1;
+        }
+
+        if (precisionBench)
+        {
+            runPrecisionBenchmark();
+            return 0;
+        }
+
+        if (fractalBench)
+        {
+            runFractalBenchmark();
+            return 0;
+        }
+
+        printf("Kernel precision: %s (%s)\n", precisionName(precision), precisionReason);
+        if (fractalKernel != NULL)
+            printf("Fractal: %s, specialised kernel in %s\n", comment,
+                   precision == PRECISION_FLOAT ? "float" : "double");
+        if (tracePath != NULL)
+            traceEnable();
+        if (energyMode)
+            energyMeter.open();
+
+        if (pipeline)
+        {
+ #if __cplusplus >= 202002L
+            std::vector<PipelineImage> pipelineImages(numConfigs);
+            for (int i = 0; i < numConfigs; i++)
+            {
+                char basename[100];
+                sprintf(basename, "mandelbrot_%d_threads", threadCounts[i]);
+                imageFilename(pipelineImages[i].filename, sizeof(pipelineImages[i].filename), basename, outputFormat);
+                snprintf(pipelineImages[i].comment, sizeof(pipelineImages[i].comment), "%s", comment);
+            }
+            unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+            bool ok = runPipelineComparison(pipelineImages, iXmax, iYmax, PIPELINE_BAND_ROWS, outputFormat,
+                                            (int)numThreads, pipelineComputeRows, pipelineColorizeRows);
+            if (tracePath != NULL)
+                traceWrite(tracePath);
+            if (ok && checksum)
+                ok = verifySweepImages(outputFormat, expectedMask);
+            return ok ? 0 : 1;
+ #else
+            printf("--pipeline needs a C++20 build: g++ -std=c++20 -O2 zad02.cpp -o zad02 -pthread -lz\n");
+            return 1;
+ #endif
+        }
+
+        if (streaming || mapped)
+        {
+            if (streaming)
+                printf("\n=== Streaming mode: rendering overlapped with disk writes ===\n");
+            else
+                printf("\n=== Mapped mode: rendering into memory-mapped files%s%s ===\n",
+                       (mappedFlags & MAPPED_POPULATE) ? ", populated" : "",
+                       (mappedFlags & MAPPED_HUGEPAGES) ? ", huge pages" : "");
+            if (outputFormat != FORMAT_PPM)
+                printf("%s writes raw PPM, --format %s is ignored\n", streaming ? "Streaming" : "Mapped mode",
+                       imageFormatExtension(outputFormat));
+
+            int configIndex = 0;
+            for (unsigned int numThreads = 1; numThreads <= 64; numThreads *= 2)
+            {
+                printf("\n=== Testing with %d thread(s) ===\n", numThreads);
+                if (streaming)
+                    renderStreaming(configIndex, numThreads);
+                else if (!renderMapped(configIndex, numThreads))
+                {
+                    printf("Mapped sweep stopped at %u thread(s)\n", numThreads);
+                    return 1;
+                }
+                configIndex++;
+            }
+
+            printf("\n=== All tests completed ===\n");
+            printf("\nPerformance Summary (compute / end-to-end):\n");
+            for (int i = 0; i < numConfigs; i++)
+            {
+                printf("%d thread(s): %lld ms / %lld ms", threadCounts[i], executionTimes[i], endToEndTimes[i]);
+                if (i > 0)
+                {
+                    float speedup = (float)endToEndTimes[0] / endToEndTimes[i];
+                    printf(" (end-to-end speedup: %.2fx)", speedup);
+                }
+                printf("\n");
+            }
+
+            if (tracePath != NULL)
+                traceWrite(tracePath);
+            if (checksum)
+                return verifySweepImages(FORMAT_PPM, expectedMask) ? 0 : 1;
+            return 0;
+        }
+
         // Allocate memory for each image
         for (int i = 0; i < numConfigs; i++)
         {
@@ -145,6 +1966,8 @@
             
             // Measure execution time
             auto startTime = std::chrono::high_resolution_clock::now();
+            int64_t regionStart = traceNow();
+            energyMeter.start();
             
             std::vector<std::thread> threads;
             
@@ -157,7 +1980,8 @@
                 int startRow = t * rowsPerThread;
                 int endRow = (t == numThreads - 1) ? iYmax : (t + 1) * rowsPerThread;
                 
-                threads.push_back(std::thread(computeRows, images[configIndex], startRow, endRow, t, numThreads));
+                unsigned char* rows = images[configIndex] + (size_t)startRow * iXmax * 3;
+                threads.push_back(std::thread(computeRows, rows, startRow, endRow, t, numThreads));
             }
             
             // Wait for all threads to complete
@@ -167,7 +1991,12 @@
             }
             
             auto endTime = std::chrono::high_resolution_clock::now();
+            EnergySample energySample = energyMeter.stop();
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            char regionName[32];
+            snprintf(regionName, sizeof(regionName), "%u threads", numThreads);
+            traceRegion(regionName, regionStart);
+            energyReport.add(regionName, energySample, (double)iXmax * iYmax / 1e6);
             
             executionTimes[configIndex] = duration.count();
             printf("Computation complete in %lld ms\n", executionTimes[configIndex]);
@@ -180,20 +2009,17 @@
         // Write all images to files after all computations
         for (int i = 0; i < numConfigs; i++)
         {
-            char filename[100];
-            sprintf(filename, "mandelbrot_%d_threads.ppm", threadCounts[i]);
-            
-            /*create new file,give it a name and open it in binary mode  */
-            FILE* fp = fopen(filename,"wb"); /* b -  binary mode */
-            /*write ASCII header to the file*/
-            fprintf(fp,"P6\n %s\n %d\n %d\n %d\n",comment,iXmax,iYmax,MaxColorComponentValue);
-            
-            /* write image data bytes to the file*/
-            fwrite(images[i], 1, iXmax * iYmax * 3, fp);
-            
-            fclose(fp);
-            
-            printf("Image saved to %s (computed in %lld ms)\n", filename, executionTimes[i]);
+            char basename[100];
+            char filename[128];
+            sprintf(basename, "mandelbrot_%d_threads", threadCounts[i]);
+            imageFilename(filename, sizeof(filename), basename, outputFormat);
+
+            writeImage(filename, comment, images[i], iXmax, iYmax, outputFormat,
+                       std::thread::hardware_concurrency(), &encodeStats[i]);
+
+            printf("Image saved to %s (computed in %lld ms, ", filename, executionTimes[i]);
+            printEncodeStats(encodeStats[i]);
+            printf(")\n");
         }
         
         // Free allocated memory
@@ -214,6 +2040,21 @@
             }
             printf("\n");
         }
+
+        printf("\nOutput (%s):\n", imageFormatExtension(outputFormat));
+        for (int i = 0; i < numConfigs; i++)
+        {
+            printf("%d thread(s): ", threadCounts[i]);
+            printEncodeStats(encodeStats[i]);
+            printf("\n");
+        }
+
+        if (energyMode)
+            printEnergyReport(energyReport, "Thread sweep");
+        if (tracePath != NULL)
+            traceWrite(tracePath);
+        if (checksum)
+            return verifySweepImages(outputFormat, expectedMask) ? 0 : 1;
         
         return 0;
  }
\ No newline at end of file
@@ -1,6 +1,30 @@
 ﻿#include <stdio.h>
 #include <math.h>
+#include <stdlib.h>
 #include <omp.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "../common/image_encoder.h"
+#include "../common/mandelbrot_kernels.h"
+#include "../common/fractal_kernels.h"
+#include "../common/stream_writer.h"
+#include "../common/mapped_image.h"
+#include "../common/trace.h"
+#include "../common/buddhabrot.h"
+#include "../common/image_checksum.h"
+#include "../common/energy_meter.h"
+#ifdef USE_MPI
+#include "../common/distributed_render.h"
+#endif
+
+// build: g++ -O2 -fopenmp zad03.cpp -o zad03 -lz
+// mpi:   mpicxx -O2 -fopenmp -DUSE_MPI zad03.cpp -o zad03_mpi -lz
+//        mpirun -np 5 ./zad03_mpi --mpi
+// energy: --energy adds RAPL joules to the schedule table, --efficiency sweeps threads x schedules
+// verification: --checksum [--expect-mask hex] hashes the schedule images and compares their masks
+// orbit density: --buddhabrot | --anti-buddhabrot [--uniform] [--samples N]
+// other fractals: --fractal multibrot|burning-ship|julia [--power d] [--julia-c re im]
 
 // Global variables
 /* screen ( integer) coordinate */
@@ -14,20 +38,30 @@ const double CyMax = 2.0;
 /* */
 double PixelWidth = (CxMax - CxMin) / iXmax;
 double PixelHeight = (CyMax - CyMin) / iYmax;
-/* color component ( R or G or B) is coded from 0 to 255 */
-/* it is 24 bit color RGB file */
-const int MaxColorComponentValue = 255; 
-char *comment = "# "; /* comment should start with # */
+const char *comment = "Mandelbrot set"; /* written after "# " in the PPM header */
 
 /* */
 const int IterationMax = 200;
 /* bail-out value , radius of circle ;  */
 const double EscapeRadius = 2;
 double ER2 = EscapeRadius * EscapeRadius;
+/* arithmetic of the escape-time kernel, chosen from the pixel spacing unless --precision is given */
+const char* precisionReason = NULL;
+PrecisionTier precision = choosePrecision(PixelWidth, PixelHeight, CxMin, CxMax, CyMin, CyMax, &precisionReason);
+/* fractal family (--fractal): anything but z*z + c runs a compile-time specialised
+   kernel from common/fractal_kernels.h; Julia sets use the grid centred on 0 */
+FractalSpec fractal = {FRACTAL_MULTIBROT, 2, false, FRACTAL_DEFAULT_JULIA_RE, FRACTAL_DEFAULT_JULIA_IM};
+FractalRowKernel fractalKernel = NULL;
+double fractalCxMin = CxMin;
+double fractalER2 = ER2;
+char fractalComment[128];
 
 // Schedule types for testing
 const char* scheduleNames[] = {"static (default)", "static,1", "static,100", "dynamic", "dynamic,1", "dynamic,100", "guided", "auto"};
 const int numSchedules = 8;
+// The same schedules expressed for schedule(runtime), used by the streaming mode
+const omp_sched_t scheduleKinds[] = {omp_sched_static, omp_sched_static, omp_sched_static, omp_sched_dynamic, omp_sched_dynamic, omp_sched_dynamic, omp_sched_guided, omp_sched_auto};
+const int scheduleChunks[] = {0, 1, 100, 0, 1, 100, 0, 0};
 
 // Fixed number of threads for schedule comparison
 const int FIXED_THREADS = 8;
@@ -35,16 +69,63 @@ const int FIXED_THREADS = 8;
 // Allocate memory for all images - array of pointers to images
 unsigned char* images[numSchedules];
 double executionTimes[numSchedules];
+double endToEndTimes[numSchedules];
+
+// Output encoder (--format) and its statistics per schedule
+ImageFormat outputFormat = FORMAT_PPM;
+EncodeStats encodeStats[numSchedules];
+
+// Streaming mode (--stream): one block holds 100 rows per thread, so even
+// static,100 keeps every thread busy inside a block; two slots double-buffer
+const int STREAM_BLOCK_ROWS = FIXED_THREADS * 100;
+const int STREAM_SLOTS = 2;
+
+// Mapped mode (--mmap [--populate] [--hugepages]): rows are computed straight
+// into a memory-mapped PPM file
+unsigned mappedFlags = MAPPED_RELEASE;
+
+// Timeline tracing (--trace file.json): one span per row, one region per
+// schedule, written after the last schedule (common/trace.h)
+const char* tracePath = NULL;
+
+#ifdef USE_MPI
+// Distributed mode (--mpi): row bands rendered by MPI worker ranks, each with
+// an OpenMP team sized to its share of the node (common/distributed_render.h)
+const int MPI_BAND_ROWS = 64;
+int distributedThreads = 1;
+#endif
+
+// Energy (--energy): RAPL package and DRAM joules of every schedule;
+// --efficiency renders every thread count with every schedule and picks the
+// best Mpixel per joule (common/energy_meter.h)
+bool energyMode = false;
+EnergyMeter energyMeter;
+EnergyReport energyReport = {"Mpixel", {}};
+
+// Buddhabrot mode (--buddhabrot): samples/s of the orbit-density render for
+// 1 .. 64 threads and each histogram strategy (common/buddhabrot.h)
+const int buddhaThreadCounts[] = {1, 2, 4, 8, 16, 32, 64};
+const int numBuddhaThreadCounts = 7;
+
+// Every member of an OpenMP team of numThreads runs body
+void launchBuddhaTeam(int numThreads, void (*body)(BuddhaRun* run, int thread), BuddhaRun* run)
+{
+    #pragma omp parallel num_threads(numThreads)
+    {
+        body(run, omp_get_thread_num());
+    }
+}
 
 // Function to compute one row of the Mandelbrot set
 // This function is called by each thread for different rows
-void computeRow(int iY, unsigned char* image)
+// row points at the first pixel of row iY
+void computeRow(int iY, unsigned char* row)
 {
+    TraceScope span("row", iY, iY + 1);
     // Local variables - private to each thread
-    double Cx, Cy;
-    double Zx, Zy;
-    double Zx2, Zy2;
+    double Cy;
     int Iteration;
+    std::vector<int> rowIterations(iXmax);
     int iX;
     int pixelIndex;
     
@@ -81,47 +162,418 @@ void computeRow(int iY, unsigned char* image)
     threadColor[2] = (unsigned char)(b * 255);
     
     Cy = CyMin + iY * PixelHeight;
-    if (fabs(Cy) < PixelHeight/2) Cy = 0.0; /* Main antenna */
+    DD CyExact = ddGridCoordinate(ddFromDouble(CyMin), iY, PixelHeight);
+    if (fabs(Cy) < PixelHeight/2) /* Main antenna */
+    {
+        Cy = 0.0;
+        CyExact = ddFromDouble(0.0);
+    }
+    
+    /* Mandelbrot iteration for the whole row in the selected precision */
+    if (fractalKernel != NULL)
+        fractalKernel(fractalCxMin, PixelWidth, Cy, fractal.juliaRe, fractal.juliaIm,
+                      iXmax, IterationMax, fractalER2, rowIterations.data());
+    else
+        escapeRow(precision, ddFromDouble(CxMin), PixelWidth,
+                  precision == PRECISION_DOUBLE_DOUBLE ? CyExact : ddFromDouble(Cy),
+                  iXmax, IterationMax, ER2, rowIterations.data());
     
     for(iX = 0; iX < iXmax; iX++)
     {
-        Cx = CxMin + iX * PixelWidth;
-        /* initial value of orbit = critical point Z= 0 */
-        Zx = 0.0;
-        Zy = 0.0;
-        Zx2 = Zx * Zx;
-        Zy2 = Zy * Zy;
-        
-        /* Mandelbrot iteration */
-        for (Iteration = 0; Iteration < IterationMax && ((Zx2 + Zy2) < ER2); Iteration++)
-        {
-            Zy = 2 * Zx * Zy + Cy;
-            Zx = Zx2 - Zy2 + Cx;
-            Zx2 = Zx * Zx;
-            Zy2 = Zy * Zy;
-        }
+        Iteration = rowIterations[iX];
         
         /* compute pixel color (24 bit = 3 bytes) */
-        pixelIndex = (iY * iXmax + iX) * 3;
+        pixelIndex = iX * 3;
         if (Iteration == IterationMax)
         {
             /*  interior of Mandelbrot set = black */
-            image[pixelIndex] = 0;
-            image[pixelIndex + 1] = 0;
-            image[pixelIndex + 2] = 0;
+            row[pixelIndex] = 0;
+            row[pixelIndex + 1] = 0;
+            row[pixelIndex + 2] = 0;
         }
         else
         {
             /* exterior of Mandelbrot set = colored by thread */
-            image[pixelIndex] = threadColor[0];     /* Red */
-            image[pixelIndex + 1] = threadColor[1];  /* Green */
-            image[pixelIndex + 2] = threadColor[2];  /* Blue */
+            row[pixelIndex] = threadColor[0];     /* Red */
+            row[pixelIndex + 1] = threadColor[1];  /* Green */
+            row[pixelIndex + 2] = threadColor[2];  /* Blue */
+        }
+    }
+}
+
+// Create safe filename from schedule name (filename holds 128 chars)
+void scheduleFilename(int schedIdx, ImageFormat format, char* filename)
+{
+    const char* schedName = scheduleNames[schedIdx];
+    char safeScheduleName[50];
+    int j = 0;
+    for (int k = 0; schedName[k] != '\0' && j < 49; k++)
+    {
+        if (schedName[k] == ' ')
+            safeScheduleName[j++] = '_';
+        else if (schedName[k] == ',')
+            safeScheduleName[j++] = '_';
+        else if (schedName[k] == '(')
+            continue;
+        else if (schedName[k] == ')')
+            continue;
+        else
+            safeScheduleName[j++] = schedName[k];
+    }
+    safeScheduleName[j] = '\0';
+
+    char basename[100];
+    sprintf(basename, "mandelbrot_schedule_%s", safeScheduleName);
+    imageFilename(filename, 128, basename, format);
+}
+
+// Render one schedule through the streaming writer. Rows of a block are shared
+// with schedule(runtime); while the team works on block b the writer thread
+// is still flushing block b - 1.
+void renderStreaming(int schedIdx)
+{
+    char filename[128];
+    scheduleFilename(schedIdx, FORMAT_PPM, filename);
+
+    omp_set_schedule(scheduleKinds[schedIdx], scheduleChunks[schedIdx]);
+
+    double startTime = omp_get_wtime();
+    int64_t regionStart = traceNow();
+
+    StreamWriter writer(filename, comment, iXmax, iYmax, STREAM_BLOCK_ROWS, STREAM_SLOTS);
+    unsigned char* block = NULL;
+
+    #pragma omp parallel shared(block)
+    {
+        for (int b = 0; b < writer.blockCount(); b++)
+        {
+            #pragma omp single
+            block = writer.acquire(b);
+
+            int firstRow = writer.firstRow(b);
+            #pragma omp for schedule(runtime)
+            for (int iY = firstRow; iY < writer.lastRow(b); iY++)
+            {
+                computeRow(iY, block + (size_t)(iY - firstRow) * iXmax * 3);
+            }
+
+            #pragma omp single nowait
+            writer.publish(b);
+        }
+    }
+
+    double computeEnd = omp_get_wtime();
+    traceRegion(scheduleNames[schedIdx], regionStart);
+    bool written = writer.finish();
+    double endTime = omp_get_wtime();
+
+    executionTimes[schedIdx] = computeEnd - startTime;
+    endToEndTimes[schedIdx] = endTime - startTime;
+
+    printf("Computation complete in %.3f seconds, end-to-end %.3f seconds (ring buffer %.1f MB)\n",
+           executionTimes[schedIdx], endToEndTimes[schedIdx], writer.footprint() / (1024.0 * 1024.0));
+    if (written)
+        printf("Image streamed to %s\n", filename);
+    else
+        printf("Failed to write %s\n", filename);
+}
+
+// Render one schedule into its memory-mapped PPM file; each finished row is
+// reported so the pages behind the watermark can be dropped. False when the
+// file cannot be created or mapped, so no timing is recorded
+bool renderMapped(int schedIdx)
+{
+    char filename[128];
+    scheduleFilename(schedIdx, FORMAT_PPM, filename);
+
+    omp_set_schedule(scheduleKinds[schedIdx], scheduleChunks[schedIdx]);
+
+    double startTime = omp_get_wtime();
+    int64_t regionStart = traceNow();
+
+    MappedImage mapped;
+    if (!mapped.open(filename, comment, iXmax, iYmax, mappedFlags))
+        return false;
+
+    #pragma omp parallel for schedule(runtime)
+    for (int iY = 0; iY < iYmax; iY++)
+    {
+        computeRow(iY, mapped.row(iY));
+        mapped.rowsDone(iY, iY + 1);
+    }
+
+    double computeEnd = omp_get_wtime();
+    traceRegion(scheduleNames[schedIdx], regionStart);
+    bool written = mapped.close();
+    double endTime = omp_get_wtime();
+
+    executionTimes[schedIdx] = computeEnd - startTime;
+    endToEndTimes[schedIdx] = endTime - startTime;
+
+    printf("Computation complete in %.3f seconds, end-to-end %.3f seconds (%.1f MB mapped, %.1f MB released early)\n",
+           executionTimes[schedIdx], endToEndTimes[schedIdx],
+           mapped.fileBytes() / (1024.0 * 1024.0), mapped.released() / (1024.0 * 1024.0));
+    if (written)
+        printf("Image rendered into %s\n", filename);
+    else
+        printf("Failed to write %s\n", filename);
+    return true;
+}
+
+#ifdef USE_MPI
+void renderBand(int firstRow, int endRow, int worker, int numWorkers, unsigned char* rgb)
+{
+    (void)worker;
+    (void)numWorkers;
+    #pragma omp parallel for schedule(dynamic) num_threads(distributedThreads)
+    for (int iY = firstRow; iY < endRow; iY++)
+    {
+        computeRow(iY, rgb + (size_t)(iY - firstRow) * iXmax * 3);
+    }
+}
+#endif
+
+// Checksums (--checksum): every schedule's file, compared by its black interior
+bool verifyScheduleImages(ImageFormat format, const char* expectedMask)
+{
+    if (format != FORMAT_PPM)
+    {
+        printf("--checksum reads PPM files, --format %s was written\n", imageFormatExtension(format));
+        return false;
+    }
+    std::vector<std::string> filenames;
+    for (int schedIdx = 0; schedIdx < numSchedules; schedIdx++)
+    {
+        char filename[128];
+        scheduleFilename(schedIdx, format, filename);
+        filenames.push_back(filename);
+    }
+    const unsigned char interior[3] = {0, 0, 0};
+    return verifyImageChecksums(filenames, interior, expectedMask);
+}
+
+// Thread counts 1, 2, 4, ... and the logical CPU count, each with every
+// schedule through schedule(runtime), into one scratch image that is not written
+void runEfficiencySweep()
+{
+    int maxThreads = omp_get_num_procs();
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    std::vector<unsigned char> scratch((size_t)iXmax * iYmax * 3);
+    unsigned char* image = scratch.data();
+    EnergyReport report = {"Mpixel", {}};
+    printf("\n=== Efficiency sweep: %zu thread counts x %d schedules, %d x %d pixels ===\n",
+           threadCounts.size(), numSchedules, iXmax, iYmax);
+
+    for (size_t t = 0; t < threadCounts.size(); t++)
+    {
+        omp_set_num_threads(threadCounts[t]);
+        for (int schedIdx = 0; schedIdx < numSchedules; schedIdx++)
+        {
+            omp_set_schedule(scheduleKinds[schedIdx], scheduleChunks[schedIdx]);
+            char label[64];
+            snprintf(label, sizeof(label), "%d threads, %s", threadCounts[t], scheduleNames[schedIdx]);
+            int64_t regionStart = traceNow();
+            energyMeter.start();
+
+            #pragma omp parallel for shared(image) schedule(runtime)
+            for (int iY = 0; iY < iYmax; iY++)
+            {
+                computeRow(iY, image + (size_t)iY * iXmax * 3);
+            }
+
+            EnergySample sample = energyMeter.stop();
+            traceRegion(label, regionStart);
+            printf("%-40s %.3f seconds\n", label, sample.seconds);
+            report.add(label, sample, (double)iXmax * iYmax / 1e6);
         }
     }
+    printEnergyReport(report, "Thread count x schedule");
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    bool streaming = false;
+    bool mapped = false;
+    bool distributed = false;
+    FractalArgs fractalArgs = {0, false};
+    bool fractalValid = true;
+    bool buddhabrot = false;
+    bool checksum = false;
+    bool efficiency = false;
+    const char* expectedMask = NULL;
+    BuddhaConfig buddhaConfig = {BUDDHA_SIZE, BUDDHA_ITERATIONS, false, BUDDHA_METROPOLIS, BUDDHA_DEFAULT_SAMPLES};
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--stream") == 0)
+            streaming = true;
+        else if (strcmp(argv[i], "--mmap") == 0)
+            mapped = true;
+        else if (strcmp(argv[i], "--populate") == 0)
+            mappedFlags |= MAPPED_POPULATE;
+        else if (strcmp(argv[i], "--hugepages") == 0)
+            mappedFlags |= MAPPED_HUGEPAGES;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (strcmp(argv[i], "--mpi") == 0)
+            distributed = true;
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            if (!parseImageFormat(argv[++i], &outputFormat))
+            {
+                printf("Unknown format %s (expected ppm, qoi or png)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc)
+        {
+            if (strcmp(argv[++i], "auto") == 0)
+                precision = choosePrecision(PixelWidth, PixelHeight, CxMin, CxMax, CyMin, CyMax, &precisionReason);
+            else if (parsePrecision(argv[i], &precision))
+                precisionReason = "set by --precision";
+            else
+            {
+                printf("Unknown precision %s (expected auto, float, double or dd)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--energy") == 0)
+            energyMode = true;
+        else if (strcmp(argv[i], "--efficiency") == 0)
+            efficiency = true;
+        else if (strcmp(argv[i], "--checksum") == 0)
+            checksum = true;
+        else if (strcmp(argv[i], "--expect-mask") == 0 && i + 1 < argc)
+        {
+            checksum = true;
+            expectedMask = argv[++i];
+        }
+        else if (strcmp(argv[i], "--buddhabrot") == 0)
+            buddhabrot = true;
+        else if (strcmp(argv[i], "--anti-buddhabrot") == 0)
+        {
+            buddhabrot = true;
+            buddhaConfig.anti = true;
+            buddhaConfig.maxIter = BUDDHA_ANTI_ITERATIONS;
+        }
+        else if (strcmp(argv[i], "--uniform") == 0)
+            buddhaConfig.sampler = BUDDHA_UNIFORM;
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            buddhaConfig.samples = atoll(argv[++i]);
+        else if (parseFractalArg(argc, argv, &i, &fractal, &fractalArgs, &fractalValid))
+        {
+            if (!fractalValid)
+                return 1;
+        }
+    }
+    if (!resolveFractalArgs(fractalArgs, &fractal))
+        return 1;
+    if (!fractalIsMandelbrot(fractal))
+    {
+        fractalKernel = fractalRowKernel(fractal, precision);
+        fractalER2 = fractalEscapeRadius2(fractal, ER2);
+        if (fractal.julia)
+            fractalCxMin = -0.5 * (CxMax - CxMin);
+        fractalName(fractal, fractalComment, sizeof(fractalComment));
+        comment = fractalComment;
+    }
+    if (buddhabrot)
+    {
+        if (buddhaConfig.samples < 1)
+        {
+            printf("--samples must be at least 1\n");
+            return 1;
+        }
+        return runBuddhabrotScaling(buddhaConfig, buddhaThreadCounts, numBuddhaThreadCounts, outputFormat,
+                                    launchBuddhaTeam) ? 0 : 1;
+    }
+
+    if (distributed)
+    {
+#ifdef USE_MPI
+        int provided;
+        MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+        distributedThreads = distributedLocalThreads();
+        std::vector<int> order((iYmax + MPI_BAND_ROWS - 1) / MPI_BAND_ROWS);
+        for (size_t b = 0; b < order.size(); b++)
+            order[b] = (int)b;
+        distributedSweep("mandelbrot", comment, iXmax, iYmax, MPI_BAND_ROWS, order, renderBand);
+        MPI_Finalize();
+        return 0;
+#else
+        printf("--mpi needs the MPI build: mpicxx -O2 -fopenmp -DUSE_MPI zad03.cpp -o zad03_mpi -lz\n");
+        return 1;
+#endif
+    }
+
+    printf("Kernel precision: %s (%s)\n", precisionName(precision), precisionReason);
+    if (fractalKernel != NULL)
+        printf("Fractal: %s, specialised kernel in %s\n", comment,
+               precision == PRECISION_FLOAT ? "float" : "double");
+    if (tracePath != NULL)
+        traceEnable();
+    if (energyMode || efficiency)
+        energyMeter.open();
+
+    if (efficiency)
+    {
+        runEfficiencySweep();
+        if (tracePath != NULL)
+            traceWrite(tracePath);
+        return 0;
+    }
+
+    if (streaming || mapped)
+    {
+        omp_set_num_threads(FIXED_THREADS);
+
+        if (streaming)
+            printf("\n=== Streaming mode: %d threads, rendering overlapped with disk writes ===\n", FIXED_THREADS);
+        else
+            printf("\n=== Mapped mode: %d threads, rendering into memory-mapped files%s%s ===\n", FIXED_THREADS,
+                   (mappedFlags & MAPPED_POPULATE) ? ", populated" : "",
+                   (mappedFlags & MAPPED_HUGEPAGES) ? ", huge pages" : "");
+        printf("Image resolution: %d x %d pixels\n", iXmax, iYmax);
+        printf("Maximum iterations: %d\n\n", IterationMax);
+        if (outputFormat != FORMAT_PPM)
+            printf("%s writes raw PPM, --format %s is ignored\n", streaming ? "Streaming" : "Mapped mode",
+                   imageFormatExtension(outputFormat));
+
+        for (int schedIdx = 0; schedIdx < numSchedules; schedIdx++)
+        {
+            printf("\n=== Schedule: %s ===\n", scheduleNames[schedIdx]);
+            if (streaming)
+                renderStreaming(schedIdx);
+            else if (!renderMapped(schedIdx))
+            {
+                printf("Mapped sweep stopped at schedule %s\n", scheduleNames[schedIdx]);
+                return 1;
+            }
+        }
+
+        printf("\n=== Performance Summary ===\n");
+        printf("Schedule Strategy              | Compute (s) | End-to-end (s) | Speedup vs static\n");
+        printf("------------------------------------------------------------------------------\n");
+        for (int i = 0; i < numSchedules; i++)
+        {
+            printf("%-30s | %10.3f  | %13.3f  |", scheduleNames[i], executionTimes[i], endToEndTimes[i]);
+            if (i > 0)
+                printf(" %.2fx", endToEndTimes[0] / endToEndTimes[i]);
+            else
+                printf(" baseline");
+            printf("\n");
+        }
+
+        if (tracePath != NULL)
+            traceWrite(tracePath);
+        if (checksum)
+            return verifyScheduleImages(FORMAT_PPM, expectedMask) ? 0 : 1;
+        return 0;
+    }
+
     // Allocate memory for each image
     for (int i = 0; i < numSchedules; i++)
     {
@@ -142,6 +594,8 @@ int main()
         
         // Measure execution time with omp_get_wtime
         double startTime = omp_get_wtime();
+        int64_t regionStart = traceNow();
+        energyMeter.start();
         
         unsigned char* image = images[schedIdx];
         
@@ -152,7 +606,7 @@ int main()
                 #pragma omp parallel for shared(image) schedule(static)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
                 
@@ -160,7 +614,7 @@ int main()
                 #pragma omp parallel for shared(image) schedule(static, 1)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
                 
@@ -168,7 +622,7 @@ int main()
                 #pragma omp parallel for shared(image) schedule(static, 100)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
                 
@@ -176,7 +630,7 @@ int main()
                 #pragma omp parallel for shared(image) schedule(dynamic)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
                 
@@ -184,7 +638,7 @@ int main()
                 #pragma omp parallel for shared(image) schedule(dynamic, 1)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
                 
@@ -192,7 +646,7 @@ int main()
                 #pragma omp parallel for shared(image) schedule(dynamic, 100)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
                 
@@ -200,7 +654,7 @@ int main()
                 #pragma omp parallel for shared(image) schedule(guided)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
                 
@@ -208,13 +662,15 @@ int main()
                 #pragma omp parallel for shared(image) schedule(auto)
                 for(int iY = 0; iY < iYmax; iY++)
                 {
-                    computeRow(iY, image);
+                    computeRow(iY, image + (size_t)iY * iXmax * 3);
                 }
                 break;
         }
         
         double endTime = omp_get_wtime();
         double duration = endTime - startTime;
+        energyReport.add(scheduleNames[schedIdx], energyMeter.stop(), (double)iXmax * iYmax / 1e6);
+        traceRegion(scheduleNames[schedIdx], regionStart);
         
         executionTimes[schedIdx] = duration;
         printf("Computation complete in %.3f seconds\n", executionTimes[schedIdx]);
@@ -225,39 +681,15 @@ int main()
     // Write all images to files after all computations
     for (int i = 0; i < numSchedules; i++)
     {
-        char filename[100];
-        // Create safe filename from schedule name
-        const char* schedName = scheduleNames[i];
-        char safeScheduleName[50];
-        int j = 0;
-        for (int k = 0; schedName[k] != '\0' && j < 49; k++)
-        {
-            if (schedName[k] == ' ')
-                safeScheduleName[j++] = '_';
-            else if (schedName[k] == ',')
-                safeScheduleName[j++] = '_';
-            else if (schedName[k] == '(')
-                continue;
-            else if (schedName[k] == ')')
-                continue;
-            else
-                safeScheduleName[j++] = schedName[k];
-        }
-        safeScheduleName[j] = '\0';
-        
-        sprintf(filename, "mandelbrot_schedule_%s.ppm", safeScheduleName);
+        char filename[128];
+        scheduleFilename(i, outputFormat, filename);
         
-        /*create new file,give it a name and open it in binary mode  */
-        FILE* fp = fopen(filename,"wb"); /* b -  binary mode */
-        /*write ASCII header to the file*/
-        fprintf(fp,"P6\n %s\n %d\n %d\n %d\n",comment,iXmax,iYmax,MaxColorComponentValue);
+        writeImage(filename, comment, images[i], iXmax, iYmax, outputFormat,
+                   std::thread::hardware_concurrency(), &encodeStats[i]);
         
-        /* write image data bytes to the file*/
-        fwrite(images[i], 1, iXmax * iYmax * 3, fp);
-        
-        fclose(fp);
-        
-        printf("Image saved to %s (computed in %.3f seconds)\n", filename, executionTimes[i]);
+        printf("Image saved to %s (computed in %.3f seconds, ", filename, executionTimes[i]);
+        printEncodeStats(encodeStats[i]);
+        printf(")\n");
     }
     
     // Free allocated memory
@@ -293,6 +725,21 @@ int main()
     }
     
     printf("Best schedule: %s (%.3f seconds)\n", scheduleNames[bestIdx], executionTimes[bestIdx]);
+
+    printf("\nOutput (%s):\n", imageFormatExtension(outputFormat));
+    for (int i = 0; i < numSchedules; i++)
+    {
+        printf("%-30s | ", scheduleNames[i]);
+        printEncodeStats(encodeStats[i]);
+        printf("\n");
+    }
+
+    if (energyMode)
+        printEnergyReport(energyReport, "Schedules");
+    if (tracePath != NULL)
+        traceWrite(tracePath);
+    if (checksum)
+        return verifyScheduleImages(outputFormat, expectedMask) ? 0 : 1;
     
     return 0;
 }
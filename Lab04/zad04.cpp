@@ -3,47 +3,170 @@
 #include <omp.h>
 #include <stdlib.h>
 #include <string.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+#include "../common/image_encoder.h"
+#include "../common/prime_sieve.h"
+#include "../common/miller_rabin.h"
+#include "../common/tiled_tiff.h"
+#include "../common/mapped_image.h"
+#include "../common/trace.h"
+#include "../common/image_checksum.h"
+#include "../common/energy_meter.h"
+#include "../common/parallel_backend.h"
+#ifdef USE_MPI
+#include "../common/distributed_render.h"
+#endif
+#if __cplusplus >= 202002L
+#include "../common/render_pipeline.h"
+#endif
+
+// build: g++ -O2 -fopenmp zad04.cpp -o zad04 -lz
+// c++20: g++ -std=c++20 -O2 -fopenmp zad04.cpp -o zad04 -lz (--pipeline)
+// energy: ./zad04 --energy ranks the methods and schedules by Mpixel per joule (RAPL)
+// backends: g++ -O2 -fopenmp -DUSE_STD_PAR zad04.cpp -o zad04 -lz -ltbb (--backend par)
+// mpi:   mpicxx -O2 -fopenmp -DUSE_MPI zad04.cpp -o zad04_mpi -lz
+//        mpirun -np 5 ./zad04_mpi --mpi [--size N]
 
 // Global variables
-const int SIZE = 9999;  // Size of the spiral
-const int iXmax = SIZE; 
-const int iYmax = SIZE;
+int SIZE = 9999;  // Size of the spiral (--size N)
+long long spiralStart = 1;  // number at the centre of the spiral (--start N)
 
-// Configuration for nested parallel regions
-const int THREADS_X = 2;  // Number of threads in X direction
-const int THREADS_Y = 2;  // Number of threads in Y direction
-const int TOTAL_THREADS = THREADS_X * THREADS_Y;
+// Threads used by every method
+const int TOTAL_THREADS = 4;
 
-// Color definitions
-const int MaxColorComponentValue = 255; 
+// Quadtree task decomposition: a node becomes a leaf at the maximum depth,
+// below the cutoff area, or once its estimated cost is small enough
+int quadtreeMaxDepth = 8;          // --quadtree-depth N
+int quadtreeCutoff = 32 * 32;      // --quadtree-cutoff PIXELS
+const int QUADTREE_LEAVES_PER_THREAD = 16;
+const int QUADTREE_DEPTH_LIMIT = 16;
+int quadtreeLeaves[QUADTREE_DEPTH_LIMIT + 1];  // leaves per depth of the last run
 
 // Image buffers for comparison
-unsigned char* imageNested;
+unsigned char* imageQuadtree;
 unsigned char* imageHorizontal;
 unsigned char* imageScheduler;
 
+// Output encoder, selected with --format ppm|qoi|png
+ImageFormat outputFormat = FORMAT_PPM;
+
+// Mapped output (--mmap [--populate] [--hugepages]): every method computes
+// straight into its memory-mapped PPM file instead of a heap buffer
+bool mappedOutput = false;
+unsigned mappedFlags = MAPPED_RELEASE;
+MappedImage mappedQuadtree;
+MappedImage mappedHorizontal;
+
+// Timeline tracing (--trace file.json): spans per row, leaf or tile, one
+// region per method, written before exit (common/trace.h)
+const char* tracePath = NULL;
+
+// Distributed mode (--mpi, USE_MPI builds only): row bands handed out most
+// expensive first by estimateRegionCost, rendered by MPI worker ranks
+bool distributedMode = false;
+const int MPI_BAND_ROWS = 64;
+int distributedThreads = 1;
+
+// Pipeline mode (--pipeline, C++20 builds only): as many images as the
+// schedule sweep, written as ulam_pipeline_<i>, through the coroutine
+// compute -> colorize -> encode -> write pipeline on TOTAL_THREADS threads,
+// against the serialized flow (common/render_pipeline.h)
+bool pipelineMode = false;
+const int PIPELINE_BAND_ROWS = 16;
+
+// Checksums (--checksum [--expect-mask hex]): the written PPM files hashed in
+// parallel; their non-prime masks must agree (common/image_checksum.h)
+bool checksumMode = false;
+const char* expectedMask = NULL;
+
+// Energy (--energy): RAPL package and DRAM joules of every method and
+// schedule (common/energy_meter.h)
+bool energyMode = false;
+EnergyMeter energyMeter;
+EnergyReport energyReport = {"Mpixel", {}};
+
+// Backends (--backend threads|openmp|stealing|par|all): the spiral rendered by
+// each parallel-for backend for 1 .. TOTAL_THREADS threads, next to the
+// scheduling overhead of an empty body (common/parallel_backend.h)
+unsigned backendMask = 0;
+const int BACKEND_THREAD_COUNTS[] = { 1, 2, TOTAL_THREADS };
+const int NUM_BACKEND_THREAD_COUNTS = 3;
+const int BACKEND_GRAIN_ROWS = 4;
+
+// Shared read-only primality table, built once in main (--trial-division skips it)
+PrimeTable primeTable;
+bool useSieve = true;
+// Wheel bitmap cache reused across runs (--prime-cache path, --no-prime-cache)
+const char* primeCachePath = "ulam_primes.mod30";
+// Numbers above the sieve go to Miller-Rabin (--sieve-limit N)
+long long sieveLimit = 2000000000LL;
+const int PRIME_BATCH = 64;
+bool spiralBenchmark = false;  // --spiral-bench
+
+// Tiled renderer (--tiled): fixed-size tiles straight to a BigTIFF, one
+// sieve window per ring of tiles, Miller-Rabin where windows would start
+// above WINDOW_SIEVE_LIMIT (base primes up to its square root) or would need
+// more than WINDOW_MAX_BYTES. A ring's window grows with its radius (the
+// outer rings need 50-70 bytes per pixel of SIZE, ~70 MB near SIZE 1e6), so
+// the cap is what keeps memory bounded for large spirals.
+bool tiledMode = false;
+const int TILED_TILE = 256;
+const long long WINDOW_SIEVE_LIMIT = 1000000000000LL;
+const long long WINDOW_MAX_BYTES = 32LL * 1024 * 1024;
+
+// Analytics (--analyze): prime counts per diagonal, anti-diagonal and ring,
+// and quadratics n^2 + b n + c with |b|, |c| <= --poly-range ranked over
+// --poly-terms values (plus each --poly a,b,c); CSV or --analysis-json
+bool analysisMode = false;
+bool analysisJson = false;
+const char* analysisBasename = "ulam_analysis";  // --analysis-out
+long long polynomialRange = 50;
+int polynomialTerms = 10000;
+const long long POLYNOMIAL_COEFF_LIMIT = 1000000;
+const int POLYNOMIAL_TERMS_LIMIT = 1000000;
+const size_t ANALYSIS_TOP = 10;
+// Prime density of f(n) = a n^2 + b n + c over n = 0 .. terms - 1 (|f(n)| is
+// tested, as usual for Euler-type polynomials)
+struct PolynomialScore
+{
+    long long a;
+    long long b;
+    long long c;
+    int primes;
+    int run;  // consecutive primes from n = 0
+};
+
+std::vector<PolynomialScore> extraPolynomials;
+
 struct ScheduleConfig
 {
     omp_sched_t type;
     int chunkSize;
     const char* label;
-    const char* filename;
+    const char* basename;
 };
 
 const ScheduleConfig SCHEDULE_CONFIGS[] =
 {
-    { omp_sched_static, 0,   "static (default chunk)", "ulam_spiral_schedule_static_default.ppm" },
-    { omp_sched_static, 100, "static (chunk = 100)",  "ulam_spiral_schedule_static_100.ppm" },
-    { omp_sched_dynamic, 1,  "dynamic (chunk = 1)",   "ulam_spiral_schedule_dynamic_1.ppm" },
-    { omp_sched_dynamic, 100,"dynamic (chunk = 100)",  "ulam_spiral_schedule_dynamic_100.ppm" },
-    { omp_sched_guided, 0,   "guided",                 "ulam_spiral_schedule_guided.ppm" },
-    { omp_sched_auto, 0,     "auto",                   "ulam_spiral_schedule_auto.ppm" }
+    { omp_sched_static, 0,   "static (default chunk)", "ulam_spiral_schedule_static_default" },
+    { omp_sched_static, 100, "static (chunk = 100)",  "ulam_spiral_schedule_static_100" },
+    { omp_sched_dynamic, 1,  "dynamic (chunk = 1)",   "ulam_spiral_schedule_dynamic_1" },
+    { omp_sched_dynamic, 100,"dynamic (chunk = 100)",  "ulam_spiral_schedule_dynamic_100" },
+    { omp_sched_guided, 0,   "guided",                 "ulam_spiral_schedule_guided" },
+    { omp_sched_auto, 0,     "auto",                   "ulam_spiral_schedule_auto" }
 };
 
 const int NUM_SCHEDULES = sizeof(SCHEDULE_CONFIGS) / sizeof(SCHEDULE_CONFIGS[0]);
 
 void computeThreadColor(int threadId, int totalThreads, unsigned char* threadColor);
-void writeImagePPM(const char* filename, const char* comment, const unsigned char* image);
+void colorSpiralRow(const int* iterations, const unsigned char* color, int count, unsigned char* row);
+void saveImage(const char* basename, const char* comment, const unsigned char* image);
+unsigned char* openMappedImage(MappedImage* mapped, const char* basename, const char* comment);
+void closeMappedImage(MappedImage* mapped, const char* basename, const char* comment);
+int pixelRing(int x, int y);
 double runSchedulerExperiment(const ScheduleConfig& config, unsigned char* image);
 
 // Function to check if a number is prime and return number of iterations
@@ -63,6 +186,24 @@ int isPrime(long long n)
     return iterations;
 }
 
+// isPrime(n) for a prime n: the trial-division loop runs to the end, so its
+// iteration count is the number of i = 5, 11, 17, ... with i * i <= n (0
+// below 25, so the primes 5 .. 23 stay grey exactly as before)
+int primeIterations(long long n)
+{
+    if (n <= 3)
+        return 1;
+    long long root = integerSqrt(n);
+    return root < 5 ? 0 : (int)((root - 5) / 6 + 1);
+}
+
+// Largest number getSpiralNumber can return: the outermost ring is complete
+long long maxSpiralNumber()
+{
+    long long side = 2 * (long long)(SIZE / 2) + 1;
+    return side * side;
+}
+
 // Function to calculate spiral coordinates and return the number at position (x, y)
 long long getSpiralNumber(int x, int y)
 {
@@ -73,7 +214,7 @@ long long getSpiralNumber(int x, int y)
     
     if (ring == 0) return 1;
     
-    long long maxNumInPrevRing = (2 * ring - 1) * (2 * ring - 1);
+    long long maxNumInPrevRing = (2 * (long long)ring - 1) * (2 * (long long)ring - 1);
     long long numInRing = maxNumInPrevRing;
     
     if (cx == ring)
@@ -96,69 +237,171 @@ long long getSpiralNumber(int x, int y)
     return numInRing;
 }
 
-// Function to compute one block with nested parallelism
-void computeQuadrantNested(int blockX, int blockY, unsigned char* image)
+long long spiralValue(int x, int y)
 {
-    int midX = SIZE / 2;
-    int midY = SIZE / 2;
-    
-    int startX = blockX * midX;
-    int endX = (blockX + 1) * midX;
-    int startY = blockY * midY;
-    int endY = (blockY + 1) * midY;
-    
-    int threadId = blockY * THREADS_X + blockX;
-    
-    unsigned char threadColor[3];
-    float hue = (float)threadId / 4.0f;
-    float saturation = 1.0f;
-    float value = 1.0f;
-    
-    int h_i = (int)(hue * 6);
-    float f = hue * 6 - h_i;
-    float p = value * (1 - saturation);
-    float q = value * (1 - f * saturation);
-    float t = value * (1 - (1 - f) * saturation);
-    
-    float r, g, b;
-    switch(h_i)
+    return getSpiralNumber(x, y) + spiralStart - 1;
+}
+
+// spiralValue() of the pixels [startX, endX) of row y. Along a row the ring is
+// -cx left of the diagonals, |cy| between them and cx right of them, so the
+// row is three branch-free segments (a = |cy|):
+//   left   cx < -a:    (2r-1)^2 + 5r - cy,  r = -cx
+//   middle |cx| <= a:  (2a-1)^2 + 3a - cx (cy >= 0) or (2a-1)^2 + 7a + cx (cy < 0)
+//   right  cx > a:     (2r-1)^2 + r + cy,   r = cx
+// getSpiralNumber tests cx == ring first, so the corner cx = a, cy = -a is
+// (2a-1)^2 instead of continuing the bottom side.
+void spiralRow(int y, int startX, int endX, long long* numbers)
+{
+    int half = SIZE / 2;
+    long long cy = y - half;
+    long long a = cy < 0 ? -cy : cy;
+    long long offset = spiralStart - 1;
+    long long corner = (2 * a - 1) * (2 * a - 1) + offset;
+
+    int leftEnd = (int)fmin(fmax(half - a, startX), endX);
+    int rightStart = (int)fmin(fmax(half + a + 1, startX), endX);
+
+    for (int x = startX; x < leftEnd; x++)
     {
-        case 0: r = value; g = t; b = p; break;
-        case 1: r = q; g = value; b = p; break;
-        case 2: r = p; g = value; b = t; break;
-        case 3: r = p; g = q; b = value; break;
-        case 4: r = t; g = p; b = value; break;
-        default: r = value; g = p; b = q; break;
+        long long r = half - x;
+        numbers[x - startX] = (2 * r - 1) * (2 * r - 1) + 5 * r - cy + offset;
     }
-    
-    threadColor[0] = (unsigned char)(r * 255);
-    threadColor[1] = (unsigned char)(g * 255);
-    threadColor[2] = (unsigned char)(b * 255);
-    
-    for (int y = startY; y < endY; y++)
+    if (cy >= 0)
+    {
+        for (int x = leftEnd; x < rightStart; x++)
+            numbers[x - startX] = corner + 3 * a - (x - half);
+    }
+    else
+    {
+        for (int x = leftEnd; x < rightStart; x++)
+            numbers[x - startX] = corner + 7 * a + (x - half);
+        if (half + a >= startX && half + a < endX)
+            numbers[half + a - startX] = corner;
+    }
+    for (int x = rightStart; x < endX; x++)
+    {
+        long long r = x - half;
+        numbers[x - startX] = (2 * r - 1) * (2 * r - 1) + r + cy + offset;
+    }
+}
+
+// Micro-benchmark: getSpiralNumber per pixel vs spiralRow, checked for equality
+void runSpiralBenchmark()
+{
+    std::vector<long long> row(SIZE);
+    long long checksum = 0;
+    double startTime = omp_get_wtime();
+    for (int y = 0; y < SIZE; y++)
     {
-        for (int x = startX; x < endX; x++)
+        for (int x = 0; x < SIZE; x++)
+            row[x] = spiralValue(x, y);
+        checksum += row[y % SIZE];
+    }
+    double perPixel = omp_get_wtime() - startTime;
+
+    long long rowChecksum = 0;
+    startTime = omp_get_wtime();
+    for (int y = 0; y < SIZE; y++)
+    {
+        spiralRow(y, 0, SIZE, row.data());
+        rowChecksum += row[y % SIZE];
+    }
+    double perRow = omp_get_wtime() - startTime;
+
+    long long mismatches = 0;
+    std::vector<long long> segment(SIZE);
+    for (int y = 0; y < SIZE; y++)
+    {
+        int startX = (y * 7) % SIZE;  // also exercise partial rows
+        spiralRow(y, 0, SIZE, row.data());
+        spiralRow(y, startX, SIZE, segment.data());
+        for (int x = 0; x < SIZE; x++)
         {
-            long long num = getSpiralNumber(x, y);
-            int pixelIndex = (y * SIZE + x) * 3;
-            
-            int iterations = isPrime(num);
-            if (iterations > 0)
-            {
-                // Intensywność koloru zależna od liczby iteracji
-                float intensity = fminf(1.0f, iterations / 50.0f);
-                image[pixelIndex] = (unsigned char)(threadColor[0] * intensity);
-                image[pixelIndex + 1] = (unsigned char)(threadColor[1] * intensity);
-                image[pixelIndex + 2] = (unsigned char)(threadColor[2] * intensity);
-            }
-            else
+            mismatches += row[x] != spiralValue(x, y);
+            if (x >= startX)
+                mismatches += segment[x - startX] != row[x];
+        }
+    }
+
+    double pixels = (double)SIZE * SIZE;
+    printf("Spiral numbering, %d x %d pixels\n", SIZE, SIZE);
+    printf("getSpiralNumber per pixel | %7.3f s | %6.2f ns/pixel\n", perPixel, perPixel * 1e9 / pixels);
+    printf("spiralRow per row         | %7.3f s | %6.2f ns/pixel | %.2fx faster\n",
+           perRow, perRow * 1e9 / pixels, perPixel / perRow);
+    printf("Mismatches: %lld%s\n", mismatches, checksum == rowChecksum ? "" : " (checksum differs)");
+}
+
+// Exact primality of `count` numbers: the prime table answers the numbers it
+// covers, the rest is gathered for batched Miller-Rabin
+void primeFlags(const PrimeTable& table, const long long* numbers, int count, char* prime)
+{
+    uint64_t pending[PRIME_BATCH];
+    int slot[PRIME_BATCH];
+    bool result[PRIME_BATCH];
+    int numPending = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        long long num = numbers[i];
+        if (num < 2)
+        {
+            prime[i] = 0;
+        }
+        else if (primeTableCovers(table, num))
+        {
+            prime[i] = primeTableTest(table, num);
+        }
+        else
+        {
+            pending[numPending] = (uint64_t)num;
+            slot[numPending] = i;
+            numPending++;
+        }
+
+        if (numPending == PRIME_BATCH || (i == count - 1 && numPending > 0))
+        {
+            isPrime64Batch(pending, numPending, result);
+            for (int k = 0; k < numPending; k++)
             {
-                // Jasno szare tło dla liczb niepierw
-                image[pixelIndex] = 200;
-                image[pixelIndex + 1] = 200;
-                image[pixelIndex + 2] = 200;
+                prime[slot[k]] = result[k];
             }
+            numPending = 0;
+        }
+    }
+}
+
+// Per-thread buffers of spiralRowIterations, sized for the widest row the
+// thread renders, so the row loop does not allocate
+struct SpiralRowScratch
+{
+    std::vector<long long> numbers;
+    std::vector<char> prime;
+
+    explicit SpiralRowScratch(int width) : numbers(width), prime(width) {}
+};
+
+// isPrime() of the pixels [startX, endX) of row y, from the exact test unless
+// --trial-division asked for the original loop
+void spiralRowIterations(const PrimeTable& table, int y, int startX, int endX, int* iterations,
+                         SpiralRowScratch* scratch)
+{
+    int count = endX - startX;
+    long long* numbers = scratch->numbers.data();
+    spiralRow(y, startX, endX, numbers);
+    if (!useSieve)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            iterations[i] = isPrime(numbers[i]);
         }
+        return;
+    }
+
+    char* prime = scratch->prime.data();
+    primeFlags(table, numbers, count, prime);
+    for (int i = 0; i < count; i++)
+    {
+        iterations[i] = prime[i] ? primeIterations(numbers[i]) : 0;
     }
 }
 
@@ -190,176 +433,1294 @@ void computeThreadColor(int threadId, int totalThreads, unsigned char* threadCol
     threadColor[2] = (unsigned char)(b * 255);
 }
 
-void writeImagePPM(const char* filename, const char* comment, const unsigned char* image)
+// Pixels of one row: primes in `color`, brighter with more iterations,
+// everything else light grey
+void colorSpiralRow(const int* iterations, const unsigned char* color, int count, unsigned char* row)
 {
-    FILE* fp = fopen(filename, "wb");
-    if (fp == NULL)
+    for (int x = 0; x < count; x++)
+    {
+        unsigned char* pixel = row + (size_t)x * 3;
+        if (iterations[x] > 0)
+        {
+            float intensity = fminf(1.0f, iterations[x] / 50.0f);
+            pixel[0] = (unsigned char)(color[0] * intensity);
+            pixel[1] = (unsigned char)(color[1] * intensity);
+            pixel[2] = (unsigned char)(color[2] * intensity);
+        }
+        else
+        {
+            pixel[0] = 200;
+            pixel[1] = 200;
+            pixel[2] = 200;
+        }
+    }
+}
+
+void saveImage(const char* basename, const char* comment, const unsigned char* image)
+{
+    char filename[256];
+    imageFilename(filename, sizeof(filename), basename, outputFormat);
+
+    EncodeStats stats;
+    if (!writeImage(filename, comment, image, SIZE, SIZE, outputFormat, std::thread::hardware_concurrency(), &stats))
+    {
+        return;
+    }
+    printf("Image saved to %s (%s, ", filename, comment);
+    printEncodeStats(stats);
+    printf(")\n");
+}
+
+// Create basename.ppm at full size and map it; NULL if that fails
+unsigned char* openMappedImage(MappedImage* mapped, const char* basename, const char* comment)
+{
+    char filename[256];
+    imageFilename(filename, sizeof(filename), basename, FORMAT_PPM);
+    if (!mapped->open(filename, comment, SIZE, SIZE, mappedFlags))
+    {
+        return NULL;
+    }
+    return mapped->pixels();
+}
+
+// Unmap a finished image; the page cache writes it back
+void closeMappedImage(MappedImage* mapped, const char* basename, const char* comment)
+{
+    char filename[256];
+    imageFilename(filename, sizeof(filename), basename, FORMAT_PPM);
+    size_t released = mapped->released();
+    if (!mapped->close())
     {
         printf("Failed to write %s\n", filename);
         return;
     }
+    printf("Image rendered into %s (%s, %.1f MB mapped, %.1f MB released early)\n", filename, comment,
+           mapped->fileBytes() / (1024.0 * 1024.0), released / (1024.0 * 1024.0));
+}
 
-    fprintf(fp, "P6\n# %s\n%d\n%d\n%d\n", comment, SIZE, SIZE, MaxColorComponentValue);
-    fwrite(image, 1, SIZE * SIZE * 3, fp);
-    fclose(fp);
-    printf("Image saved to %s (%s)\n", filename, comment);
+// Smallest and largest pixel ring inside the tile (tx, ty)
+void tileRingRange(int tx, int ty, int* minRing, int* maxRing)
+{
+    int half = SIZE / 2;
+    int x0 = tx * TILED_TILE;
+    int y0 = ty * TILED_TILE;
+    int x1 = (int)fmin(x0 + TILED_TILE, SIZE) - 1;
+    int y1 = (int)fmin(y0 + TILED_TILE, SIZE) - 1;
+    int dx = (half >= x0 && half <= x1) ? 0 : (int)fmin(abs(x0 - half), abs(x1 - half));
+    int dy = (half >= y0 && half <= y1) ? 0 : (int)fmin(abs(y0 - half), abs(y1 - half));
+    *minRing = (int)fmax(dx, dy);
+    *maxRing = (int)fmax(fmax(abs(x0 - half), abs(x1 - half)), fmax(abs(y0 - half), abs(y1 - half)));
 }
 
-// Function to compute horizontal strips
-void computeHorizontalStrip(int stripId, int numStrips, unsigned char* image)
+// Render one tile (padded to TILED_TILE x TILED_TILE with black)
+void computeTile(const PrimeTable& window, int tx, int ty, unsigned char* tile, int* rowIterations,
+                 SpiralRowScratch* scratch)
 {
-    int startY = (SIZE * stripId) / numStrips;
-    int endY = (SIZE * (stripId + 1)) / numStrips;
-    
+    long long tileIndex = (long long)ty * ((SIZE + TILED_TILE - 1) / TILED_TILE) + tx;
+    TraceScope span("tile", tileIndex, tileIndex + 1);
     unsigned char threadColor[3];
-    computeThreadColor(stripId, numStrips, threadColor);
-    
-    for (int y = startY; y < endY; y++)
+    computeThreadColor(omp_get_thread_num(), omp_get_num_threads(), threadColor);
+
+    int x0 = tx * TILED_TILE;
+    int y0 = ty * TILED_TILE;
+    int width = (int)fmin(TILED_TILE, SIZE - x0);
+    int height = (int)fmin(TILED_TILE, SIZE - y0);
+    memset(tile, 0, (size_t)TILED_TILE * TILED_TILE * 3);
+
+    for (int row = 0; row < height; row++)
     {
-        for (int x = 0; x < SIZE; x++)
+        spiralRowIterations(window, y0 + row, x0, x0 + width, rowIterations, scratch);
+        colorSpiralRow(rowIterations, threadColor, width, tile + (size_t)row * TILED_TILE * 3);
+    }
+}
+
+// Gigapixel mode: tiles are rendered ring by ring (Chebyshev distance from
+// the centre tile) because a ring of tiles spans a narrow band of spiral
+// numbers; that band is sieved into a window, the tiles are rendered in
+// parallel and pwrite() puts each one at its fixed place in the file. Memory
+// is one window (at most WINDOW_MAX_BYTES, rings beyond it use Miller-Rabin)
+// plus one tile per thread.
+int runTiledRenderer()
+{
+    const char* filename = "ulam_spiral_tiled.tif";
+    char description[128];
+    snprintf(description, sizeof(description), "Ulam spiral %d x %d from %lld", SIZE, SIZE, spiralStart);
+
+    TiledTiffWriter writer;
+    if (!writer.open(filename, description, SIZE, SIZE, TILED_TILE))
+    {
+        return 1;
+    }
+
+    int numThreads = omp_get_max_threads();
+    int tilesX = (int)writer.tilesX();
+    int tilesY = (int)writer.tilesY();
+    int centreTile = (SIZE / 2) / TILED_TILE;
+    int numRings = (int)fmax(fmax(centreTile, tilesX - 1 - centreTile), fmax(centreTile, tilesY - 1 - centreTile)) + 1;
+    long long offset = spiralStart - 1;
+
+    printf("=== Tiled renderer: %d x %d pixels, %d x %d tiles of %d, %d threads ===\n",
+           SIZE, SIZE, tilesX, tilesY, TILED_TILE, numThreads);
+
+    std::vector<int> basePrimes;
+    long long largestValue = maxSpiralNumber() + offset;
+    if (useSieve)
+    {
+        sieveBasePrimes(integerSqrt((long long)fmin((double)largestValue, (double)WINDOW_SIEVE_LIMIT)) + 1, &basePrimes);
+    }
+
+    PrimeTable window = PrimeTable();
+    size_t peakWindowBytes = 0;
+    long long windowTiles = 0;
+    long long millerRabinTiles = 0;
+    double sieveSeconds = 0.0;
+    std::vector<int> tileX, tileY;
+    double startTime = omp_get_wtime();
+    int64_t regionStart = traceNow();
+
+    for (int ring = 0; ring < numRings; ring++)
+    {
+        // Tiles of this ring and the spiral rings they cover
+        tileX.clear();
+        tileY.clear();
+        int minRing = SIZE, maxRing = 0;
+        for (int ty = centreTile - ring; ty <= centreTile + ring; ty++)
         {
-            long long num = getSpiralNumber(x, y);
-            int pixelIndex = (y * SIZE + x) * 3;
-            
-            int iterations = isPrime(num);
-            if (iterations > 0)
+            if (ty < 0 || ty >= tilesY)
+                continue;
+            bool edgeRow = ty == centreTile - ring || ty == centreTile + ring;
+            for (int tx = centreTile - ring; tx <= centreTile + ring; tx += edgeRow ? 1 : 2 * (int)fmax(ring, 1))
             {
-                // Intensywność koloru zależna od liczby iteracji
-                float intensity = fminf(1.0f, iterations / 50.0f);
-                image[pixelIndex] = (unsigned char)(threadColor[0] * intensity);
-                image[pixelIndex + 1] = (unsigned char)(threadColor[1] * intensity);
-                image[pixelIndex + 2] = (unsigned char)(threadColor[2] * intensity);
+                if (tx < 0 || tx >= tilesX)
+                    continue;
+                tileX.push_back(tx);
+                tileY.push_back(ty);
+                int lo, hi;
+                tileRingRange(tx, ty, &lo, &hi);
+                minRing = (int)fmin(minRing, lo);
+                maxRing = (int)fmax(maxRing, hi);
             }
-            else
+        }
+        if (tileX.empty())
+            continue;
+
+        long long firstNumber = (minRing == 0 ? 1 : (2LL * minRing - 1) * (2LL * minRing - 1)) + offset;
+        long long lastNumber = (2LL * maxRing + 1) * (2LL * maxRing + 1) + offset;
+        closePrimeTable(&window);
+        long long windowBytes = lastNumber / WHEEL - firstNumber / WHEEL + 1;
+        if (useSieve && lastNumber <= WINDOW_SIEVE_LIMIT && windowBytes <= WINDOW_MAX_BYTES)
+        {
+            double sieveStart = omp_get_wtime();
+            buildPrimeWindow(firstNumber, lastNumber, basePrimes, numThreads, &window);
+            sieveSeconds += omp_get_wtime() - sieveStart;
+            peakWindowBytes = (size_t)fmax((double)peakWindowBytes, (double)window.numBytes);
+            windowTiles += (long long)tileX.size();
+        }
+        else
+        {
+            millerRabinTiles += (long long)tileX.size();
+        }
+
+        int count = (int)tileX.size();
+        #pragma omp parallel num_threads(numThreads)
+        {
+            std::vector<unsigned char> tile((size_t)TILED_TILE * TILED_TILE * 3);
+            std::vector<int> rowIterations(TILED_TILE);
+            SpiralRowScratch scratch(TILED_TILE);
+
+            #pragma omp for schedule(dynamic)
+            for (int i = 0; i < count; i++)
             {
-                // Jasno szare tło dla liczb niepierw
-                image[pixelIndex] = 200;
-                image[pixelIndex + 1] = 200;
-                image[pixelIndex + 2] = 200;
+                computeTile(window, tileX[i], tileY[i], tile.data(), rowIterations.data(), &scratch);
+                writer.writeTile(tileX[i], tileY[i], tile.data());
             }
         }
     }
+    closePrimeTable(&window);
+
+    traceRegion("tiled render", regionStart);
+    bool ok = writer.close();
+    double duration = omp_get_wtime() - startTime;
+    size_t tileBufferBytes = (size_t)numThreads * TILED_TILE * (TILED_TILE * 3 + sizeof(int));
+
+    printf("Tile rings: %d, tiles from sieve windows: %lld, tiles by Miller-Rabin: %lld\n",
+           numRings, windowTiles, millerRabinTiles);
+    printf("Peak sieve window %.1f MB + tile buffers %.1f MB, sieving %.3f s\n",
+           peakWindowBytes / (1024.0 * 1024.0), tileBufferBytes / (1024.0 * 1024.0), sieveSeconds);
+    printf("Tiled render complete in %.3f seconds (%.1f Mpixel/s)\n",
+           duration, (double)SIZE * SIZE / duration / 1e6);
+    if (!ok)
+    {
+        printf("Failed to write %s\n", filename);
+        return 1;
+    }
+    printf("Image saved to %s (%.1f MB)\n", filename, writer.fileBytes() / (1024.0 * 1024.0));
+    return 0;
 }
 
-double runSchedulerExperiment(const ScheduleConfig& config, unsigned char* image)
+// Prime counts along the spiral geometry, gathered in one pass over the rows
+struct SpiralAnalysis
 {
-    omp_set_nested(0);
-    omp_set_num_threads(TOTAL_THREADS);
-    omp_set_schedule(config.type, config.chunkSize);
+    std::vector<long long> diagonalPrimes;      // x - y = k, index k + SIZE - 1
+    std::vector<long long> antiDiagonalPrimes;  // x + y = k, index k
+    std::vector<long long> ringPrimes;
+    std::vector<long long> ringPixels;
+};
 
-    size_t bufferSize = (size_t)SIZE * (size_t)SIZE * 3;
-    memset(image, 200, bufferSize);
+// Pixels on the diagonal x - y = k and the anti-diagonal x + y = k
+long long diagonalLength(int k)
+{
+    return SIZE - abs(k);
+}
 
-    double startTime = omp_get_wtime();
+long long antiDiagonalLength(int k)
+{
+    return (long long)std::min(k, 2 * SIZE - 2 - k) + 1;
+}
+
+// Rows are shared dynamically; every thread counts into its own arrays,
+// which are merged once at the end
+void analyzeSpiral(SpiralAnalysis* analysis)
+{
+    int numLines = 2 * SIZE - 1;
+    int numRings = SIZE / 2 + 1;
+    analysis->diagonalPrimes.assign(numLines, 0);
+    analysis->antiDiagonalPrimes.assign(numLines, 0);
+    analysis->ringPrimes.assign(numRings, 0);
+    analysis->ringPixels.assign(numRings, 0);
 
     #pragma omp parallel
     {
-        int threadId = omp_get_thread_num();
-        int totalThreads = omp_get_num_threads();
-        unsigned char threadColor[3];
-        computeThreadColor(threadId, totalThreads, threadColor);
+        std::vector<long long> diagonal(numLines, 0);
+        std::vector<long long> antiDiagonal(numLines, 0);
+        std::vector<long long> ringPrimes(numRings, 0);
+        std::vector<long long> ringPixels(numRings, 0);
+        std::vector<long long> numbers(SIZE);
+        std::vector<char> prime(SIZE);
 
-        #pragma omp for schedule(runtime)
+        #pragma omp for schedule(dynamic, 16)
         for (int y = 0; y < SIZE; y++)
         {
+            TraceScope span("row", y, y + 1);
+            spiralRow(y, 0, SIZE, numbers.data());
+            primeFlags(primeTable, numbers.data(), SIZE, prime.data());
             for (int x = 0; x < SIZE; x++)
             {
-                long long num = getSpiralNumber(x, y);
-                int pixelIndex = (y * SIZE + x) * 3;
+                int ring = pixelRing(x, y);
+                ringPixels[ring]++;
+                if (prime[x])
+                {
+                    diagonal[x - y + SIZE - 1]++;
+                    antiDiagonal[x + y]++;
+                    ringPrimes[ring]++;
+                }
+            }
+        }
+
+        #pragma omp critical
+        {
+            for (int k = 0; k < numLines; k++)
+            {
+                analysis->diagonalPrimes[k] += diagonal[k];
+                analysis->antiDiagonalPrimes[k] += antiDiagonal[k];
+            }
+            for (int r = 0; r < numRings; r++)
+            {
+                analysis->ringPrimes[r] += ringPrimes[r];
+                analysis->ringPixels[r] += ringPixels[r];
+            }
+        }
+    }
+}
+
+// Score every candidate polynomial, one polynomial per iteration
+void scorePolynomials(std::vector<PolynomialScore>* candidates)
+{
+    int numCandidates = (int)candidates->size();
 
-                int iterations = isPrime(num);
-                if (iterations > 0)
+    #pragma omp parallel
+    {
+        std::vector<long long> values(PRIME_BATCH);
+        char prime[PRIME_BATCH];
+
+        #pragma omp for schedule(dynamic, 4)
+        for (int i = 0; i < numCandidates; i++)
+        {
+            TraceScope span("polynomial", i, i + 1);
+            PolynomialScore& score = (*candidates)[i];
+            score.primes = 0;
+            score.run = 0;
+            bool inRun = true;
+            for (int first = 0; first < polynomialTerms; first += PRIME_BATCH)
+            {
+                int count = (int)fmin(PRIME_BATCH, polynomialTerms - first);
+                for (int k = 0; k < count; k++)
                 {
-                    // Intensywność koloru zależna od liczby iteracji
-                    float intensity = fminf(1.0f, iterations / 50.0f);
-                    image[pixelIndex] = (unsigned char)(threadColor[0] * intensity);
-                    image[pixelIndex + 1] = (unsigned char)(threadColor[1] * intensity);
-                    image[pixelIndex + 2] = (unsigned char)(threadColor[2] * intensity);
+                    long long n = first + k;
+                    long long value = (score.a * n + score.b) * n + score.c;
+                    values[k] = value < 0 ? -value : value;
                 }
-                else
+                primeFlags(primeTable, values.data(), count, prime);
+                for (int k = 0; k < count; k++)
                 {
-                    // Jasno szare tło dla liczb niepierw
-                    image[pixelIndex] = 200;
-                    image[pixelIndex + 1] = 200;
-                    image[pixelIndex + 2] = 200;
+                    score.primes += prime[k];
+                    inRun = inRun && prime[k];
+                    score.run += inRun;
                 }
             }
         }
     }
 
-    double endTime = omp_get_wtime();
-    double duration = endTime - startTime;
+    std::stable_sort(candidates->begin(), candidates->end(),
+                     [](const PolynomialScore& p, const PolynomialScore& q)
+                     {
+                         return p.primes != q.primes ? p.primes > q.primes : p.run > q.run;
+                     });
+}
 
-    char chunkBuffer[16];
-    if (config.chunkSize > 0)
+// Largest |f(n)| any candidate polynomial reaches, so the prime table can
+// cover the polynomial values as well as the spiral
+long long polynomialValueBound()
+{
+    long long n = polynomialTerms - 1;
+    long long bound = (n + polynomialRange) * n + polynomialRange;
+    for (size_t i = 0; i < extraPolynomials.size(); i++)
     {
-        snprintf(chunkBuffer, sizeof(chunkBuffer), "%d", config.chunkSize);
+        const PolynomialScore& p = extraPolynomials[i];
+        bound = std::max(bound, (llabs(p.a) * n + llabs(p.b)) * n + llabs(p.c));
     }
-    else if (config.type == omp_sched_auto)
+    return bound;
+}
+
+// Expected prime density around the numbers of ring r (prime number theorem)
+double ringExpectedDensity(int ring)
+{
+    double middle = 4.0 * ring * ring + spiralStart;
+    return middle > 2.0 ? 1.0 / log(middle) : 0.0;
+}
+
+bool writeAnalysisCsv(const SpiralAnalysis& analysis, const std::vector<PolynomialScore>& polynomials)
+{
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s_lines.csv", analysisBasename);
+    FILE* fp = fopen(filename, "w");
+    if (fp == NULL)
     {
-        snprintf(chunkBuffer, sizeof(chunkBuffer), "n/a");
+        printf("Failed to write %s\n", filename);
+        return false;
     }
-    else
+    fprintf(fp, "kind,offset,pixels,primes,density\n");
+    for (int k = 0; k < 2 * SIZE - 1; k++)
     {
-        snprintf(chunkBuffer, sizeof(chunkBuffer), "default");
+        long long length = diagonalLength(k - SIZE + 1);
+        fprintf(fp, "diagonal,%d,%lld,%lld,%.6f\n", k - SIZE + 1, length, analysis.diagonalPrimes[k],
+                (double)analysis.diagonalPrimes[k] / length);
     }
+    for (int k = 0; k < 2 * SIZE - 1; k++)
+    {
+        long long length = antiDiagonalLength(k);
+        fprintf(fp, "anti-diagonal,%d,%lld,%lld,%.6f\n", k, length, analysis.antiDiagonalPrimes[k],
+                (double)analysis.antiDiagonalPrimes[k] / length);
+    }
+    fclose(fp);
+    printf("Diagonals written to %s\n", filename);
 
-    printf("Schedule %-28s | chunk %7s | %7.3f s\n", config.label, chunkBuffer, duration);
-
-    writeImagePPM(config.filename, config.label, image);
+    snprintf(filename, sizeof(filename), "%s_rings.csv", analysisBasename);
+    fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Failed to write %s\n", filename);
+        return false;
+    }
+    fprintf(fp, "ring,pixels,primes,density,expected\n");
+    for (int r = 0; r < (int)analysis.ringPixels.size(); r++)
+    {
+        fprintf(fp, "%d,%lld,%lld,%.6f,%.6f\n", r, analysis.ringPixels[r], analysis.ringPrimes[r],
+                (double)analysis.ringPrimes[r] / analysis.ringPixels[r], ringExpectedDensity(r));
+    }
+    fclose(fp);
+    printf("Rings written to %s\n", filename);
 
-    return duration;
+    snprintf(filename, sizeof(filename), "%s_polynomials.csv", analysisBasename);
+    fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Failed to write %s\n", filename);
+        return false;
+    }
+    fprintf(fp, "rank,a,b,c,terms,primes,density,run\n");
+    for (size_t i = 0; i < polynomials.size(); i++)
+    {
+        const PolynomialScore& p = polynomials[i];
+        fprintf(fp, "%zu,%lld,%lld,%lld,%d,%d,%.6f,%d\n", i + 1, p.a, p.b, p.c, polynomialTerms, p.primes,
+                (double)p.primes / polynomialTerms, p.run);
+    }
+    fclose(fp);
+    printf("Polynomials written to %s\n", filename);
+    return true;
 }
 
-int main()
+bool writeAnalysisJson(const SpiralAnalysis& analysis, const std::vector<PolynomialScore>& polynomials)
 {
-    printf("\n=== Ulam Spiral - Comparison: Nested vs Horizontal Parallelism ===\n");
-    printf("Image resolution: %d x %d pixels\n", SIZE, SIZE);
-    printf("Comparing 2x2 nested parallelism vs 4-thread horizontal division\n\n");
-    
-    imageNested = new unsigned char[SIZE * SIZE * 3];
-    imageHorizontal = new unsigned char[SIZE * SIZE * 3];
-    imageScheduler = new unsigned char[SIZE * SIZE * 3];
-    
-    size_t bufferSize = (size_t)SIZE * (size_t)SIZE * 3;
-    memset(imageNested, 200, bufferSize);
-    memset(imageHorizontal, 200, bufferSize);
-    memset(imageScheduler, 200, bufferSize);
-    
-    // Method 1: Nested Parallelism (2x2 blocks)
-    printf("=== Method 1: Nested Parallelism (2x2 blocks) ===\n");
-    
-    omp_set_nested(1);
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s.json", analysisBasename);
+    FILE* fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Failed to write %s\n", filename);
+        return false;
+    }
+
+    fprintf(fp, "{\n  \"size\": %d,\n  \"start\": %lld,\n  \"diagonals\": [", SIZE, spiralStart);
+    for (int k = 0; k < 2 * SIZE - 1; k++)
+    {
+        fprintf(fp, "%s\n    {\"offset\": %d, \"pixels\": %lld, \"primes\": %lld}", k > 0 ? "," : "",
+                k - SIZE + 1, diagonalLength(k - SIZE + 1), analysis.diagonalPrimes[k]);
+    }
+    fprintf(fp, "\n  ],\n  \"antiDiagonals\": [");
+    for (int k = 0; k < 2 * SIZE - 1; k++)
+    {
+        fprintf(fp, "%s\n    {\"offset\": %d, \"pixels\": %lld, \"primes\": %lld}", k > 0 ? "," : "",
+                k, antiDiagonalLength(k), analysis.antiDiagonalPrimes[k]);
+    }
+    fprintf(fp, "\n  ],\n  \"rings\": [");
+    for (int r = 0; r < (int)analysis.ringPixels.size(); r++)
+    {
+        fprintf(fp, "%s\n    {\"ring\": %d, \"pixels\": %lld, \"primes\": %lld, \"expected\": %.6f}", r > 0 ? "," : "",
+                r, analysis.ringPixels[r], analysis.ringPrimes[r], ringExpectedDensity(r));
+    }
+    fprintf(fp, "\n  ],\n  \"polynomialTerms\": %d,\n  \"polynomials\": [", polynomialTerms);
+    for (size_t i = 0; i < polynomials.size(); i++)
+    {
+        const PolynomialScore& p = polynomials[i];
+        fprintf(fp, "%s\n    {\"a\": %lld, \"b\": %lld, \"c\": %lld, \"primes\": %d, \"run\": %d}", i > 0 ? "," : "",
+                p.a, p.b, p.c, p.primes, p.run);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+
+    bool ok = ferror(fp) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok)
+    {
+        printf("Failed to write %s\n", filename);
+        return false;
+    }
+    printf("Analysis written to %s\n", filename);
+    return true;
+}
+
+// Analytics mode: diagonal, anti-diagonal and ring counts of the spiral plus a
+// ranking of quadratic polynomials; nothing is rendered
+int runAnalysis()
+{
+    printf("=== Prime pattern analysis (%d threads) ===\n", omp_get_max_threads());
+
+    SpiralAnalysis analysis;
+    double startTime = omp_get_wtime();
+    int64_t regionStart = traceNow();
+    analyzeSpiral(&analysis);
+    double spiralDuration = omp_get_wtime() - startTime;
+    traceRegion("diagonals and rings", regionStart);
+
+    long long totalPrimes = 0;
+    for (size_t r = 0; r < analysis.ringPrimes.size(); r++)
+    {
+        totalPrimes += analysis.ringPrimes[r];
+    }
+    printf("Spiral: %lld primes among %lld numbers, lines and rings counted in %.3f s (%.1f Mnumbers/s)\n",
+           totalPrimes, (long long)SIZE * SIZE, spiralDuration, (double)SIZE * SIZE / spiralDuration / 1e6);
+
+    // Richest long lines: only lines at least half the image long are ranked,
+    // short corner lines have meaningless densities
+    int bestDiagonal = SIZE - 1;
+    int bestAntiDiagonal = SIZE - 1;
+    for (int k = 0; k < 2 * SIZE - 1; k++)
+    {
+        if (2 * diagonalLength(k - SIZE + 1) >= SIZE &&
+            analysis.diagonalPrimes[k] * diagonalLength(bestDiagonal - SIZE + 1) >
+            analysis.diagonalPrimes[bestDiagonal] * diagonalLength(k - SIZE + 1))
+        {
+            bestDiagonal = k;
+        }
+        if (2 * antiDiagonalLength(k) >= SIZE &&
+            analysis.antiDiagonalPrimes[k] * antiDiagonalLength(bestAntiDiagonal) >
+            analysis.antiDiagonalPrimes[bestAntiDiagonal] * antiDiagonalLength(k))
+        {
+            bestAntiDiagonal = k;
+        }
+    }
+    printf("Densest diagonal x - y = %d: %lld of %lld primes (%.4f)\n", bestDiagonal - SIZE + 1,
+           analysis.diagonalPrimes[bestDiagonal], diagonalLength(bestDiagonal - SIZE + 1),
+           (double)analysis.diagonalPrimes[bestDiagonal] / diagonalLength(bestDiagonal - SIZE + 1));
+    printf("Densest anti-diagonal x + y = %d: %lld of %lld primes (%.4f)\n", bestAntiDiagonal,
+           analysis.antiDiagonalPrimes[bestAntiDiagonal], antiDiagonalLength(bestAntiDiagonal),
+           (double)analysis.antiDiagonalPrimes[bestAntiDiagonal] / antiDiagonalLength(bestAntiDiagonal));
+
+    // Candidates: n^2 + b n + c over the coefficient box, then every --poly
+    // that is not already among them, so nothing is ranked twice
+    std::vector<PolynomialScore> polynomials;
+    for (long long b = -polynomialRange; b <= polynomialRange; b++)
+    {
+        for (long long c = -polynomialRange; c <= polynomialRange; c++)
+        {
+            polynomials.push_back(PolynomialScore{ 1, b, c, 0, 0 });
+        }
+    }
+    size_t boxCandidates = polynomials.size();
+    for (size_t i = 0; i < extraPolynomials.size(); i++)
+    {
+        const PolynomialScore& p = extraPolynomials[i];
+        bool inBox = p.a == 1 && llabs(p.b) <= polynomialRange && llabs(p.c) <= polynomialRange;
+        bool repeated = false;
+        for (size_t j = boxCandidates; j < polynomials.size() && !repeated; j++)
+        {
+            repeated = polynomials[j].a == p.a && polynomials[j].b == p.b && polynomials[j].c == p.c;
+        }
+        if (!inBox && !repeated)
+        {
+            polynomials.push_back(p);
+        }
+    }
+
+    startTime = omp_get_wtime();
+    regionStart = traceNow();
+    scorePolynomials(&polynomials);
+    double polynomialDuration = omp_get_wtime() - startTime;
+    traceRegion("polynomials", regionStart);
+    printf("Polynomials: %zu candidates x %d terms ranked in %.3f s\n",
+           polynomials.size(), polynomialTerms, polynomialDuration);
+    for (size_t i = 0; i < polynomials.size() && i < ANALYSIS_TOP; i++)
+    {
+        const PolynomialScore& p = polynomials[i];
+        printf("  %2zu. %lld n^2 %+lld n %+lld: %d primes (%.4f), first %d consecutive\n",
+               i + 1, p.a, p.b, p.c, p.primes, (double)p.primes / polynomialTerms, p.run);
+    }
+
+    bool ok = analysisJson ? writeAnalysisJson(analysis, polynomials) : writeAnalysisCsv(analysis, polynomials);
+    return ok ? 0 : 1;
+}
+
+// Relative cost of the primality test for a number around n
+double estimatePixelCost(double n)
+{
+    if (!useSieve)
+    {
+        // every prime (1 in ln n) runs the full sqrt(n) / 6 trial loop
+        return 1.0 + sqrt(n) / (6.0 * log(n + 2.0));
+    }
+    if (n <= (double)primeTable.limit)
+    {
+        return 1.0;
+    }
+    return 1.0 + 2.0 * log2(n);  // Miller-Rabin on the prefilter survivors
+}
+
+// Ring of the pixel (x, y): numbers grow as (2 * ring + 1)^2 outwards
+int pixelRing(int x, int y)
+{
+    return (int)fmax(abs(x - SIZE / 2), abs(y - SIZE / 2));
+}
+
+// Estimated cost of a region, from the numbers at its centre and at its
+// outermost corner
+double estimateRegionCost(int x0, int y0, int width, int height)
+{
+    int innerRing = pixelRing(x0 + width / 2, y0 + height / 2);
+    int outerRing = (int)fmax(fmax(pixelRing(x0, y0), pixelRing(x0 + width - 1, y0)),
+                              fmax(pixelRing(x0, y0 + height - 1), pixelRing(x0 + width - 1, y0 + height - 1)));
+    double inner = (2.0 * innerRing + 1) * (2.0 * innerRing + 1) + (double)(spiralStart - 1);
+    double outer = (2.0 * outerRing + 1) * (2.0 * outerRing + 1) + (double)(spiralStart - 1);
+    return (double)width * height * 0.5 * (estimatePixelCost(inner) + estimatePixelCost(outer));
+}
+
+// Render one leaf in the colour of the thread that runs the task
+void computeQuadtreeLeaf(int x0, int y0, int width, int height, unsigned char* image)
+{
+    TraceScope span("leaf", y0, y0 + height);
+    unsigned char threadColor[3];
+    computeThreadColor(omp_get_thread_num(), omp_get_num_threads(), threadColor);
+
+    std::vector<int> rowIterations(width);
+    SpiralRowScratch scratch(width);
+    for (int y = y0; y < y0 + height; y++)
+    {
+        spiralRowIterations(primeTable, y, x0, x0 + width, rowIterations.data(), &scratch);
+        colorSpiralRow(rowIterations.data(), threadColor, width, image + ((size_t)y * SIZE + x0) * 3);
+    }
+}
+
+// Split the region into four quadrants (the odd pixel goes to the second
+// half, so nothing is lost) as long as it is expensive enough, one task each
+void computeQuadtreeNode(int x0, int y0, int width, int height, int depth, double leafCost, unsigned char* image)
+{
+    bool split = depth < quadtreeMaxDepth && (long long)width * height > quadtreeCutoff &&
+                 width > 1 && height > 1 && estimateRegionCost(x0, y0, width, height) > leafCost;
+    if (!split)
+    {
+        computeQuadtreeLeaf(x0, y0, width, height, image);
+        #pragma omp atomic
+        quadtreeLeaves[depth]++;
+        return;
+    }
+
+    int halfWidth = width / 2;
+    int halfHeight = height / 2;
+    int xs[2] = { x0, x0 + halfWidth };
+    int ws[2] = { halfWidth, width - halfWidth };
+    int ys[2] = { y0, y0 + halfHeight };
+    int hs[2] = { halfHeight, height - halfHeight };
+    for (int q = 0; q < 4; q++)
+    {
+        int qx = q & 1;
+        int qy = q >> 1;
+        #pragma omp task firstprivate(qx, qy)
+        computeQuadtreeNode(xs[qx], ys[qy], ws[qx], hs[qy], depth + 1, leafCost, image);
+    }
+}
+
+// Method 1: the whole spiral as a task quadtree; leaves aim at
+// QUADTREE_LEAVES_PER_THREAD equal-cost pieces per thread
+double runQuadtreeExperiment(unsigned char* image)
+{
+    memset(quadtreeLeaves, 0, sizeof(quadtreeLeaves));
+    double leafCost = estimateRegionCost(0, 0, SIZE, SIZE) / (TOTAL_THREADS * QUADTREE_LEAVES_PER_THREAD);
+
+    double startTime = omp_get_wtime();
+    int64_t regionStart = traceNow();
+    energyMeter.start();
+
+    #pragma omp parallel num_threads(TOTAL_THREADS)
+    {
+        #pragma omp single
+        computeQuadtreeNode(0, 0, SIZE, SIZE, 0, leafCost, image);
+    }
+
+    energyReport.add("quadtree tasks", energyMeter.stop(), (double)SIZE * SIZE / 1e6);
+    traceRegion("quadtree tasks", regionStart);
+    return omp_get_wtime() - startTime;
+}
+
+// Function to compute horizontal strips
+void computeHorizontalStrip(int stripId, int numStrips, unsigned char* image)
+{
+    int startY = (SIZE * stripId) / numStrips;
+    int endY = (SIZE * (stripId + 1)) / numStrips;
     
-    double startTimeNested = omp_get_wtime();
+    unsigned char threadColor[3];
+    computeThreadColor(stripId, numStrips, threadColor);
     
-    #pragma omp parallel for num_threads(THREADS_Y)
-    for (int blockY = 0; blockY < THREADS_Y; blockY++)
+    std::vector<int> rowIterations(SIZE);
+    SpiralRowScratch scratch(SIZE);
+    for (int y = startY; y < endY; y++)
+    {
+        TraceScope span("row", y, y + 1);
+        spiralRowIterations(primeTable, y, 0, SIZE, rowIterations.data(), &scratch);
+        colorSpiralRow(rowIterations.data(), threadColor, SIZE, image + (size_t)y * SIZE * 3);
+    }
+}
+
+// Duration in seconds, or a negative value when the output image cannot be opened
+double runSchedulerExperiment(const ScheduleConfig& config, unsigned char* image)
+{
+    omp_set_num_threads(TOTAL_THREADS);
+    omp_set_schedule(config.type, config.chunkSize);
+
+    // Mapped output gets a fresh file per schedule; every pixel is written,
+    // so it needs no background fill
+    MappedImage mapped;
+    if (mappedOutput)
+    {
+        image = openMappedImage(&mapped, config.basename, config.label);
+        if (image == NULL)
+        {
+            return -1.0;
+        }
+    }
+    else
+    {
+        size_t bufferSize = (size_t)SIZE * (size_t)SIZE * 3;
+        memset(image, 200, bufferSize);
+    }
+
+    double startTime = omp_get_wtime();
+    int64_t regionStart = traceNow();
+    energyMeter.start();
+
+    #pragma omp parallel
+    {
+        int threadId = omp_get_thread_num();
+        int totalThreads = omp_get_num_threads();
+        unsigned char threadColor[3];
+        computeThreadColor(threadId, totalThreads, threadColor);
+        std::vector<int> rowIterations(SIZE);
+        SpiralRowScratch scratch(SIZE);
+
+        #pragma omp for schedule(runtime)
+        for (int y = 0; y < SIZE; y++)
+        {
+            TraceScope span("row", y, y + 1);
+            spiralRowIterations(primeTable, y, 0, SIZE, rowIterations.data(), &scratch);
+            colorSpiralRow(rowIterations.data(), threadColor, SIZE, image + (size_t)y * SIZE * 3);
+            if (mappedOutput)
+            {
+                mapped.rowsDone(y, y + 1);
+            }
+        }
+    }
+
+    double endTime = omp_get_wtime();
+    double duration = endTime - startTime;
+    energyReport.add(std::string("schedule ") + config.label, energyMeter.stop(), (double)SIZE * SIZE / 1e6);
+    traceRegion(config.label, regionStart);
+
+    char chunkBuffer[16];
+    if (config.chunkSize > 0)
+    {
+        snprintf(chunkBuffer, sizeof(chunkBuffer), "%d", config.chunkSize);
+    }
+    else if (config.type == omp_sched_auto)
+    {
+        snprintf(chunkBuffer, sizeof(chunkBuffer), "n/a");
+    }
+    else
+    {
+        snprintf(chunkBuffer, sizeof(chunkBuffer), "default");
+    }
+
+    printf("Schedule %-28s | chunk %7s | %7.3f s\n", config.label, chunkBuffer, duration);
+
+    if (mappedOutput)
+    {
+        closeMappedImage(&mapped, config.basename, config.label);
+    }
+    else
+    {
+        saveImage(config.basename, config.label, image);
+    }
+
+    return duration;
+}
+
+#ifdef USE_MPI
+// One band on a worker rank: rows shared by its OpenMP team, coloured by rank
+void renderDistributedBand(int firstRow, int endRow, int worker, int numWorkers, unsigned char* rgb)
+{
+    unsigned char rankColor[3];
+    computeThreadColor(worker, numWorkers, rankColor);
+
+    #pragma omp parallel num_threads(distributedThreads)
+    {
+        std::vector<int> rowIterations(SIZE);
+        SpiralRowScratch scratch(SIZE);
+
+        #pragma omp for schedule(dynamic)
+        for (int y = firstRow; y < endRow; y++)
+        {
+            spiralRowIterations(primeTable, y, 0, SIZE, rowIterations.data(), &scratch);
+            colorSpiralRow(rowIterations.data(), rankColor, SIZE, rgb + (size_t)(y - firstRow) * SIZE * 3);
+        }
+    }
+}
+#endif
+
+#if __cplusplus >= 202002L
+void pipelineComputeRows(int image, int firstRow, int endRow, int* values)
+{
+    (void)image;
+    SpiralRowScratch scratch(SIZE);
+    for (int y = firstRow; y < endRow; y++)
+    {
+        spiralRowIterations(primeTable, y, 0, SIZE, values + (size_t)(y - firstRow) * SIZE, &scratch);
+    }
+}
+
+// Coloured by the compute worker, as the schedule sweep colours by thread
+void pipelineColorizeRows(int image, int firstRow, int endRow, int worker, int numWorkers,
+                          const int* values, unsigned char* rgb)
+{
+    (void)image;
+    unsigned char workerColor[3];
+    computeThreadColor(worker, numWorkers, workerColor);
+    for (int y = firstRow; y < endRow; y++)
+    {
+        colorSpiralRow(values + (size_t)(y - firstRow) * SIZE, workerColor, SIZE, rgb + (size_t)(y - firstRow) * SIZE * 3);
+    }
+}
+#endif
+
+// Pipeline images have their own names: they are not rendered with the
+// OpenMP schedules and must not overwrite the sweep's files
+void pipelineBasename(int image, char* basename, size_t size)
+{
+    snprintf(basename, size, "ulam_pipeline_%d", image);
+}
+
+// NUM_SCHEDULES images, serialized and then through the pipeline
+int runPipeline()
+{
+#if __cplusplus >= 202002L
+    std::vector<PipelineImage> images(NUM_SCHEDULES);
+    for (int i = 0; i < NUM_SCHEDULES; i++)
+    {
+        char basename[64];
+        pipelineBasename(i, basename, sizeof(basename));
+        imageFilename(images[i].filename, sizeof(images[i].filename), basename, outputFormat);
+        snprintf(images[i].comment, sizeof(images[i].comment), "Pipeline image %d of %d", i + 1, NUM_SCHEDULES);
+    }
+    bool ok = runPipelineComparison(images, SIZE, SIZE, PIPELINE_BAND_ROWS, outputFormat, TOTAL_THREADS,
+                                    pipelineComputeRows, pipelineColorizeRows);
+    return ok ? 0 : 1;
+#else
+    printf("--pipeline needs a C++20 build: g++ -std=c++20 -O2 -fopenmp zad04.cpp -o zad04 -lz\n");
+    return 1;
+#endif
+}
+
+// Every backend renders the same buffer; each render must have the non-prime
+// mask of the first, and the buffer is blanked after the check so that rows
+// left out cannot pass
+int runBackendRenders()
+{
+    size_t bufferSize = (size_t)SIZE * (size_t)SIZE * 3;
+    unsigned char* image = new unsigned char[bufferSize];
+    const unsigned char nonPrime[3] = { 200, 200, 200 };
+    bool haveMask = false;
+    uint64_t firstMask = 0;
+
+    auto renderRows = [image](long long first, long long last, int worker, int numWorkers)
+    {
+        std::vector<int> rowIterations(SIZE);
+        SpiralRowScratch scratch(SIZE);
+        unsigned char threadColor[3];
+        computeThreadColor(worker, numWorkers, threadColor);
+        for (int y = (int)first; y < (int)last; y++)
+        {
+            spiralRowIterations(primeTable, y, 0, SIZE, rowIterations.data(), &scratch);
+            colorSpiralRow(rowIterations.data(), threadColor, SIZE, image + (size_t)y * SIZE * 3);
+        }
+    };
+    auto checkImage = [&]()
     {
-        #pragma omp parallel for num_threads(THREADS_X)
-        for (int blockX = 0; blockX < THREADS_X; blockX++)
+        uint64_t mask = imageChecksum(image, SIZE, SIZE, nonPrime, omp_get_max_threads()).mask;
+        memset(image, 0, bufferSize);
+        if (!haveMask)
         {
-            #pragma omp critical
+            haveMask = true;
+            firstMask = mask;
+        }
+        return mask == firstMask;
+    };
+
+    bool ok = runBackendComparison("Ulam spiral", backendMask, BACKEND_THREAD_COUNTS, NUM_BACKEND_THREAD_COUNTS, SIZE,
+                                   BACKEND_GRAIN_ROWS, (double)SIZE * SIZE / 1e6, "Mpixel", renderRows, checkImage);
+    printf("Non-prime mask: %016llx\n", (unsigned long long)firstMask);
+    delete[] image;
+    return ok ? 0 : 1;
+}
+
+// Hash the images of the schedule sweep (and of the quadtree and strip
+// methods), or those of the pipeline, and compare their masks of grey
+// non-prime pixels
+bool verifySpiralImages(ImageFormat format, bool withMethods, bool pipelineImages = false)
+{
+    if (format != FORMAT_PPM)
+    {
+        printf("--checksum reads PPM files, --format %s was written\n", imageFormatExtension(format));
+        return false;
+    }
+    std::vector<std::string> filenames;
+    char filename[256];
+    if (withMethods)
+    {
+        imageFilename(filename, sizeof(filename), "ulam_spiral_quadtree_tasks", format);
+        filenames.push_back(filename);
+        imageFilename(filename, sizeof(filename), "ulam_spiral_horizontal_4", format);
+        filenames.push_back(filename);
+    }
+    for (int i = 0; i < NUM_SCHEDULES; i++)
+    {
+        char basename[64];
+        if (pipelineImages)
+            pipelineBasename(i, basename, sizeof(basename));
+        else
+            snprintf(basename, sizeof(basename), "%s", SCHEDULE_CONFIGS[i].basename);
+        imageFilename(filename, sizeof(filename), basename, format);
+        filenames.push_back(filename);
+    }
+    const unsigned char nonPrime[3] = {200, 200, 200};
+    return verifyImageChecksums(filenames, nonPrime, expectedMask);
+}
+
+// Distributed sweep over MPI worker counts; every rank needs the prime
+// table, so rank 0 builds or extends the cache file before the others map it
+int runDistributed(long long largestValue)
+{
+#ifdef USE_MPI
+    int provided;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+    int rank = distributedRank();
+    distributedThreads = distributedLocalThreads();
+
+    long long tableLimit = largestValue < sieveLimit ? largestValue : sieveLimit;
+    bool buildTable = useSieve && spiralStart <= tableLimit;
+    if (buildTable && rank == 0)
+    {
+        openPrimeTable(primeCachePath, tableLimit, distributedThreads, &primeTable);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (buildTable && rank != 0)
+    {
+        openPrimeTable(primeCachePath, tableLimit, distributedThreads, &primeTable);
+    }
+    if (rank == 0)
+    {
+        printf("Ulam spiral %d x %d, numbers %lld .. %lld, primality: %s\n", SIZE, SIZE, spiralStart, largestValue,
+               !useSieve ? "trial division" : buildTable ? "mod-30 wheel table + Miller-Rabin" : "Miller-Rabin");
+    }
+
+    // Most expensive bands first, so no worker is left with a costly band at the end
+    int numBands = (SIZE + MPI_BAND_ROWS - 1) / MPI_BAND_ROWS;
+    std::vector<int> order(numBands);
+    std::vector<double> cost(numBands);
+    for (int b = 0; b < numBands; b++)
+    {
+        order[b] = b;
+        int rows = (int)fmin(MPI_BAND_ROWS, SIZE - b * MPI_BAND_ROWS);
+        cost[b] = estimateRegionCost(0, b * MPI_BAND_ROWS, SIZE, rows);
+    }
+    std::stable_sort(order.begin(), order.end(), [&cost](int p, int q) { return cost[p] > cost[q]; });
+
+    distributedSweep("ulam_spiral", "Ulam spiral", SIZE, SIZE, MPI_BAND_ROWS, order, renderDistributedBand);
+
+    closePrimeTable(&primeTable);
+    MPI_Finalize();
+    return 0;
+#else
+    (void)largestValue;
+    printf("--mpi needs the MPI build: mpicxx -O2 -fopenmp -DUSE_MPI zad04.cpp -o zad04_mpi -lz\n");
+    return 1;
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            if (!parseImageFormat(argv[++i], &outputFormat))
             {
-                printf("Processing block (%d, %d)\n", blockX, blockY);
+                printf("Unknown format %s (expected ppm, qoi or png)\n", argv[i]);
+                return 1;
             }
-            
-            computeQuadrantNested(blockX, blockY, imageNested);
         }
+        else if (strcmp(argv[i], "--trial-division") == 0)
+        {
+            useSieve = false;
+        }
+        else if (strcmp(argv[i], "--prime-cache") == 0 && i + 1 < argc)
+        {
+            primeCachePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-prime-cache") == 0)
+        {
+            primeCachePath = NULL;
+        }
+        else if (strcmp(argv[i], "--sieve-limit") == 0 && i + 1 < argc)
+        {
+            sieveLimit = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            SIZE = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)
+        {
+            spiralStart = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--quadtree-depth") == 0 && i + 1 < argc)
+        {
+            quadtreeMaxDepth = (int)fmin(atoi(argv[++i]), QUADTREE_DEPTH_LIMIT);
+        }
+        else if (strcmp(argv[i], "--quadtree-cutoff") == 0 && i + 1 < argc)
+        {
+            quadtreeCutoff = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tiled") == 0)
+        {
+            tiledMode = true;
+        }
+        else if (strcmp(argv[i], "--spiral-bench") == 0)
+        {
+            spiralBenchmark = true;
+        }
+        else if (strcmp(argv[i], "--mmap") == 0)
+        {
+            mappedOutput = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mpi") == 0)
+        {
+            distributedMode = true;
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipelineMode = true;
+        }
+        else if (strcmp(argv[i], "--analyze") == 0)
+        {
+            analysisMode = true;
+        }
+        else if (strcmp(argv[i], "--analysis-json") == 0)
+        {
+            analysisJson = true;
+        }
+        else if (strcmp(argv[i], "--analysis-out") == 0 && i + 1 < argc)
+        {
+            analysisBasename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--poly-range") == 0 && i + 1 < argc)
+        {
+            polynomialRange = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--poly-terms") == 0 && i + 1 < argc)
+        {
+            polynomialTerms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--poly") == 0 && i + 1 < argc)
+        {
+            PolynomialScore p = { 0, 0, 0, 0, 0 };
+            if (sscanf(argv[++i], "%lld,%lld,%lld", &p.a, &p.b, &p.c) != 3 ||
+                llabs(p.a) > POLYNOMIAL_COEFF_LIMIT || llabs(p.b) > POLYNOMIAL_COEFF_LIMIT ||
+                llabs(p.c) > POLYNOMIAL_COEFF_LIMIT)
+            {
+                printf("Invalid polynomial %s (expected a,b,c with |a|, |b|, |c| <= %lld)\n",
+                       argv[i], POLYNOMIAL_COEFF_LIMIT);
+                return 1;
+            }
+            extraPolynomials.push_back(p);
+        }
+        else if (strcmp(argv[i], "--populate") == 0)
+        {
+            mappedFlags |= MAPPED_POPULATE;
+        }
+        else if (strcmp(argv[i], "--hugepages") == 0)
+        {
+            mappedFlags |= MAPPED_HUGEPAGES;
+        }
+        else if (strcmp(argv[i], "--energy") == 0)
+        {
+            energyMode = true;
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+        {
+            if (!parseBackends(argv[++i], &backendMask))
+            {
+                printf("Unknown backend %s (expected threads, openmp, stealing, par or all)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--checksum") == 0)
+        {
+            checksumMode = true;
+        }
+        else if (strcmp(argv[i], "--expect-mask") == 0 && i + 1 < argc)
+        {
+            checksumMode = true;
+            expectedMask = argv[++i];
+        }
+    }
+
+    if (SIZE < 2 || spiralStart < 1 || spiralStart - 1 > LLONG_MAX - maxSpiralNumber())
+    {
+        printf("Invalid spiral: --size must be at least 2 and --start positive (numbers must fit 64 bits)\n");
+        return 1;
+    }
+    long long largestValue = maxSpiralNumber() + spiralStart - 1;
+    if (polynomialRange < 0 || polynomialRange > POLYNOMIAL_COEFF_LIMIT ||
+        polynomialTerms < 1 || polynomialTerms > POLYNOMIAL_TERMS_LIMIT)
+    {
+        printf("Invalid polynomial search: --poly-range must be 0 .. %lld and --poly-terms 1 .. %d\n",
+               POLYNOMIAL_COEFF_LIMIT, POLYNOMIAL_TERMS_LIMIT);
+        return 1;
+    }
+
+    if (spiralBenchmark)
+    {
+        runSpiralBenchmark();
+        return 0;
+    }
+
+    if (distributedMode)
+    {
+        return runDistributed(largestValue);
+    }
+
+    if (tracePath != NULL)
+    {
+        traceEnable();
+    }
+
+    if (tiledMode)
+    {
+        int status = runTiledRenderer();
+        if (tracePath != NULL)
+        {
+            traceWrite(tracePath);
+        }
+        return status;
+    }
+
+    if (analysisMode)
+    {
+        printf("\n=== Ulam Spiral - Prime Pattern Analytics ===\n");
+        printf("Spiral: %d x %d, numbers %lld .. %lld\n\n", SIZE, SIZE, spiralStart, largestValue);
+    }
+    else if (backendMask != 0)
+    {
+        printf("\n=== Ulam Spiral - Parallel Backends ===\n");
+        printf("Image resolution: %d x %d pixels, numbers %lld .. %lld\n\n", SIZE, SIZE, spiralStart, largestValue);
+    }
+    else if (pipelineMode)
+    {
+        printf("\n=== Ulam Spiral - Render Pipeline vs Serialized Flow ===\n");
+        printf("Image resolution: %d x %d pixels, numbers %lld .. %lld\n\n", SIZE, SIZE, spiralStart, largestValue);
+    }
+    else
+    {
+        printf("\n=== Ulam Spiral - Comparison: Quadtree Tasks vs Horizontal Parallelism ===\n");
+        printf("Image resolution: %d x %d pixels, numbers %lld .. %lld\n", SIZE, SIZE, spiralStart, largestValue);
+        printf("Comparing a task quadtree vs %d-thread horizontal division\n\n", TOTAL_THREADS);
+    }
+
+    double sieveDuration = 0.0;
+    long long tableTarget = analysisMode ? std::max(largestValue, polynomialValueBound()) : largestValue;
+    long long tableLimit = tableTarget < sieveLimit ? tableTarget : sieveLimit;
+    if (useSieve && spiralStart > tableLimit && !analysisMode)
+    {
+        primeTable.limit = 0;
+        printf("All numbers above the sieve limit %lld: Miller-Rabin only\n\n", sieveLimit);
+    }
+    else if (useSieve)
+    {
+        double startTimeSieve = omp_get_wtime();
+        openPrimeTable(primeCachePath, tableLimit, omp_get_max_threads(), &primeTable);
+        sieveDuration = omp_get_wtime() - startTimeSieve;
+        printf("Prime table up to %lld: %.1f MB mod-30 wheel (%s%s%s), %.1f MB sieved in %.3f s with %d threads\n",
+               primeTable.limit, primeTableBytes(primeTable) / (1024.0 * 1024.0), primeTableSourceName(primeTable.source),
+               primeTable.mapping != NULL ? " " : "", primeTable.mapping != NULL ? primeCachePath : "",
+               primeTable.sievedBytes / (1024.0 * 1024.0), sieveDuration, omp_get_max_threads());
+        if (primeTable.limit < tableTarget)
+        {
+            printf("Numbers above %lld: deterministic Miller-Rabin, %d lanes\n", primeTable.limit, MR_LANES);
+        }
+        printf("\n");
+    }
+    else if (analysisMode)
+    {
+        printf("No prime table (--trial-division): the analysis uses Miller-Rabin only\n\n");
+    }
+    else
+    {
+        printf("Primality by trial division (--trial-division)\n\n");
+    }
+
+    if (backendMask != 0 && !analysisMode)
+    {
+        int status = runBackendRenders();
+        closePrimeTable(&primeTable);
+        return status;
+    }
+
+    if (pipelineMode)
+    {
+        int status = runPipeline();
+        if (tracePath != NULL)
+        {
+            traceWrite(tracePath);
+        }
+        if (status == 0 && checksumMode && !verifySpiralImages(outputFormat, false, true))
+        {
+            status = 1;
+        }
+        closePrimeTable(&primeTable);
+        return status;
+    }
+
+    if (analysisMode)
+    {
+        int status = runAnalysis();
+        if (tracePath != NULL)
+        {
+            traceWrite(tracePath);
+        }
+        closePrimeTable(&primeTable);
+        return status;
     }
     
-    double endTimeNested = omp_get_wtime();
-    double durationNested = endTimeNested - startTimeNested;
+    if (energyMode)
+    {
+        energyMeter.open();
+    }
+    size_t bufferSize = (size_t)SIZE * (size_t)SIZE * 3;
+    if (mappedOutput)
+    {
+        printf("Rendering into memory-mapped PPM files%s%s\n\n",
+               (mappedFlags & MAPPED_POPULATE) ? ", populated" : "",
+               (mappedFlags & MAPPED_HUGEPAGES) ? ", huge pages" : "");
+        if (outputFormat != FORMAT_PPM)
+        {
+            printf("Mapped output is raw PPM, --format %s is ignored\n\n", imageFormatExtension(outputFormat));
+        }
+        imageQuadtree = openMappedImage(&mappedQuadtree, "ulam_spiral_quadtree_tasks", "Quadtree tasks");
+        imageHorizontal = openMappedImage(&mappedHorizontal, "ulam_spiral_horizontal_4", "Horizontal 4 threads");
+        imageScheduler = NULL;
+        if (imageQuadtree == NULL || imageHorizontal == NULL)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        imageQuadtree = new unsigned char[bufferSize];
+        imageHorizontal = new unsigned char[bufferSize];
+        imageScheduler = new unsigned char[bufferSize];
+
+        memset(imageQuadtree, 200, bufferSize);
+        memset(imageHorizontal, 200, bufferSize);
+        memset(imageScheduler, 200, bufferSize);
+    }
     
-    printf("Nested parallelism complete in %.3f seconds\n\n", durationNested);
+    // Method 1: Quadtree of OpenMP tasks
+    printf("=== Method 1: Quadtree Tasks (%d threads, depth <= %d, cutoff %d pixels) ===\n",
+           TOTAL_THREADS, quadtreeMaxDepth, quadtreeCutoff);
+
+    double durationQuadtree = runQuadtreeExperiment(imageQuadtree);
+
+    int totalLeaves = 0;
+    printf("Leaves per depth:");
+    for (int d = 0; d <= QUADTREE_DEPTH_LIMIT; d++)
+    {
+        if (quadtreeLeaves[d] > 0)
+        {
+            printf(" %d:%d", d, quadtreeLeaves[d]);
+            totalLeaves += quadtreeLeaves[d];
+        }
+    }
+    printf(" (%d leaves)\n", totalLeaves);
+    printf("Quadtree tasks complete in %.3f seconds\n\n", durationQuadtree);
     
     // Method 2: Horizontal Division
     printf("=== Method 2: Horizontal Division (%d threads) ===\n", TOTAL_THREADS);
     
-    omp_set_nested(0);
     omp_set_num_threads(TOTAL_THREADS);
     
     double startTimeHorizontal = omp_get_wtime();
+    int64_t regionStartHorizontal = traceNow();
+    energyMeter.start();
     
     #pragma omp parallel
     {
@@ -379,7 +1740,9 @@ int main()
     }
     
     double endTimeHorizontal = omp_get_wtime();
+    energyReport.add("horizontal strips", energyMeter.stop(), (double)SIZE * SIZE / 1e6);
     double durationHorizontal = endTimeHorizontal - startTimeHorizontal;
+    traceRegion("horizontal strips", regionStartHorizontal);
     
     printf("Horizontal division complete in %.3f seconds\n\n", durationHorizontal);
 
@@ -391,6 +1754,18 @@ int main()
     for (int i = 0; i < NUM_SCHEDULES; i++)
     {
         scheduleDurations[i] = runSchedulerExperiment(SCHEDULE_CONFIGS[i], imageScheduler);
+        if (scheduleDurations[i] < 0.0)
+        {
+            printf("Schedule sweep stopped: no output image for %s\n", SCHEDULE_CONFIGS[i].label);
+            if (!mappedOutput)
+            {
+                delete[] imageQuadtree;
+                delete[] imageHorizontal;
+                delete[] imageScheduler;
+            }
+            closePrimeTable(&primeTable);
+            return 1;
+        }
     }
     printf("Scheduler output images saved for each configuration above.\n\n");
 
@@ -410,47 +1785,55 @@ int main()
     // Write images
     printf("=== Writing images to files ===\n");
     
-    writeImagePPM("ulam_spiral_nested_2x2.ppm", "Nested 2x2", imageNested);
-    writeImagePPM("ulam_spiral_horizontal_4.ppm", "Horizontal 4 threads", imageHorizontal);
-    
-    delete[] imageNested;
-    delete[] imageHorizontal;
-    delete[] imageScheduler;
+    if (mappedOutput)
+    {
+        closeMappedImage(&mappedQuadtree, "ulam_spiral_quadtree_tasks", "Quadtree tasks");
+        closeMappedImage(&mappedHorizontal, "ulam_spiral_horizontal_4", "Horizontal 4 threads");
+    }
+    else
+    {
+        saveImage("ulam_spiral_quadtree_tasks", "Quadtree tasks", imageQuadtree);
+        saveImage("ulam_spiral_horizontal_4", "Horizontal 4 threads", imageHorizontal);
+
+        delete[] imageQuadtree;
+        delete[] imageHorizontal;
+        delete[] imageScheduler;
+    }
     
     // Performance Summary
     printf("\n=== Performance Summary ===\n");
-    printf("Method                          | Time (s) | Relative to nested\n");
+    printf("Method                          | Time (s) | Relative to quadtree\n");
     printf("----------------------------------------------------------------\n");
-    printf("Nested Parallelism (2x2)        | %7.3f  | baseline\n", durationNested);
-    if (durationHorizontal >= durationNested)
+    printf("Quadtree tasks                  | %7.3f  | baseline\n", durationQuadtree);
+    if (durationHorizontal >= durationQuadtree)
     {
-        printf("Horizontal Division (4 threads) | %7.3f  | %6.2fx slower\n", durationHorizontal, durationHorizontal / durationNested);
+        printf("Horizontal Division (4 threads) | %7.3f  | %6.2fx slower\n", durationHorizontal, durationHorizontal / durationQuadtree);
     }
     else
     {
-        printf("Horizontal Division (4 threads) | %7.3f  | %6.2fx faster\n", durationHorizontal, durationNested / durationHorizontal);
+        printf("Horizontal Division (4 threads) | %7.3f  | %6.2fx faster\n", durationHorizontal, durationQuadtree / durationHorizontal);
     }
 
     for (int i = 0; i < NUM_SCHEDULES; i++)
     {
         double duration = scheduleDurations[i];
-        if (duration >= durationNested)
+        if (duration >= durationQuadtree)
         {
-            printf("Runtime schedule %-16s | %7.3f  | %6.2fx slower\n", SCHEDULE_CONFIGS[i].label, duration, duration / durationNested);
+            printf("Runtime schedule %-16s | %7.3f  | %6.2fx slower\n", SCHEDULE_CONFIGS[i].label, duration, duration / durationQuadtree);
         }
         else
         {
-            printf("Runtime schedule %-16s | %7.3f  | %6.2fx faster\n", SCHEDULE_CONFIGS[i].label, duration, durationNested / duration);
+            printf("Runtime schedule %-16s | %7.3f  | %6.2fx faster\n", SCHEDULE_CONFIGS[i].label, duration, durationQuadtree / duration);
         }
     }
 
-    if (durationNested < durationHorizontal)
+    if (durationQuadtree < durationHorizontal)
     {
-        printf("\nNested parallelism is FASTER than static strips by %.2fx\n", durationHorizontal / durationNested);
+        printf("\nQuadtree tasks are FASTER than static strips by %.2fx\n", durationHorizontal / durationQuadtree);
     }
     else
     {
-        printf("\nHorizontal division is FASTER than nested by %.2fx\n", durationNested / durationHorizontal);
+        printf("\nHorizontal division is FASTER than quadtree tasks by %.2fx\n", durationQuadtree / durationHorizontal);
     }
 
     double scheduleVsHorizontal = fastestScheduleTime / durationHorizontal;
@@ -463,20 +1846,49 @@ int main()
         printf("Horizontal strips remain faster than %s by %.2fx\n", SCHEDULE_CONFIGS[fastestScheduleIndex].label, scheduleVsHorizontal);
     }
 
-    if (fastestScheduleTime < durationNested)
+    if (fastestScheduleTime < durationQuadtree)
     {
-        printf("%s also outperforms nested blocks by %.2fx\n", SCHEDULE_CONFIGS[fastestScheduleIndex].label, durationNested / fastestScheduleTime);
+        printf("%s also outperforms quadtree tasks by %.2fx\n", SCHEDULE_CONFIGS[fastestScheduleIndex].label, durationQuadtree / fastestScheduleTime);
     }
     else
     {
-        printf("Nested blocks stay ahead of %s by %.2fx\n", SCHEDULE_CONFIGS[fastestScheduleIndex].label, fastestScheduleTime / durationNested);
+        printf("Quadtree tasks stay ahead of %s by %.2fx\n", SCHEDULE_CONFIGS[fastestScheduleIndex].label, fastestScheduleTime / durationQuadtree);
     }
     
     printf("\n=== Analysis ===\n");
-    printf("Nested: 2x2 blocks using nested parallel regions\n");
+    printf("Quadtree: recursive OpenMP tasks, cost-aware splitting (%d leaves)\n", totalLeaves);
     printf("Horizontal: %d horizontal strips\n", TOTAL_THREADS);
     printf("Runtime: schedule(runtime) sweep across static/dynamic/guided/auto\n");
-    printf("Both methods use %d total threads\n", TOTAL_THREADS);
-    
-    return 0;
+    printf("All methods use %d total threads\n", TOTAL_THREADS);
+    if (useSieve && primeTable.limit == 0)
+    {
+        printf("Primality: deterministic Miller-Rabin (all numbers above the sieve limit)\n");
+    }
+    else if (useSieve)
+    {
+        printf("Primality: shared mod-30 wheel bitmap, ready in %.3f s (not included above)%s\n", sieveDuration,
+               primeTable.limit < largestValue ? ", Miller-Rabin beyond it" : "");
+    }
+    else
+    {
+        printf("Primality: trial division per pixel\n");
+    }
+
+    if (energyMode)
+    {
+        printEnergyReport(energyReport, "Ulam spiral methods");
+    }
+    if (tracePath != NULL)
+    {
+        traceWrite(tracePath);
+    }
+
+    int status = 0;
+    if (checksumMode && !verifySpiralImages(mappedOutput ? FORMAT_PPM : outputFormat, true))
+    {
+        status = 1;
+    }
+
+    closePrimeTable(&primeTable);
+    return status;
 }
@@ -0,0 +1,200 @@
+/*
+ Fixed-point big numbers for deep-zoom reference orbits.
+ -------------------------------------------------------
+ A BigFixed is a two's complement number of `limbs` 32-bit limbs, little
+ endian: limb[limbs - 1] is the (signed) integer part and the remaining
+ limbs are the fraction, so the resolution is 2^(-32 * (limbs - 1)).
+ Only what the Mandelbrot reference orbit needs is implemented: +, -, *,
+ conversion from/to double and parsing of plain decimal strings.
+*/
+#ifndef COMMON_BIGFIXED_H
+#define COMMON_BIGFIXED_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+const int BIGFIXED_MAX_LIMBS = 40;
+
+struct BigFixed
+{
+    int limbs;
+    uint32_t limb[BIGFIXED_MAX_LIMBS];
+};
+
+// Limbs needed to address pixels of a view magnified `zoom` times with
+// `pixels` pixels across, plus 64 guard bits for the orbit's rounding
+inline int bigLimbsForZoom(double zoom, int pixels)
+{
+    double bits = log2(zoom > 1.0 ? zoom : 1.0) + log2(pixels > 1 ? (double)pixels : 1.0) + 64.0;
+    int limbs = 1 + (int)ceil(bits / 32.0);
+    if (limbs < 3)
+        limbs = 3;
+    if (limbs > BIGFIXED_MAX_LIMBS)
+        limbs = BIGFIXED_MAX_LIMBS;
+    return limbs;
+}
+
+inline void bigZero(BigFixed* r, int limbs)
+{
+    r->limbs = limbs;
+    memset(r->limb, 0, sizeof(r->limb));
+}
+
+inline bool bigIsNegative(const BigFixed& a)
+{
+    return (a.limb[a.limbs - 1] & 0x80000000u) != 0;
+}
+
+inline void bigNegate(BigFixed* a)
+{
+    uint64_t carry = 1;
+    for (int i = 0; i < a->limbs; i++)
+    {
+        uint64_t v = (uint64_t)(~a->limb[i]) + carry;
+        a->limb[i] = (uint32_t)v;
+        carry = v >> 32;
+    }
+}
+
+inline void bigAdd(const BigFixed& a, const BigFixed& b, BigFixed* r)
+{
+    uint64_t carry = 0;
+    r->limbs = a.limbs;
+    for (int i = 0; i < a.limbs; i++)
+    {
+        uint64_t v = (uint64_t)a.limb[i] + b.limb[i] + carry;
+        r->limb[i] = (uint32_t)v;
+        carry = v >> 32;
+    }
+}
+
+inline void bigSub(const BigFixed& a, const BigFixed& b, BigFixed* r)
+{
+    int64_t borrow = 0;
+    r->limbs = a.limbs;
+    for (int i = 0; i < a.limbs; i++)
+    {
+        int64_t v = (int64_t)a.limb[i] - b.limb[i] - borrow;
+        r->limb[i] = (uint32_t)v;
+        borrow = v < 0 ? 1 : 0;
+    }
+}
+
+// r = a * b, truncated to the fixed-point resolution
+inline void bigMul(const BigFixed& a, const BigFixed& b, BigFixed* r)
+{
+    int n = a.limbs;
+    BigFixed ma = a;
+    BigFixed mb = b;
+    bool negative = bigIsNegative(a) != bigIsNegative(b);
+    if (bigIsNegative(ma))
+        bigNegate(&ma);
+    if (bigIsNegative(mb))
+        bigNegate(&mb);
+
+    uint32_t product[2 * BIGFIXED_MAX_LIMBS];
+    memset(product, 0, sizeof(uint32_t) * 2 * n);
+    for (int i = 0; i < n; i++)
+    {
+        if (ma.limb[i] == 0)
+            continue;
+        uint64_t carry = 0;
+        for (int j = 0; j < n; j++)
+        {
+            uint64_t v = (uint64_t)ma.limb[i] * mb.limb[j] + product[i + j] + carry;
+            product[i + j] = (uint32_t)v;
+            carry = v >> 32;
+        }
+        product[i + n] = (uint32_t)carry;
+    }
+
+    r->limbs = n;
+    memcpy(r->limb, product + (n - 1), sizeof(uint32_t) * n);
+    if (negative)
+        bigNegate(r);
+}
+
+inline double bigToDouble(const BigFixed& a)
+{
+    BigFixed m = a;
+    bool negative = bigIsNegative(a);
+    if (negative)
+        bigNegate(&m);
+    double v = 0.0;
+    for (int i = m.limbs - 1; i >= 0; i--)
+    {
+        if (m.limb[i] != 0)
+            v += ldexp((double)m.limb[i], 32 * (i - (m.limbs - 1)));
+    }
+    return negative ? -v : v;
+}
+
+inline void bigFromDouble(double v, int limbs, BigFixed* r)
+{
+    bigZero(r, limbs);
+    bool negative = v < 0.0;
+    double m = fabs(v);
+    double whole = floor(m);
+    r->limb[limbs - 1] = (uint32_t)whole;
+    double frac = m - whole;
+    for (int i = limbs - 2; i >= 0 && frac > 0.0; i--)
+    {
+        frac *= 4294967296.0;
+        double digit = floor(frac);
+        r->limb[i] = (uint32_t)digit;
+        frac -= digit;
+    }
+    if (negative)
+        bigNegate(r);
+}
+
+// Parse "[-]digits[.digits]" exactly up to the fixed-point resolution
+inline bool bigParse(const char* text, int limbs, BigFixed* r)
+{
+    bigZero(r, limbs);
+    bool negative = false;
+    if (*text == '-' || *text == '+')
+    {
+        negative = *text == '-';
+        text++;
+    }
+
+    uint64_t whole = 0;
+    const char* p = text;
+    while (*p >= '0' && *p <= '9')
+    {
+        whole = whole * 10 + (uint64_t)(*p - '0');
+        if (whole > 0x7fffffffu)
+            return false;
+        p++;
+    }
+
+    if (*p == '.')
+    {
+        const char* fracStart = ++p;
+        while (*p >= '0' && *p <= '9')
+            p++;
+        // Horner from the last digit: x = (digit + x) / 10
+        for (const char* d = p - 1; d >= fracStart; d--)
+        {
+            r->limb[limbs - 1] = (uint32_t)(*d - '0');
+            uint64_t rem = 0;
+            for (int i = limbs - 1; i >= 0; i--)
+            {
+                uint64_t cur = (rem << 32) | r->limb[i];
+                r->limb[i] = (uint32_t)(cur / 10);
+                rem = cur % 10;
+            }
+        }
+    }
+    if (*p != '\0' || p == text)
+        return false;
+
+    r->limb[limbs - 1] = (uint32_t)whole;
+    if (negative)
+        bigNegate(r);
+    return true;
+}
+
+#endif
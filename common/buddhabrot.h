@@ -0,0 +1,441 @@
+/*
+ Buddhabrot / Anti-Buddhabrot orbit-density rendering shared by the image labs.
+ ------------------------------------------------------------------------------
+ A sample is a point c; its orbit z -> z*z + c is splatted into a histogram
+ over the view: every orbit point inside the view adds one to its bin. The
+ Buddhabrot keeps orbits that escape after BUDDHA_MIN_ITERATIONS .. maxIter
+ steps, the Anti-Buddhabrot the ones that never escape.
+ The increments land all over the image, so where they go is what scales:
+  - BUDDHA_PER_THREAD     every thread owns a histogram (first touched by the
+                          thread, so it sits on its node) and adds without
+                          atomics; a tiled merge sums them afterwards, each
+                          thread taking BUDDHA_MERGE_TILE bins of all of them
+  - BUDDHA_PER_NODE       one histogram per NUMA node (sysfs), relaxed atomic
+                          adds by the threads running there, same merge. It
+                          is zeroed by the first thread that samples on the
+                          node, so first-touch places it there, and the node
+                          is looked up again for every chain because
+                          unpinned threads migrate
+  - BUDDHA_SHARED_ATOMIC  one histogram, relaxed atomic adds, no merge
+ Samples come in chains of BUDDHA_CHAIN_SAMPLES orbits. Each chain draws from
+ its own counter-based random stream (draw n of chain k is a hash of seed, k
+ and n), and threads take chains from a shared counter, so the histogram is
+ the same for every thread count and strategy. The sampler is uniform over
+ [-2, 2]^2 or Metropolis-Hastings: a chain proposes a small mutation of its
+ current c (or, with probability 1 - BUDDHA_MUTATE_PROBABILITY, a fresh
+ uniform point) and accepts it with probability min(1, n'/n), n the number of
+ orbit points in view. That keeps chains on the rare long orbits, and the
+ image becomes the orbit density weighted by n, the usual trade of
+ importance-sampled Buddhabrots.
+*/
+#ifndef COMMON_BUDDHABROT_H
+#define COMMON_BUDDHABROT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <sched.h>
+#include "image_encoder.h"
+
+enum BuddhaHistograms
+{
+    BUDDHA_PER_THREAD,
+    BUDDHA_PER_NODE,
+    BUDDHA_SHARED_ATOMIC
+};
+
+enum BuddhaSampler
+{
+    BUDDHA_UNIFORM,
+    BUDDHA_METROPOLIS
+};
+
+const int BUDDHA_SIZE = 1000;               // square image over [-2, 1] x [-1.5, 1.5]
+const int BUDDHA_ITERATIONS = 1000;
+const int BUDDHA_MIN_ITERATIONS = 20;
+const int BUDDHA_ANTI_ITERATIONS = 200;
+const long long BUDDHA_DEFAULT_SAMPLES = 1 << 20;
+const int BUDDHA_CHAIN_SAMPLES = 4096;
+const size_t BUDDHA_MERGE_TILE = 16384;     // 64 KB of every histogram per tile
+const double BUDDHA_MUTATE_PROBABILITY = 0.8;
+const double BUDDHA_MUTATE_MIN = 1e-4;      // mutation radius range
+const double BUDDHA_MUTATE_MAX = 0.1;
+const uint64_t BUDDHA_SEED = 0x5eedb0dd4ab0f00dULL;
+
+struct BuddhaConfig
+{
+    int size;
+    int maxIter;
+    bool anti;
+    BuddhaSampler sampler;
+    long long samples;  // rounded up to whole chains
+};
+
+// Counter-based generator (splitmix64 finaliser): draw n of a stream is a
+// pure function of (key, n), whichever thread makes it
+inline uint64_t buddhaHash(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+struct BuddhaRandom
+{
+    uint64_t key;
+    uint64_t counter;
+
+    // uniform in [0, 1)
+    double next()
+    {
+        return (buddhaHash(key ^ buddhaHash(counter++)) >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// NUMA node of every CPU from /sys/devices/system/node/node<N>/cpulist;
+// a single node 0 when the tree is missing
+inline const std::vector<int>& buddhaCpuNodes(int* numNodes)
+{
+    static std::vector<int> cpuNodes;
+    static int nodes = 0;
+    if (nodes == 0)
+    {
+        for (int node = 0;; node++)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE* fp = fopen(path, "r");
+            if (fp == NULL)
+                break;
+            int first, last;
+            while (fscanf(fp, "%d", &first) == 1)
+            {
+                last = first;
+                int c = fgetc(fp);
+                if (c == '-' && fscanf(fp, "%d", &last) == 1)
+                    c = fgetc(fp);
+                if ((int)cpuNodes.size() <= last)
+                    cpuNodes.resize(last + 1, 0);
+                for (int cpu = first; cpu <= last; cpu++)
+                    cpuNodes[cpu] = node;
+                if (c != ',')
+                    break;
+            }
+            fclose(fp);
+            nodes = node + 1;
+        }
+        if (nodes == 0)
+            nodes = 1;
+    }
+    *numNodes = nodes;
+    return cpuNodes;
+}
+
+// Node the calling thread runs on right now
+inline int buddhaCurrentNode()
+{
+    int numNodes;
+    const std::vector<int>& cpuNodes = buddhaCpuNodes(&numNodes);
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < (int)cpuNodes.size() ? cpuNodes[cpu] : 0;
+}
+
+// Iterate c and store the bins of the orbit points inside the view in `bins`
+// (room for maxIter). Returns how many were stored, or 0 if the orbit does
+// not belong to the image (too short, escapes on the anti side, never escapes
+// on the other).
+inline int buddhaOrbit(const BuddhaConfig& config, double cx, double cy, int* bins)
+{
+    if (!config.anti)
+    {
+        // main cardioid and period-2 bulb never escape
+        double q = (cx - 0.25) * (cx - 0.25) + cy * cy;
+        if (q * (q + (cx - 0.25)) <= 0.25 * cy * cy || (cx + 1) * (cx + 1) + cy * cy <= 0.0625)
+            return 0;
+    }
+
+    double scale = config.size / 3.0;
+    double zx = 0, zy = 0;
+    int count = 0;
+    int it;
+    for (it = 0; it < config.maxIter; it++)
+    {
+        double x2 = zx * zx, y2 = zy * zy;
+        if (x2 + y2 > 4.0)
+            break;
+        zy = 2 * zx * zy + cy;
+        zx = x2 - y2 + cx;
+        double fx = (zx + 2.0) * scale, fy = (zy + 1.5) * scale;
+        if (fx >= 0 && fx < config.size && fy >= 0 && fy < config.size)
+            bins[count++] = (int)fy * config.size + (int)fx;
+    }
+    bool escaped = it < config.maxIter;
+    if (config.anti ? escaped : (!escaped || it < BUDDHA_MIN_ITERATIONS))
+        return 0;
+    return count;
+}
+
+inline void buddhaSplat(uint32_t* histogram, bool atomic, const int* bins, int count)
+{
+    if (atomic)
+    {
+        for (int i = 0; i < count; i++)
+            __atomic_fetch_add(&histogram[bins[i]], 1u, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+            histogram[bins[i]]++;
+    }
+}
+
+// One render: shared by the threads of a sampling and a merge phase
+struct BuddhaRun
+{
+    BuddhaConfig config;
+    BuddhaHistograms histograms;
+    long long numChains;
+    std::atomic<long long> nextChain;
+    std::atomic<size_t> nextTile;
+    std::atomic<long long> proposals;   // Metropolis-Hastings statistics
+    std::atomic<long long> accepted;
+    std::vector<std::vector<uint32_t> > partials;  // per thread or per node
+    std::mutex nodeLock;                           // allocation of the per-node ones
+    std::vector<uint32_t> image;                   // merged counts
+
+    BuddhaRun(const BuddhaConfig& config, BuddhaHistograms histograms, int numThreads)
+        : config(config), histograms(histograms), nextChain(0), nextTile(0), proposals(0), accepted(0)
+    {
+        numChains = (config.samples + BUDDHA_CHAIN_SAMPLES - 1) / BUDDHA_CHAIN_SAMPLES;
+        size_t bins = (size_t)config.size * config.size;
+        image.assign(bins, 0);
+        int numNodes;
+        buddhaCpuNodes(&numNodes);
+        if (histograms == BUDDHA_PER_THREAD)
+            partials.resize(numThreads);  // allocated by their threads
+        else if (histograms == BUDDHA_PER_NODE)
+            partials.resize(numNodes);    // allocated on first use on the node
+    }
+};
+
+// Histogram of the node the caller runs on, zeroed by the first thread there
+inline uint32_t* buddhaNodeHistogram(BuddhaRun* run)
+{
+    size_t node = buddhaCurrentNode() % run->partials.size();
+    std::lock_guard<std::mutex> lock(run->nodeLock);
+    if (run->partials[node].empty())
+        run->partials[node].assign((size_t)run->config.size * run->config.size, 0);
+    return run->partials[node].data();
+}
+
+// Sampling phase, run by every thread of the team; `thread` is 0 .. n - 1
+inline void buddhaSample(BuddhaRun* run, int thread)
+{
+    const BuddhaConfig& config = run->config;
+    uint32_t* histogram;
+    bool atomic = true;
+    if (run->histograms == BUDDHA_PER_THREAD)
+    {
+        run->partials[thread].assign((size_t)config.size * config.size, 0);
+        histogram = run->partials[thread].data();
+        atomic = false;
+    }
+    else if (run->histograms == BUDDHA_PER_NODE)
+        histogram = NULL;  // per chain, see below
+    else
+        histogram = run->image.data();
+
+    std::vector<int> current(config.maxIter), proposal(config.maxIter);
+    long long proposals = 0, accepted = 0;
+    for (;;)
+    {
+        long long chain = run->nextChain++;
+        if (chain >= run->numChains)
+            break;
+        if (run->histograms == BUDDHA_PER_NODE)
+            histogram = buddhaNodeHistogram(run);
+        BuddhaRandom random = { buddhaHash(BUDDHA_SEED ^ buddhaHash((uint64_t)chain)), 0 };
+        double cx = 0, cy = 0;
+        int count = 0;
+        for (int s = 0; s < BUDDHA_CHAIN_SAMPLES; s++)
+        {
+            // mutate only once the chain holds an orbit of the image
+            double px, py;
+            bool mutate = config.sampler == BUDDHA_METROPOLIS && count > 0 &&
+                          random.next() < BUDDHA_MUTATE_PROBABILITY;
+            if (mutate)
+            {
+                double radius = BUDDHA_MUTATE_MAX * exp(-log(BUDDHA_MUTATE_MAX / BUDDHA_MUTATE_MIN) * random.next());
+                double angle = 2 * M_PI * random.next();
+                px = cx + radius * cos(angle);
+                py = cy + radius * sin(angle);
+            }
+            else
+            {
+                px = 4 * random.next() - 2;
+                py = 4 * random.next() - 2;
+            }
+            int proposed = buddhaOrbit(config, px, py, proposal.data());
+
+            if (config.sampler == BUDDHA_UNIFORM)
+            {
+                buddhaSplat(histogram, atomic, proposal.data(), proposed);
+                continue;
+            }
+            // both proposals are symmetric, so the acceptance is the ratio of n
+            if (count > 0)
+                proposals++;
+            if (proposed > 0 && (count == 0 || proposed >= count || random.next() * count < proposed))
+            {
+                accepted += count > 0;
+                current.swap(proposal);
+                count = proposed;
+                cx = px;
+                cy = py;
+            }
+            buddhaSplat(histogram, atomic, current.data(), count);
+        }
+    }
+    run->proposals += proposals;
+    run->accepted += accepted;
+}
+
+// Merge phase: sum the partial histograms tile by tile into run->image
+inline void buddhaMerge(BuddhaRun* run, int thread)
+{
+    (void)thread;
+    size_t bins = run->image.size();
+    for (;;)
+    {
+        size_t first = run->nextTile++ * BUDDHA_MERGE_TILE;
+        if (first >= bins)
+            break;
+        size_t last = first + BUDDHA_MERGE_TILE < bins ? first + BUDDHA_MERGE_TILE : bins;
+        uint32_t* out = run->image.data();
+        for (size_t p = 0; p < run->partials.size(); p++)
+        {
+            if (run->partials[p].empty())  // a thread or node that sampled nothing
+                continue;
+            const uint32_t* in = run->partials[p].data();
+            for (size_t i = first; i < last; i++)
+                out[i] += in[i];
+        }
+    }
+}
+
+// Runs body(run, t) for t = 0 .. numThreads - 1 on the lab's threads
+typedef void (*BuddhaParallel)(int numThreads, void (*body)(BuddhaRun* run, int thread), BuddhaRun* run);
+
+inline const char* buddhaHistogramsName(BuddhaHistograms histograms)
+{
+    switch (histograms)
+    {
+        case BUDDHA_PER_THREAD: return "per thread";
+        case BUDDHA_PER_NODE: return "per NUMA node";
+        default: return "shared atomic";
+    }
+}
+
+inline uint64_t buddhaChecksum(const std::vector<uint32_t>& image)
+{
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (size_t i = 0; i < image.size(); i++)
+        hash = (hash ^ image[i]) * 1099511628211ULL;
+    return hash;
+}
+
+// Square-root tone mapping of the counts, written as basename.<format>
+inline bool buddhaWrite(const char* basename, const char* comment, const std::vector<uint32_t>& image, int size,
+                        ImageFormat format)
+{
+    uint32_t maxCount = 1;
+    for (size_t i = 0; i < image.size(); i++)
+        maxCount = image[i] > maxCount ? image[i] : maxCount;
+    std::vector<unsigned char> rgb(image.size() * 3);
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        double v = sqrt((double)image[i] / maxCount);
+        rgb[3 * i] = (unsigned char)(255 * v);
+        rgb[3 * i + 1] = (unsigned char)(255 * v);
+        rgb[3 * i + 2] = (unsigned char)(255 * sqrt(v));
+    }
+    char filename[128];
+    imageFilename(filename, sizeof(filename), basename, format);
+    EncodeStats stats;
+    bool ok = writeImage(filename, comment, rgb.data(), size, size, format, 1, &stats);
+    if (ok)
+        printf("Image written to %s (max %u hits per pixel)\n", filename, maxCount);
+    return ok;
+}
+
+// Render with every histogram strategy at every thread count, print the
+// samples/s table and write the image of the last run
+inline bool runBuddhabrotScaling(const BuddhaConfig& config, const int* threadCounts, int numCounts,
+                                 ImageFormat format, BuddhaParallel parallel)
+{
+    int numNodes;
+    buddhaCpuNodes(&numNodes);
+    long long samples = (config.samples + BUDDHA_CHAIN_SAMPLES - 1) / BUDDHA_CHAIN_SAMPLES * BUDDHA_CHAIN_SAMPLES;
+    const char* name = config.anti ? "Anti-Buddhabrot" : "Buddhabrot";
+    printf("\n=== %s: %d x %d, %lld %s samples in chains of %d, %d iterations, %d NUMA node(s) ===\n",
+           name, config.size, config.size, samples,
+           config.sampler == BUDDHA_METROPOLIS ? "Metropolis-Hastings" : "uniform",
+           BUDDHA_CHAIN_SAMPLES, config.maxIter, numNodes);
+    printf("Histograms    | Threads | Sample (ms) | Merge (ms) |  Msamples/s | Speedup | Accepted | Checksum\n");
+    printf("---------------------------------------------------------------------------------------------------\n");
+
+    const BuddhaHistograms strategies[] = {BUDDHA_PER_THREAD, BUDDHA_PER_NODE, BUDDHA_SHARED_ATOMIC};
+    uint64_t firstChecksum = 0;
+    bool identical = true;
+    std::vector<uint32_t> image;
+    for (int s = 0; s < 3; s++)
+    {
+        double baseRate = 0;
+        for (int c = 0; c < numCounts; c++)
+        {
+            BuddhaRun run(config, strategies[s], threadCounts[c]);
+            auto startTime = std::chrono::high_resolution_clock::now();
+            parallel(threadCounts[c], buddhaSample, &run);
+            auto sampledTime = std::chrono::high_resolution_clock::now();
+            if (strategies[s] != BUDDHA_SHARED_ATOMIC)
+                parallel(threadCounts[c], buddhaMerge, &run);
+            auto endTime = std::chrono::high_resolution_clock::now();
+
+            double sampleMs = std::chrono::duration<double, std::milli>(sampledTime - startTime).count();
+            double mergeMs = std::chrono::duration<double, std::milli>(endTime - sampledTime).count();
+            double rate = samples / ((sampleMs + mergeMs) / 1000.0);
+            if (c == 0)
+                baseRate = rate;
+            uint64_t checksum = buddhaChecksum(run.image);
+            if (s == 0 && c == 0)
+                firstChecksum = checksum;
+            identical = identical && checksum == firstChecksum;
+
+            printf("%-13s | %7d | %11.1f | %10.1f | %11.3f | %6.2fx | ", buddhaHistogramsName(strategies[s]),
+                   threadCounts[c], sampleMs, mergeMs, rate / 1e6, rate / baseRate);
+            if (run.proposals > 0)
+                printf("%7.1f%% | ", 100.0 * run.accepted / run.proposals);
+            else
+                printf("%8s | ", "-");
+            printf("%016llx\n", (unsigned long long)checksum);
+            if (s == 2 && c == numCounts - 1)
+                image.swap(run.image);
+        }
+    }
+    printf("Samples/s include the merge; histograms %s across thread counts and strategies\n",
+           identical ? "identical" : "DIFFER");
+
+    char comment[128];
+    snprintf(comment, sizeof(comment), "%s, %lld %s samples", name, samples,
+             config.sampler == BUDDHA_METROPOLIS ? "Metropolis-Hastings" : "uniform");
+    return buddhaWrite(config.anti ? "anti_buddhabrot" : "buddhabrot", comment, image, config.size, format) &&
+           identical;
+}
+
+#endif
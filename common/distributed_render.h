@@ -0,0 +1,277 @@
+/*
+ MPI distributed band rendering shared by the image labs.
+ --------------------------------------------------------
+ Only compiled with -DUSE_MPI (build with mpicxx, run with mpirun -np N).
+ The image is cut into bands of whole rows. Rank 0 is the master: it hands
+ out bands in the order the caller gives (row order, or most expensive
+ first from a cost prediction), keeps DIST_JOBS_IN_FLIGHT bands queued per
+ worker so no worker waits for its next job, and pwrite()s every returned
+ band straight to its place in the PPM file, so the full image is never held
+ in memory. Ranks 1 .. N-1 are workers: they render a band with their local
+ thread pool and send it back deflated (zlib level 1), which cuts the
+ traffic of the mostly flat images several times over.
+ distributedSweep() repeats the render with 1, 2, 4, ... workers inside one
+ mpirun and prints speedup and efficiency per worker count; the ranks left
+ out of a round return at once. With a single rank the master renders the
+ bands itself.
+*/
+#ifndef COMMON_DISTRIBUTED_RENDER_H
+#define COMMON_DISTRIBUTED_RENDER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mpi.h>
+#include <zlib.h>
+
+const int DIST_TAG_JOB = 1;
+const int DIST_TAG_RESULT = 2;
+const int DIST_STOP = -1;
+const int DIST_JOBS_IN_FLIGHT = 2;
+const int DIST_COMPRESSION = 1;
+const int DIST_RESULT_HEADER = 3 * sizeof(int);  // band, raw bytes, deflated bytes
+
+// Render rows [firstRow, endRow) into rgb (width * 3 bytes per row) with the
+// local thread pool; worker is 0 .. numWorkers - 1 (0 of 1 on a lone master)
+typedef void (*BandRenderer)(int firstRow, int endRow, int worker, int numWorkers, unsigned char* rgb);
+
+struct DistributedStats
+{
+    double seconds;
+    long long rawBytes;
+    long long sentBytes;
+    std::vector<int> bandsPerWorker;
+};
+
+inline int distributedRank()
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+}
+
+inline int distributedSize()
+{
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    return size;
+}
+
+// Threads per rank: the cores of this node shared by the ranks on it, so
+// mpirun -np N on one machine does not oversubscribe it N times
+inline int distributedLocalThreads()
+{
+    MPI_Comm node;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    int ranksOnNode;
+    MPI_Comm_size(node, &ranksOnNode);
+    MPI_Comm_free(&node);
+    int threads = (int)std::thread::hardware_concurrency() / ranksOnNode;
+    return threads > 0 ? threads : 1;
+}
+
+// Worker loop: render bands until the master sends DIST_STOP
+inline void distributedWorker(int width, int height, int bandRows, int worker, int numWorkers, BandRenderer render)
+{
+    size_t bandBytes = (size_t)bandRows * width * 3;
+    std::vector<unsigned char> rgb(bandBytes);
+    std::vector<unsigned char> message(DIST_RESULT_HEADER + compressBound(bandBytes));
+    for (;;)
+    {
+        int band;
+        MPI_Recv(&band, 1, MPI_INT, 0, DIST_TAG_JOB, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        if (band == DIST_STOP)
+            break;
+
+        int firstRow = band * bandRows;
+        int endRow = firstRow + bandRows < height ? firstRow + bandRows : height;
+        render(firstRow, endRow, worker, numWorkers, rgb.data());
+
+        uLongf deflated = (uLongf)(message.size() - DIST_RESULT_HEADER);
+        uLong raw = (uLong)(endRow - firstRow) * width * 3;
+        int status = compress2(message.data() + DIST_RESULT_HEADER, &deflated, rgb.data(), raw, DIST_COMPRESSION);
+        if (status != Z_OK)
+        {
+            printf("Worker %d: compressing band %d failed (zlib error %d)\n", worker, band, status);
+            fflush(stdout);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        int header[3] = { band, (int)raw, (int)deflated };
+        memcpy(message.data(), header, sizeof(header));
+        MPI_Send(message.data(), DIST_RESULT_HEADER + (int)deflated, MPI_BYTE, 0, DIST_TAG_RESULT, MPI_COMM_WORLD);
+    }
+}
+
+// Master loop: deal out `order`, write results as they arrive, stop the workers
+inline bool distributedMaster(const char* filename, const char* comment, int width, int height, int bandRows,
+                              const std::vector<int>& order, int numWorkers, BandRenderer render,
+                              DistributedStats* stats)
+{
+    char header[256];
+    size_t headerBytes = (size_t)snprintf(header, sizeof(header), "P6\n# %s\n%d\n%d\n%d\n", comment, width, height, 255);
+    size_t rowBytes = (size_t)width * 3;
+    size_t bandBytes = (size_t)bandRows * rowBytes;
+
+    stats->rawBytes = 0;
+    stats->sentBytes = 0;
+    stats->bandsPerWorker.assign(numWorkers > 0 ? numWorkers : 1, 0);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && pwrite(fd, header, headerBytes, 0) == (ssize_t)headerBytes &&
+              ftruncate(fd, (off_t)(headerBytes + rowBytes * height)) == 0;
+
+    std::vector<unsigned char> rgb(bandBytes);
+    std::vector<unsigned char> message(DIST_RESULT_HEADER + compressBound(bandBytes));
+    double startTime = MPI_Wtime();
+
+    if (numWorkers == 0)
+    {
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            int firstRow = order[i] * bandRows;
+            int endRow = firstRow + bandRows < height ? firstRow + bandRows : height;
+            render(firstRow, endRow, 0, 1, rgb.data());
+            size_t raw = (size_t)(endRow - firstRow) * rowBytes;
+            ok = ok && pwrite(fd, rgb.data(), raw, (off_t)(headerBytes + (size_t)firstRow * rowBytes)) == (ssize_t)raw;
+            stats->rawBytes += raw;
+            stats->bandsPerWorker[0]++;
+        }
+    }
+    else
+    {
+        size_t next = 0;
+        int outstanding = 0;
+        for (int k = 0; k < DIST_JOBS_IN_FLIGHT; k++)
+        {
+            for (int w = 1; w <= numWorkers && next < order.size(); w++)
+            {
+                MPI_Send(&order[next++], 1, MPI_INT, w, DIST_TAG_JOB, MPI_COMM_WORLD);
+                outstanding++;
+            }
+        }
+
+        while (outstanding > 0)
+        {
+            MPI_Status status;
+            int bytes;
+            MPI_Probe(MPI_ANY_SOURCE, DIST_TAG_RESULT, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_BYTE, &bytes);
+            MPI_Recv(message.data(), bytes, MPI_BYTE, status.MPI_SOURCE, DIST_TAG_RESULT, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+            outstanding--;
+            if (next < order.size())
+            {
+                MPI_Send(&order[next++], 1, MPI_INT, status.MPI_SOURCE, DIST_TAG_JOB, MPI_COMM_WORLD);
+                outstanding++;
+            }
+
+            int result[3];
+            memcpy(result, message.data(), sizeof(result));
+            uLongf raw = (uLongf)result[1];
+            if (uncompress(rgb.data(), &raw, message.data() + DIST_RESULT_HEADER, (uLong)result[2]) != Z_OK ||
+                raw != (uLongf)result[1])
+            {
+                ok = false;
+                continue;
+            }
+            size_t offset = headerBytes + (size_t)result[0] * bandBytes;
+            ok = ok && pwrite(fd, rgb.data(), raw, (off_t)offset) == (ssize_t)raw;
+            stats->rawBytes += (long long)raw;
+            stats->sentBytes += bytes;
+            stats->bandsPerWorker[status.MPI_SOURCE - 1]++;
+        }
+    }
+
+    for (int w = 1; w <= numWorkers; w++)
+    {
+        int stop = DIST_STOP;
+        MPI_Send(&stop, 1, MPI_INT, w, DIST_TAG_JOB, MPI_COMM_WORLD);
+    }
+    if (fd >= 0 && close(fd) != 0)
+        ok = false;
+    stats->seconds = MPI_Wtime() - startTime;
+    if (!ok)
+        printf("Failed to write %s\n", filename);
+    return ok;
+}
+
+// Collective: rank 0 assembles, ranks 1 .. numWorkers render, the rest return
+inline bool distributedRender(const char* filename, const char* comment, int width, int height, int bandRows,
+                              const std::vector<int>& order, int numWorkers, BandRenderer render,
+                              DistributedStats* stats)
+{
+    MPI_Barrier(MPI_COMM_WORLD);
+    int rank = distributedRank();
+    if (rank == 0)
+        return distributedMaster(filename, comment, width, height, bandRows, order, numWorkers, render, stats);
+    if (rank <= numWorkers)
+        distributedWorker(width, height, bandRows, rank - 1, numWorkers, render);
+    return true;
+}
+
+// Render basename_mpi_<k>_workers.ppm for k = 1, 2, 4, ... and all workers,
+// then print the scaling table on rank 0
+inline void distributedSweep(const char* basename, const char* comment, int width, int height, int bandRows,
+                             const std::vector<int>& order, BandRenderer render)
+{
+    int size = distributedSize();
+    int maxWorkers = size - 1;
+    std::vector<int> counts;
+    for (int k = 1; k < maxWorkers; k *= 2)
+        counts.push_back(k);
+    counts.push_back(maxWorkers);
+
+    bool master = distributedRank() == 0;
+    if (master)
+    {
+        printf("\n=== Distributed rendering: %d ranks (%d workers + master), %d threads per rank ===\n",
+               size, maxWorkers, distributedLocalThreads());
+        printf("Image %d x %d in %zu bands of %d rows\n", width, height, order.size(), bandRows);
+        if (maxWorkers == 0)
+            printf("Single rank: the master renders every band itself (run with mpirun -np N)\n");
+    }
+    else
+    {
+        distributedLocalThreads();  // collective
+    }
+
+    std::vector<DistributedStats> results(counts.size());
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s_mpi_%d_workers.ppm", basename, counts[i]);
+        bool ok = distributedRender(filename, comment, width, height, bandRows, order, counts[i], render, &results[i]);
+        if (master && ok)
+            printf("%d worker(s): %.3f s, image written to %s\n", counts[i], results[i].seconds, filename);
+    }
+
+    if (!master)
+        return;
+    printf("\nWorkers | Time (s) | Speedup | Efficiency | Sent MB (deflate ratio) | Bands per worker\n");
+    printf("-------------------------------------------------------------------------------------\n");
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        const DistributedStats& r = results[i];
+        int minBands = r.bandsPerWorker[0], maxBands = r.bandsPerWorker[0];
+        for (size_t w = 1; w < r.bandsPerWorker.size(); w++)
+        {
+            minBands = r.bandsPerWorker[w] < minBands ? r.bandsPerWorker[w] : minBands;
+            maxBands = r.bandsPerWorker[w] > maxBands ? r.bandsPerWorker[w] : maxBands;
+        }
+        // efficiency against the first round, per rendering rank
+        double speedup = results[0].seconds / r.seconds;
+        int baseWorkers = counts[0] > 0 ? counts[0] : 1;
+        int workers = counts[i] > 0 ? counts[i] : 1;
+        printf("%7d | %8.3f | %6.2fx | %9.1f%% | ", counts[i], r.seconds, speedup, 100.0 * speedup * baseWorkers / workers);
+        if (r.sentBytes > 0)
+            printf("%8.2f (%5.1f:1)     ", r.sentBytes / (1024.0 * 1024.0), (double)r.rawBytes / r.sentBytes);
+        else
+            printf("%-23s", "local, nothing sent");
+        printf(" | %d .. %d\n", minBands, maxBands);
+    }
+}
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ Package and DRAM energy of timed regions from RAPL via /sys/class/powercap.
+ -------------------------------------------------------------------------
+ Every powercap zone named package-N or dram is read before and after a
+ region: Intel RAPL, and AMD parts exposed by the same rapl driver. core,
+ uncore and psys zones are skipped, because package already contains them,
+ and so are intel-rapl-mmio zones, which repeat the package-N counter of the
+ MSR interface under the same name.
+ energy_uj wraps at max_energy_range_uj, and a delta corrects one wrap.
+ The counters are often readable by root only (energy_uj is mode 0400 on
+ current kernels). Without any readable zone the meter says so once and the
+ tables fall back to time only.
+ Readings cover whole sockets, so anything else running on the machine is
+ counted as well, and short regions are only as exact as the ~1 ms counter
+ updates.
+ EnergyReport keeps one row per configuration: time, joules, average watts
+ and work per joule. It names both the fastest and the most energy-efficient
+ configuration; on a power-capped machine, more threads can finish sooner
+ and still cost more per unit of work.
+*/
+#ifndef COMMON_ENERGY_METER_H
+#define COMMON_ENERGY_METER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <dirent.h>
+
+const char* const POWERCAP_ROOT = "/sys/class/powercap";
+
+enum EnergyDomain
+{
+    ENERGY_PACKAGE,
+    ENERGY_DRAM
+};
+
+struct EnergyZone
+{
+    std::string path;        // zone directory, e.g. /sys/class/powercap/intel-rapl:0
+    std::string name;        // package-0, dram
+    EnergyDomain domain;
+    unsigned long long range;  // counter wraps here (microjoules)
+};
+
+struct EnergySample
+{
+    double seconds;
+    double packageJoules;
+    double dramJoules;
+    bool valid;              // false without readable zones
+};
+
+inline bool readEnergyValue(const std::string& path, unsigned long long* value)
+{
+    FILE* fp = fopen(path.c_str(), "r");
+    if (fp == NULL)
+        return false;
+    bool ok = fscanf(fp, "%llu", value) == 1;
+    fclose(fp);
+    return ok;
+}
+
+class EnergyMeter
+{
+public:
+    EnergyMeter() : opened(false) {}
+
+    // Find the readable package and DRAM zones; false if there are none
+    bool open()
+    {
+        if (opened)
+            return !zones.empty();
+        opened = true;
+
+        DIR* dir = opendir(POWERCAP_ROOT);
+        if (dir != NULL)
+        {
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != NULL)
+            {
+                if (entry->d_name[0] == '.' || strncmp(entry->d_name, "intel-rapl-mmio", 15) == 0)
+                    continue;
+                EnergyZone zone;
+                zone.path = std::string(POWERCAP_ROOT) + "/" + entry->d_name;
+
+                char name[64] = "";
+                FILE* fp = fopen((zone.path + "/name").c_str(), "r");
+                if (fp == NULL)
+                    continue;
+                bool named = fscanf(fp, "%63s", name) == 1;
+                fclose(fp);
+                if (!named)
+                    continue;
+                zone.name = name;
+                if (strncmp(name, "package", 7) == 0)
+                    zone.domain = ENERGY_PACKAGE;
+                else if (strcmp(name, "dram") == 0)
+                    zone.domain = ENERGY_DRAM;
+                else
+                    continue;
+                // package-N is unique per socket (dram is not, each socket has one)
+                bool duplicate = false;
+                for (size_t i = 0; i < zones.size() && zone.domain == ENERGY_PACKAGE; i++)
+                    duplicate = duplicate || zones[i].name == zone.name;
+                if (duplicate)
+                    continue;
+
+                unsigned long long energy;
+                if (!readEnergyValue(zone.path + "/energy_uj", &energy) ||
+                    !readEnergyValue(zone.path + "/max_energy_range_uj", &zone.range))
+                    continue;
+                zones.push_back(zone);
+            }
+            closedir(dir);
+        }
+        std::sort(zones.begin(), zones.end(),
+                  [](const EnergyZone& a, const EnergyZone& b) { return a.path < b.path; });
+        startEnergy.assign(zones.size(), 0);
+
+        if (zones.empty())
+        {
+            printf("Energy: no readable RAPL zone under %s (needs RAPL and read access to energy_uj), "
+                   "reporting time only\n", POWERCAP_ROOT);
+        }
+        else
+        {
+            printf("Energy: RAPL zones");
+            for (size_t i = 0; i < zones.size(); i++)
+                printf(" %s (%s)", zones[i].name.c_str(), zones[i].path.c_str() + strlen(POWERCAP_ROOT) + 1);
+            printf("\n");
+        }
+        return !zones.empty();
+    }
+
+    bool available() const { return !zones.empty(); }
+
+    // Mark the start of a region
+    void start()
+    {
+        for (size_t i = 0; i < zones.size(); i++)
+            readEnergyValue(zones[i].path + "/energy_uj", &startEnergy[i]);
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    // Time and energy since start()
+    EnergySample stop()
+    {
+        EnergySample sample;
+        sample.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        sample.packageJoules = 0;
+        sample.dramJoules = 0;
+        sample.valid = !zones.empty();
+        for (size_t i = 0; i < zones.size(); i++)
+        {
+            unsigned long long energy;
+            if (!readEnergyValue(zones[i].path + "/energy_uj", &energy))
+            {
+                sample.valid = false;
+                continue;
+            }
+            unsigned long long delta = energy >= startEnergy[i] ? energy - startEnergy[i]
+                                                                 : energy + zones[i].range - startEnergy[i];
+            (zones[i].domain == ENERGY_PACKAGE ? sample.packageJoules : sample.dramJoules) += delta / 1e6;
+        }
+        return sample;
+    }
+
+private:
+    bool opened;
+    std::vector<EnergyZone> zones;
+    std::vector<unsigned long long> startEnergy;
+    std::chrono::steady_clock::time_point startTime;
+};
+
+struct EnergyRow
+{
+    std::string label;
+    EnergySample sample;
+    double work;             // in the report's unit, e.g. Mpixel or GFLOP
+};
+
+struct EnergyReport
+{
+    const char* workUnit;
+    std::vector<EnergyRow> rows;
+
+    void add(const std::string& label, const EnergySample& sample, double work)
+    {
+        rows.push_back(EnergyRow{ label, sample, work });
+    }
+};
+
+inline double energyJoules(const EnergySample& sample)
+{
+    return sample.packageJoules + sample.dramJoules;
+}
+
+// Table of every row, then the fastest and the most energy-efficient one
+inline void printEnergyReport(const EnergyReport& report, const char* title)
+{
+    bool measured = !report.rows.empty();
+    for (size_t i = 0; i < report.rows.size(); i++)
+        measured = measured && report.rows[i].sample.valid && energyJoules(report.rows[i].sample) > 0;
+
+    printf("\n=== %s: time and energy ===\n", title);
+    printf("%-32s | Time (s) | Package J |  DRAM J | Avg W | %s/s | %s/J\n", "Configuration", report.workUnit,
+           report.workUnit);
+    printf("-----------------------------------------------------------------------------------------------\n");
+    int fastest = -1, efficient = -1;
+    for (size_t i = 0; i < report.rows.size(); i++)
+    {
+        const EnergyRow& row = report.rows[i];
+        double joules = energyJoules(row.sample);
+        printf("%-32.32s | %8.3f | ", row.label.c_str(), row.sample.seconds);
+        if (measured)
+            printf("%9.2f | %7.2f | %5.1f | ", row.sample.packageJoules, row.sample.dramJoules, joules / row.sample.seconds);
+        else
+            printf("%9s | %7s | %5s | ", "-", "-", "-");
+        printf("%*.2f | ", (int)strlen(report.workUnit) + 2, row.work / row.sample.seconds);
+        if (measured)
+            printf("%.3f\n", row.work / joules);
+        else
+            printf("-\n");
+
+        if (fastest < 0 || row.sample.seconds < report.rows[fastest].sample.seconds)
+            fastest = (int)i;
+        if (measured && (efficient < 0 || row.work / joules > report.rows[efficient].work / energyJoules(report.rows[efficient].sample)))
+            efficient = (int)i;
+    }
+    if (fastest < 0)
+        return;
+
+    printf("Fastest:               %s (%.3f s)\n", report.rows[fastest].label.c_str(), report.rows[fastest].sample.seconds);
+    if (efficient < 0)
+    {
+        printf("Most energy-efficient: unknown without RAPL readings\n");
+        return;
+    }
+    const EnergyRow& best = report.rows[efficient];
+    printf("Most energy-efficient: %s (%.3f %s/J, %.1f W average)\n", best.label.c_str(),
+           best.work / energyJoules(best.sample), report.workUnit, energyJoules(best.sample) / best.sample.seconds);
+    if (efficient != fastest)
+    {
+        const EnergyRow& quick = report.rows[fastest];
+        printf("The fastest configuration needs %.0f%% more energy per %s\n",
+               100.0 * (energyJoules(quick.sample) / quick.work / (energyJoules(best.sample) / best.work) - 1.0),
+               report.workUnit);
+    }
+}
+
+#endif
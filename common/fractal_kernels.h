@@ -0,0 +1,304 @@
+/*
+ Generalized escape-time kernels: Multibrot z^d + c and Burning Ship
+ (|Re z| + i |Im z|)^d + c, each in Mandelbrot mode (z0 = 0, c = pixel) or
+ Julia mode (z0 = pixel, c fixed).
+ ------------------------------------------------------------------------
+ Formula, exponent and mode are template parameters, so every instantiation
+ has its power expanded at compile time (square and multiply on the constant
+ exponent, no pow() and no loop over d) and its own LANES-wide loop in the
+ style of escapeLanes, which vectorises the same way. Exponents 2 ..
+ FRACTAL_MAX_POWER are instantiated for float and double;
+ fractalRowKernel() picks the instantiation once, rows then call it through
+ a pointer. The double-double tier stays with the z*z + c kernels.
+ Multibrot d = 2 in Mandelbrot mode does the same operations as escapeLanes
+ and gives the same counts.
+*/
+#ifndef COMMON_FRACTAL_KERNELS_H
+#define COMMON_FRACTAL_KERNELS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mandelbrot_kernels.h"
+
+enum FractalFormula
+{
+    FRACTAL_MULTIBROT,
+    FRACTAL_BURNING_SHIP
+};
+
+struct FractalSpec
+{
+    FractalFormula formula;
+    int power;
+    bool julia;
+    double juliaRe;  // c of the Julia set
+    double juliaIm;
+};
+
+const int FRACTAL_MAX_POWER = 8;
+const double FRACTAL_DEFAULT_JULIA_RE = -0.8;
+const double FRACTAL_DEFAULT_JULIA_IM = 0.156;
+
+// Iteration counts of one row: pixel iX is x0 + iX * pixelWidth + i y
+typedef void (*FractalRowKernel)(double x0, double pixelWidth, double y, double cRe, double cIm,
+                                 int width, int maxIter, double er2, int* iterations);
+
+// (x + iy)^D, expanded at compile time
+template <int D, typename Real>
+inline void complexPower(Real x, Real y, Real* rx, Real* ry)
+{
+    if constexpr (D == 1)
+    {
+        *rx = x;
+        *ry = y;
+    }
+    else if constexpr (D == 2)
+    {
+        *rx = x * x - y * y;
+        *ry = 2 * x * y;
+    }
+    else if constexpr (D % 2 == 0)
+    {
+        Real hx, hy;
+        complexPower<D / 2>(x, y, &hx, &hy);
+        complexPower<2>(hx, hy, rx, ry);
+    }
+    else
+    {
+        Real px, py;
+        complexPower<D - 1>(x, y, &px, &py);
+        *rx = px * x - py * y;
+        *ry = px * y + py * x;
+    }
+}
+
+// LANES pixels of one row per step; padding lanes start far outside and escape at once
+template <typename Real, int LANES, FractalFormula FORMULA, int POWER, bool JULIA>
+inline void fractalLanes(const Real* px, Real py, Real cRe, Real cIm, int count, int maxIter, Real er2, int* iterations)
+{
+    Real zx[LANES], zy[LANES], cx[LANES], cy[LANES];
+    int it[LANES];
+    for (int l = 0; l < LANES; l++)
+    {
+        Real x = l < count ? px[l] : (Real)4;
+        zx[l] = JULIA ? x : 0;
+        zy[l] = JULIA ? py : 0;
+        cx[l] = JULIA ? cRe : x;
+        cy[l] = JULIA ? cIm : py;
+        it[l] = 0;
+    }
+
+    for (int step = 0; step < maxIter; step++)
+    {
+        int active = 0;
+        for (int l = 0; l < LANES; l++)
+        {
+            Real x = zx[l], y = zy[l];
+            bool live = (x * x + y * y) < er2;
+            if constexpr (FORMULA == FRACTAL_BURNING_SHIP)
+            {
+                x = x < 0 ? -x : x;
+                y = y < 0 ? -y : y;
+            }
+            Real nx, ny;
+            complexPower<POWER>(x, y, &nx, &ny);
+            nx += cx[l];
+            ny += cy[l];
+            zx[l] = live ? nx : zx[l];
+            zy[l] = live ? ny : zy[l];
+            it[l] += live ? 1 : 0;
+            active += live ? 1 : 0;
+        }
+        if (active == 0)
+            break;
+    }
+
+    for (int l = 0; l < count; l++)
+    {
+        iterations[l] = it[l];
+    }
+}
+
+template <typename Real, int LANES, FractalFormula FORMULA, int POWER, bool JULIA>
+inline void fractalRow(double x0, double pixelWidth, double y, double cRe, double cIm,
+                       int width, int maxIter, double er2, int* iterations)
+{
+    Real px[LANES];
+    for (int iX = 0; iX < width; iX += LANES)
+    {
+        int count = width - iX < LANES ? width - iX : LANES;
+        for (int l = 0; l < count; l++)
+            px[l] = (Real)(x0 + (iX + l) * pixelWidth);
+        fractalLanes<Real, LANES, FORMULA, POWER, JULIA>(px, (Real)y, (Real)cRe, (Real)cIm, count, maxIter,
+                                                         (Real)er2, iterations + iX);
+    }
+}
+
+// Instantiation for a runtime exponent: POWER .. FRACTAL_MAX_POWER, else NULL
+template <typename Real, int LANES, FractalFormula FORMULA, bool JULIA, int POWER = 2>
+inline FractalRowKernel fractalKernelForPower(int power)
+{
+    if constexpr (POWER > FRACTAL_MAX_POWER)
+    {
+        return NULL;
+    }
+    else
+    {
+        if (power == POWER)
+            return &fractalRow<Real, LANES, FORMULA, POWER, JULIA>;
+        return fractalKernelForPower<Real, LANES, FORMULA, JULIA, POWER + 1>(power);
+    }
+}
+
+template <typename Real, int LANES>
+inline FractalRowKernel fractalKernelForTier(const FractalSpec& spec)
+{
+    if (spec.formula == FRACTAL_BURNING_SHIP)
+    {
+        return spec.julia ? fractalKernelForPower<Real, LANES, FRACTAL_BURNING_SHIP, true>(spec.power)
+                          : fractalKernelForPower<Real, LANES, FRACTAL_BURNING_SHIP, false>(spec.power);
+    }
+    return spec.julia ? fractalKernelForPower<Real, LANES, FRACTAL_MULTIBROT, true>(spec.power)
+                      : fractalKernelForPower<Real, LANES, FRACTAL_MULTIBROT, false>(spec.power);
+}
+
+// Runtime dispatch to the instantiation; double-double runs in double.
+// NULL if the exponent is outside 2 .. FRACTAL_MAX_POWER.
+inline FractalRowKernel fractalRowKernel(const FractalSpec& spec, PrecisionTier tier)
+{
+    if (tier == PRECISION_FLOAT)
+        return fractalKernelForTier<float, FLOAT_LANES>(spec);
+    return fractalKernelForTier<double, DOUBLE_LANES>(spec);
+}
+
+// Runtime-parameter reference for the benchmarks: one pixel at a time in
+// double, the power by d - 1 multiplications. Same counts as the kernels up
+// to rounding (for d = 2 and 3 the operations are identical).
+inline void fractalRowGeneric(const FractalSpec& spec, double x0, double pixelWidth, double y,
+                              int width, int maxIter, double er2, int* iterations)
+{
+    for (int iX = 0; iX < width; iX++)
+    {
+        double px = x0 + iX * pixelWidth;
+        double zx = spec.julia ? px : 0.0, zy = spec.julia ? y : 0.0;
+        double cx = spec.julia ? spec.juliaRe : px, cy = spec.julia ? spec.juliaIm : y;
+        int it = 0;
+        while (it < maxIter && zx * zx + zy * zy < er2)
+        {
+            double ax = zx, ay = zy;
+            if (spec.formula == FRACTAL_BURNING_SHIP)
+            {
+                ax = fabs(ax);
+                ay = fabs(ay);
+            }
+            double rx = ax, ry = ay;
+            for (int k = 1; k < spec.power; k++)
+            {
+                double t = rx * ax - ry * ay;
+                ry = rx * ay + ry * ax;
+                rx = t;
+            }
+            zx = rx + cx;
+            zy = ry + cy;
+            it++;
+        }
+        iterations[iX] = it;
+    }
+}
+
+// The plain z*z + c Mandelbrot set, which the labs keep on escapeRow
+inline bool fractalIsMandelbrot(const FractalSpec& spec)
+{
+    return spec.formula == FRACTAL_MULTIBROT && spec.power == 2 && !spec.julia;
+}
+
+// mandelbrot | multibrot | burning-ship | julia, with its default exponent
+// (3 for multibrot, else 2); an explicit --power replaces it afterwards
+inline bool parseFractal(const char* name, FractalSpec* spec)
+{
+    spec->formula = FRACTAL_MULTIBROT;
+    spec->power = 2;
+    spec->julia = false;
+    if (strcmp(name, "multibrot") == 0)
+        spec->power = 3;
+    else if (strcmp(name, "burning-ship") == 0)
+        spec->formula = FRACTAL_BURNING_SHIP;
+    else if (strcmp(name, "julia") == 0)
+        spec->julia = true;
+    else if (strcmp(name, "mandelbrot") != 0)
+        return false;
+    return true;
+}
+
+// --fractal, --power and --julia-c as read from the command line; the
+// exponent and the Julia flag only apply once every option has been seen
+struct FractalArgs
+{
+    int power;        // 0: the default of the family
+    bool juliaGiven;
+};
+
+// If argv[*i] is --fractal name, --power d or --julia-c re im, consume it and
+// its values and return true; *valid turns false (message printed) for an
+// unknown name
+inline bool parseFractalArg(int argc, char** argv, int* i, FractalSpec* spec, FractalArgs* args, bool* valid)
+{
+    *valid = true;
+    if (strcmp(argv[*i], "--fractal") == 0 && *i + 1 < argc)
+    {
+        if (!parseFractal(argv[++*i], spec))
+        {
+            printf("Unknown fractal %s (expected mandelbrot, multibrot, burning-ship or julia)\n", argv[*i]);
+            *valid = false;
+        }
+    }
+    else if (strcmp(argv[*i], "--power") == 0 && *i + 1 < argc)
+        args->power = atoi(argv[++*i]);
+    else if (strcmp(argv[*i], "--julia-c") == 0 && *i + 2 < argc)
+    {
+        args->juliaGiven = true;
+        spec->juliaRe = atof(argv[++*i]);
+        spec->juliaIm = atof(argv[++*i]);
+    }
+    else
+        return false;
+    return true;
+}
+
+// Apply --power and --julia-c over the family; false (message printed) if
+// the exponent is outside 2 .. FRACTAL_MAX_POWER
+inline bool resolveFractalArgs(const FractalArgs& args, FractalSpec* spec)
+{
+    if (args.power != 0)
+        spec->power = args.power;
+    if (args.juliaGiven)
+        spec->julia = true;
+    if (spec->power < 2 || spec->power > FRACTAL_MAX_POWER)
+    {
+        printf("--power must be 2 .. %d\n", FRACTAL_MAX_POWER);
+        return false;
+    }
+    return true;
+}
+
+// Squared bail-out radius: er2, or |c|^2 for a Julia set with |c| beyond it
+inline double fractalEscapeRadius2(const FractalSpec& spec, double er2)
+{
+    double c2 = spec.juliaRe * spec.juliaRe + spec.juliaIm * spec.juliaIm;
+    return spec.julia && c2 > er2 ? c2 : er2;
+}
+
+// "Multibrot z^3 + c", "Burning Ship Julia z^2 + c, c = -0.8 + 0.156i"
+inline void fractalName(const FractalSpec& spec, char* name, size_t size)
+{
+    const char* family = spec.formula == FRACTAL_BURNING_SHIP ? (spec.julia ? "Burning Ship Julia" : "Burning Ship") :
+                         spec.julia ? "Julia" : spec.power == 2 ? "Mandelbrot" : "Multibrot";
+    if (spec.julia)
+        snprintf(name, size, "%s z^%d + c, c = %g %c %gi", family, spec.power, spec.juliaRe,
+                 spec.juliaIm < 0 ? '-' : '+', fabs(spec.juliaIm));
+    else
+        snprintf(name, size, "%s z^%d + c", family, spec.power);
+}
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ Parallel checksums of the PPM files the image labs write.
+ ---------------------------------------------------------
+ A file is mapped read-only and cut into blocks of CHECKSUM_BLOCK_ROWS rows;
+ threads hash blocks in parallel and the block hashes are folded in row
+ order, so the result does not depend on the thread count. Two hashes per
+ image:
+  - pixels  every byte of the RGB data, equal only for identical files
+  - mask    one bit per pixel, set where the pixel has the mask colour (the
+            black Mandelbrot interior, the grey Ulam non-primes). Renders of
+            the same picture by different thread counts, schedules or output
+            paths colour the rest by thread, so their pixel hashes differ but
+            their masks must not.
+ verifyImageChecksums() prints both for a set of files and checks that all
+ masks agree, and match an expected mask from a reference run if given.
+ Hashing runs at memory speed, far below the time of any render.
+*/
+#ifndef COMMON_IMAGE_CHECKSUM_H
+#define COMMON_IMAGE_CHECKSUM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const int CHECKSUM_BLOCK_ROWS = 64;
+
+struct ImageChecksum
+{
+    uint64_t pixels;
+    uint64_t mask;
+};
+
+inline uint64_t checksumMix(uint64_t hash, uint64_t word)
+{
+    hash ^= word * 0x9e3779b97f4a7c15ULL;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * 0xbf58476d1ce4e5b9ULL;
+}
+
+// Hashes of rows [firstRow, endRow) of a width-wide RGB image
+inline ImageChecksum checksumBlock(const unsigned char* rgb, int width, int firstRow, int endRow,
+                                   const unsigned char* maskColor)
+{
+    ImageChecksum block = { 0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL };
+    const unsigned char* p = rgb + (size_t)firstRow * width * 3;
+    size_t bytes = (size_t)(endRow - firstRow) * width * 3;
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        block.pixels = checksumMix(block.pixels, word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, bytes - i);
+    block.pixels = checksumMix(block.pixels, tail ^ bytes);
+
+    uint64_t bits = 0;
+    int used = 0;
+    for (size_t px = 0; px < bytes; px += 3)
+    {
+        bool inMask = p[px] == maskColor[0] && p[px + 1] == maskColor[1] && p[px + 2] == maskColor[2];
+        bits |= (uint64_t)inMask << used;
+        if (++used == 64)
+        {
+            block.mask = checksumMix(block.mask, bits);
+            bits = 0;
+            used = 0;
+        }
+    }
+    block.mask = checksumMix(block.mask, bits ^ ((uint64_t)used << 56));
+    return block;
+}
+
+// Both hashes of an in-memory image with numThreads threads
+inline ImageChecksum imageChecksum(const unsigned char* rgb, int width, int height, const unsigned char* maskColor,
+                                   int numThreads)
+{
+    int numBlocks = (height + CHECKSUM_BLOCK_ROWS - 1) / CHECKSUM_BLOCK_ROWS;
+    std::vector<ImageChecksum> blocks(numBlocks);
+    auto hashBlocks = [&](int thread)
+    {
+        for (int b = thread; b < numBlocks; b += numThreads)
+        {
+            int firstRow = b * CHECKSUM_BLOCK_ROWS;
+            int endRow = firstRow + CHECKSUM_BLOCK_ROWS < height ? firstRow + CHECKSUM_BLOCK_ROWS : height;
+            blocks[b] = checksumBlock(rgb, width, firstRow, endRow, maskColor);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; t++)
+        threads.push_back(std::thread(hashBlocks, t));
+    hashBlocks(0);
+    for (auto& thread : threads)
+        thread.join();
+
+    ImageChecksum sum = { (uint64_t)width << 32 | (uint32_t)height, (uint64_t)width << 32 | (uint32_t)height };
+    for (int b = 0; b < numBlocks; b++)
+    {
+        sum.pixels = checksumMix(sum.pixels, blocks[b].pixels);
+        sum.mask = checksumMix(sum.mask, blocks[b].mask);
+    }
+    return sum;
+}
+
+// Map a P6 file (maxval 255, comment lines allowed) and hash its pixels
+inline bool ppmChecksum(const char* filename, const unsigned char* maskColor, int numThreads, ImageChecksum* checksum)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 2)
+    {
+        if (fd >= 0)
+            close(fd);
+        printf("Cannot read %s\n", filename);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        printf("Cannot map %s\n", filename);
+        return false;
+    }
+    const unsigned char* data = (const unsigned char*)mapping;
+
+    // "P6", then width, height and maxval separated by whitespace or # comments
+    int fields[3];
+    size_t pos = 2;
+    bool ok = data[0] == 'P' && data[1] == '6';
+    for (int f = 0; f < 3 && ok; f++)
+    {
+        while (pos < size && (data[pos] == '#' || data[pos] == ' ' || data[pos] == '\n' || data[pos] == '\r' ||
+                              data[pos] == '\t'))
+        {
+            if (data[pos] == '#')
+                while (pos < size && data[pos] != '\n')
+                    pos++;
+            else
+                pos++;
+        }
+        fields[f] = 0;
+        size_t start = pos;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9' && fields[f] < 100000000)
+            fields[f] = fields[f] * 10 + (data[pos++] - '0');
+        ok = pos > start;
+    }
+    pos++;  // the single whitespace before the pixels
+    ok = ok && fields[2] == 255 && fields[0] > 0 && fields[1] > 0 &&
+         pos + (size_t)fields[0] * fields[1] * 3 <= size;
+    if (ok)
+        *checksum = imageChecksum(data + pos, fields[0], fields[1], maskColor, numThreads);
+    else
+        printf("%s is not a P6 image with maxval 255\n", filename);
+    munmap(mapping, size);
+    return ok;
+}
+
+// Print pixel and mask hashes of every file; true if all masks agree (and
+// equal expectedMask when it is not NULL, a hex value from a reference run)
+inline bool verifyImageChecksums(const std::vector<std::string>& filenames, const unsigned char* maskColor,
+                                 const char* expectedMask)
+{
+    int numThreads = (int)std::thread::hardware_concurrency();
+    numThreads = numThreads > 0 ? numThreads : 1;
+    printf("\n=== Image checksums (%d threads, mask colour %d %d %d) ===\n", numThreads, maskColor[0], maskColor[1],
+           maskColor[2]);
+
+    bool ok = true;
+    uint64_t firstMask = 0;
+    for (size_t i = 0; i < filenames.size(); i++)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        ImageChecksum checksum;
+        if (!ppmChecksum(filenames[i].c_str(), maskColor, numThreads, &checksum))
+        {
+            ok = false;
+            continue;
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        printf("%-40s pixels %016llx  mask %016llx  (%.1f ms)\n", filenames[i].c_str(),
+               (unsigned long long)checksum.pixels, (unsigned long long)checksum.mask, ms);
+        if (i == 0)
+            firstMask = checksum.mask;
+        else if (checksum.mask != firstMask)
+            ok = false;
+    }
+
+    if (expectedMask != NULL && ok)
+    {
+        uint64_t expected = strtoull(expectedMask, NULL, 16);
+        ok = expected == firstMask;
+        printf("Mask %s the reference %016llx\n", ok ? "matches" : "DIFFERS FROM", (unsigned long long)expected);
+    }
+    printf("Masks: %s\n", ok ? "all identical" : "MISMATCH");
+    return ok;
+}
+
+#endif
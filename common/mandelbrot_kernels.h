@@ -0,0 +1,307 @@
+/*
+ Escape-time kernels for z*z + c in three precision tiers.
+ ---------------------------------------------------------
+  float         - twice the SIMD width of double, enough for shallow views;
+                  chosen automatically only in builds that vectorise it
+                  (AVX2), since at plain -O2 it is slower than double and
+                  flips more pixels in and out of the set
+  double        - the original kernel
+  double-double - unevaluated sum hi + lo (~106 bit mantissa) for views
+                  deeper than double can resolve (pixel spacing < ~1e-13)
+ Every kernel works on LANES pixels at a time: all lanes step together and a
+ lane that escaped or reached maxIter is frozen, so the inner loops have no
+ data dependent branches and vectorise. The per-pixel result is identical to
+ the scalar loop  for (it = 0; it < maxIter && zx2 + zy2 < er2; it++)
+*/
+#ifndef COMMON_MANDELBROT_KERNELS_H
+#define COMMON_MANDELBROT_KERNELS_H
+
+#include <math.h>
+#include <string.h>
+
+enum PrecisionTier
+{
+    PRECISION_FLOAT,
+    PRECISION_DOUBLE,
+    PRECISION_DOUBLE_DOUBLE
+};
+
+// Pixel spacing relative to the coordinate magnitude at which a tier stops
+// being able to separate neighbouring pixels (with margin for the error that
+// iterating amplifies)
+const double FLOAT_MIN_RELATIVE_SPACING = 1e-5;
+const double DOUBLE_MIN_RELATIVE_SPACING = 1e-13;
+
+// Whether the float kernel is vectorised wide enough to beat double
+#if defined(__AVX2__)
+const bool FLOAT_TIER_VECTORISED = true;
+#else
+const bool FLOAT_TIER_VECTORISED = false;
+#endif
+
+inline const char* precisionName(PrecisionTier tier)
+{
+    switch (tier)
+    {
+        case PRECISION_FLOAT: return "float";
+        case PRECISION_DOUBLE: return "double";
+        default: return "double-double";
+    }
+}
+
+inline bool parsePrecision(const char* name, PrecisionTier* tier)
+{
+    if (strcmp(name, "float") == 0) { *tier = PRECISION_FLOAT; return true; }
+    if (strcmp(name, "double") == 0) { *tier = PRECISION_DOUBLE; return true; }
+    if (strcmp(name, "dd") == 0) { *tier = PRECISION_DOUBLE_DOUBLE; return true; }
+    return false;
+}
+
+// Pick the cheapest tier that still resolves the pixel grid of a view;
+// reason, if given, says why
+inline PrecisionTier choosePrecision(double pixelWidth, double pixelHeight,
+                                     double cxMin, double cxMax, double cyMin, double cyMax,
+                                     const char** reason = NULL)
+{
+    const char* unused;
+    if (reason == NULL)
+        reason = &unused;
+    double spacing = fmin(pixelWidth, pixelHeight);
+    double scale = fmax(fmax(fabs(cxMin), fabs(cxMax)), fmax(fabs(cyMin), fabs(cyMax)));
+    if (scale < 1.0)
+        scale = 1.0;
+    double relative = spacing / scale;
+    if (relative >= FLOAT_MIN_RELATIVE_SPACING && FLOAT_TIER_VECTORISED)
+    {
+        *reason = "auto: float resolves the view and this build vectorises it (AVX2)";
+        return PRECISION_FLOAT;
+    }
+    if (relative >= FLOAT_MIN_RELATIVE_SPACING)
+    {
+        *reason = "auto: float would resolve the view, but without AVX2 it is not faster than double";
+        return PRECISION_DOUBLE;
+    }
+    if (relative >= DOUBLE_MIN_RELATIVE_SPACING)
+    {
+        *reason = "auto: pixel spacing below what float resolves";
+        return PRECISION_DOUBLE;
+    }
+    *reason = "auto: pixel spacing below what double resolves";
+    return PRECISION_DOUBLE_DOUBLE;
+}
+
+/* double-double arithmetic */
+struct DD
+{
+    double hi;
+    double lo;
+};
+
+inline DD ddFromDouble(double a)
+{
+    DD r = {a, 0.0};
+    return r;
+}
+
+inline DD ddTwoSum(double a, double b)
+{
+    double s = a + b;
+    double bb = s - a;
+    DD r = {s, (a - (s - bb)) + (b - bb)};
+    return r;
+}
+
+inline DD ddQuickTwoSum(double a, double b)
+{
+    double s = a + b;
+    DD r = {s, b - (s - a)};
+    return r;
+}
+
+inline DD ddTwoProd(double a, double b)
+{
+    double p = a * b;
+#ifdef __FMA__
+    DD r = {p, fma(a, b, -p)};
+#else
+    // Dekker split, exact without a hardware fma
+    const double split = 134217729.0; /* 2^27 + 1 */
+    double ta = split * a;
+    double ah = ta - (ta - a);
+    double al = a - ah;
+    double tb = split * b;
+    double bh = tb - (tb - b);
+    double bl = b - bh;
+    DD r = {p, ((ah * bh - p) + ah * bl + al * bh) + al * bl};
+#endif
+    return r;
+}
+
+inline DD ddAdd(DD a, DD b)
+{
+    DD s = ddTwoSum(a.hi, b.hi);
+    DD t = ddTwoSum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = ddQuickTwoSum(s.hi, s.lo);
+    s.lo += t.lo;
+    return ddQuickTwoSum(s.hi, s.lo);
+}
+
+inline DD ddNeg(DD a)
+{
+    DD r = {-a.hi, -a.lo};
+    return r;
+}
+
+inline DD ddMul(DD a, DD b)
+{
+    DD p = ddTwoProd(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return ddQuickTwoSum(p.hi, p.lo);
+}
+
+inline DD ddMulDouble(DD a, double b)
+{
+    DD p = ddTwoProd(a.hi, b);
+    p.lo += a.lo * b;
+    return ddQuickTwoSum(p.hi, p.lo);
+}
+
+inline double ddToDouble(DD a)
+{
+    return a.hi + a.lo;
+}
+
+// origin + index * spacing without rounding the product
+inline DD ddGridCoordinate(DD origin, int index, double spacing)
+{
+    return ddAdd(origin, ddTwoProd((double)index, spacing));
+}
+
+/* SIMD lane batches */
+const int FLOAT_LANES = 16;
+const int DOUBLE_LANES = 8;
+const int DD_LANES = 4;
+
+// Escape-time kernel in float or double, LANES pixels per step
+template <typename Real, int LANES>
+inline void escapeLanes(const Real* cx, Real cy, int count, int maxIter, Real er2, int* iterations)
+{
+    Real zx[LANES], zy[LANES], zx2[LANES], zy2[LANES], c[LANES];
+    int it[LANES];
+    for (int l = 0; l < LANES; l++)
+    {
+        c[l] = l < count ? cx[l] : (Real)4;  /* padding lanes escape at once */
+        zx[l] = 0; zy[l] = 0; zx2[l] = 0; zy2[l] = 0;
+        it[l] = 0;
+    }
+
+    for (int step = 0; step < maxIter; step++)
+    {
+        int active = 0;
+        for (int l = 0; l < LANES; l++)
+        {
+            bool live = (zx2[l] + zy2[l]) < er2;
+            Real nzy = 2 * zx[l] * zy[l] + cy;
+            Real nzx = zx2[l] - zy2[l] + c[l];
+            zy[l] = live ? nzy : zy[l];
+            zx[l] = live ? nzx : zx[l];
+            zx2[l] = zx[l] * zx[l];
+            zy2[l] = zy[l] * zy[l];
+            it[l] += live ? 1 : 0;
+            active += live ? 1 : 0;
+        }
+        if (active == 0)
+            break;
+    }
+
+    for (int l = 0; l < count; l++)
+    {
+        iterations[l] = it[l];
+    }
+}
+
+// Escape-time kernel in double-double, DD_LANES pixels per step
+inline void escapeLanesDD(const DD* cx, DD cy, int count, int maxIter, double er2, int* iterations)
+{
+    DD zx[DD_LANES], zy[DD_LANES], c[DD_LANES];
+    int it[DD_LANES];
+    bool live[DD_LANES];
+    for (int l = 0; l < DD_LANES; l++)
+    {
+        c[l] = l < count ? cx[l] : ddFromDouble(4.0);
+        zx[l] = ddFromDouble(0.0);
+        zy[l] = ddFromDouble(0.0);
+        it[l] = 0;
+        live[l] = true;
+    }
+
+    for (int step = 0; step < maxIter; step++)
+    {
+        int active = 0;
+        for (int l = 0; l < DD_LANES; l++)
+        {
+            DD zx2 = ddMul(zx[l], zx[l]);
+            DD zy2 = ddMul(zy[l], zy[l]);
+            live[l] = live[l] && (zx2.hi + zy2.hi) < er2;
+            DD nzy = ddAdd(ddMulDouble(ddMul(zx[l], zy[l]), 2.0), cy);
+            DD nzx = ddAdd(ddAdd(zx2, ddNeg(zy2)), c[l]);
+            zy[l] = live[l] ? nzy : zy[l];
+            zx[l] = live[l] ? nzx : zx[l];
+            it[l] += live[l] ? 1 : 0;
+            active += live[l] ? 1 : 0;
+        }
+        if (active == 0)
+            break;
+    }
+
+    for (int l = 0; l < count; l++)
+    {
+        iterations[l] = it[l];
+    }
+}
+
+// Iteration counts of one row: pixel iX has c = (cxMin + iX * pixelWidth, cy)
+inline void escapeRow(PrecisionTier tier, DD cxMin, double pixelWidth, DD cy,
+                      int width, int maxIter, double er2, int* iterations)
+{
+    if (tier == PRECISION_FLOAT)
+    {
+        float cx[FLOAT_LANES];
+        float cyf = (float)ddToDouble(cy);
+        double x0 = ddToDouble(cxMin);
+        for (int iX = 0; iX < width; iX += FLOAT_LANES)
+        {
+            int count = width - iX < FLOAT_LANES ? width - iX : FLOAT_LANES;
+            for (int l = 0; l < count; l++)
+                cx[l] = (float)(x0 + (iX + l) * pixelWidth);
+            escapeLanes<float, FLOAT_LANES>(cx, cyf, count, maxIter, (float)er2, iterations + iX);
+        }
+    }
+    else if (tier == PRECISION_DOUBLE)
+    {
+        double cx[DOUBLE_LANES];
+        double cyd = ddToDouble(cy);
+        double x0 = ddToDouble(cxMin);
+        for (int iX = 0; iX < width; iX += DOUBLE_LANES)
+        {
+            int count = width - iX < DOUBLE_LANES ? width - iX : DOUBLE_LANES;
+            for (int l = 0; l < count; l++)
+                cx[l] = x0 + (iX + l) * pixelWidth;
+            escapeLanes<double, DOUBLE_LANES>(cx, cyd, count, maxIter, er2, iterations + iX);
+        }
+    }
+    else
+    {
+        DD cx[DD_LANES];
+        for (int iX = 0; iX < width; iX += DD_LANES)
+        {
+            int count = width - iX < DD_LANES ? width - iX : DD_LANES;
+            for (int l = 0; l < count; l++)
+                cx[l] = ddGridCoordinate(cxMin, iX + l, pixelWidth);
+            escapeLanesDD(cx, cy, count, maxIter, er2, iterations + iX);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ Compute-into-mmap PPM output shared by the image labs.
+ ------------------------------------------------------
+ The file is created at its final size with the P6 header in place, and the
+ pixel region is mapped MAP_SHARED, so workers render straight into the page
+ cache: there is no heap image and no fwrite copy.
+  - MAPPED_POPULATE   pre-faults the whole mapping (MAP_POPULATE)
+  - MAPPED_HUGEPAGES  asks for transparent huge pages (madvise hint only)
+  - MAPPED_RELEASE    keeps resident memory low: finished rows are reported
+                      with rowsDone(), and once the contiguous finished
+                      prefix (the watermark) is MAPPED_RELEASE_BYTES past the
+                      last release, that range is msync(MS_ASYNC)ed and
+                      dropped with madvise(MADV_DONTNEED). The data stays in
+                      the page cache and reaches the file as usual.
+ Rows are released only behind the watermark, so renderers that hand out
+ rows in order (dynamic blocks, interleaved rows) benefit the most.
+*/
+#ifndef COMMON_MAPPED_IMAGE_H
+#define COMMON_MAPPED_IMAGE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+enum MappedImageFlags
+{
+    MAPPED_POPULATE = 1,
+    MAPPED_HUGEPAGES = 2,
+    MAPPED_RELEASE = 4
+};
+
+const size_t MAPPED_RELEASE_BYTES = 64 * 1024 * 1024;
+
+class MappedImage
+{
+public:
+    MappedImage() : fd(-1), base(NULL), mappedBytes(0) {}
+
+    ~MappedImage()
+    {
+        close();
+    }
+
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    // Create `filename` as a width x height P6 image and map it for writing
+    bool open(const char* filename, const char* comment, int width, int height, unsigned flags)
+    {
+        this->width = width;
+        this->height = height;
+        this->flags = flags;
+        rowDone.assign((size_t)height, 0);
+        watermark = 0;
+        releasedBytes = 0;
+
+        char header[256];
+        headerBytes = (size_t)snprintf(header, sizeof(header), "P6\n# %s\n%d\n%d\n%d\n", comment, width, height, 255);
+        mappedBytes = headerBytes + (size_t)width * height * 3;
+
+        fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)mappedBytes) != 0 ||
+            pwrite(fd, header, headerBytes, 0) != (ssize_t)headerBytes)
+        {
+            printf("Failed to create %s\n", filename);
+            close();
+            return false;
+        }
+
+        int mapFlags = MAP_SHARED | ((flags & MAPPED_POPULATE) ? MAP_POPULATE : 0);
+        void* mapping = mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, mapFlags, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            printf("Failed to map %s\n", filename);
+            close();
+            return false;
+        }
+        base = (unsigned char*)mapping;
+#ifdef MADV_HUGEPAGE
+        if (flags & MAPPED_HUGEPAGES)
+            madvise(base, mappedBytes, MADV_HUGEPAGE);
+#endif
+        return true;
+    }
+
+    unsigned char* pixels() { return base + headerBytes; }
+    unsigned char* row(int y) { return pixels() + (size_t)y * width * 3; }
+
+    // Rows [firstRow, endRow) are final; may release memory behind the watermark
+    void rowsDone(int firstRow, int endRow)
+    {
+        if (!(flags & MAPPED_RELEASE))
+            return;
+
+        size_t releaseFrom = 0, releaseTo = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int y = firstRow; y < endRow; y++)
+                rowDone[y] = 1;
+            while (watermark < height && rowDone[watermark])
+                watermark++;
+
+            // only whole pages strictly behind the watermark
+            size_t doneEnd = headerBytes + (size_t)watermark * width * 3;
+            size_t pageEnd = doneEnd & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+            if (pageEnd >= releasedBytes + MAPPED_RELEASE_BYTES || (watermark == height && pageEnd > releasedBytes))
+            {
+                releaseFrom = releasedBytes;
+                releaseTo = pageEnd;
+                releasedBytes = pageEnd;
+            }
+        }
+
+        if (releaseTo > releaseFrom)
+        {
+            msync(base + releaseFrom, releaseTo - releaseFrom, MS_ASYNC);
+            madvise(base + releaseFrom, releaseTo - releaseFrom, MADV_DONTNEED);
+        }
+    }
+
+    // Unmap and close; the page cache writes the file back
+    bool close()
+    {
+        bool ok = fd >= 0 && base != NULL;
+        if (base != NULL && munmap(base, mappedBytes) != 0)
+            ok = false;
+        base = NULL;
+        if (fd >= 0 && ::close(fd) != 0)
+            ok = false;
+        fd = -1;
+        return ok;
+    }
+
+    size_t fileBytes() const { return mappedBytes; }
+    size_t released() const { return releasedBytes; }
+
+private:
+    int fd;
+    unsigned char* base;
+    size_t mappedBytes;
+    size_t headerBytes;
+    int width;
+    int height;
+    unsigned flags;
+    std::mutex mutex;
+    std::vector<char> rowDone;
+    int watermark;           // rows [0, watermark) are finished
+    size_t releasedBytes;    // mapping bytes [0, releasedBytes) were released
+};
+
+#endif
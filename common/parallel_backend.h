@@ -0,0 +1,566 @@
+/*
+ Interchangeable parallel-for backends, compared on the same kernel.
+ --------------------------------------------------------------------
+ parallelFor(backend, threads, n, grain, body) calls
+ body(first, last, worker, numWorkers) on disjoint ranges that together cover
+ [0, n):
+  - threads   one std::thread per worker and one contiguous static band each,
+              what the std::thread labs do by hand; grain is not used
+  - openmp    #pragma omp parallel for schedule(dynamic) over grain-sized
+              chunks; only in builds with -fopenmp
+  - stealing  WorkStealingPool: persistent workers, each with a deque of
+              ranges seeded with an equal share of [0, n). A worker halves its
+              range down to grain, runs the left part and pushes the right
+              ones; an idle worker steals the oldest (largest) range of
+              another worker. While it finds nothing it backs off: pause for
+              STEAL_SPIN_ROUNDS tries, yield for STEAL_YIELD_ROUNDS, then
+              sleep in naps doubling up to STEAL_MAX_NAP_US, so an imbalanced
+              tail does not keep every core busy (and in the energy figures).
+              The cost is at most one nap of delay in noticing new ranges or
+              the end of the job
+  - par       std::for_each(std::execution::par) over grain-sized chunks;
+              only in -DUSE_STD_PAR builds (libstdc++ runs it on TBB, link
+              with -ltbb). Not par_unseq: the bodies allocate row buffers,
+              which unsequenced execution does not allow. The runtime picks
+              its own thread count, and since par has no thread identity,
+              worker is the chunk index modulo threads
+ worker is meant for colouring output by worker; a body must not keep
+ per-worker scratch state, because under par two chunks with the same worker
+ number can run at once.
+ measureSchedulingOverhead() runs parallelFor with empty bodies, so the cost
+ of starting, splitting and joining is known apart from any kernel: once per
+ call (fork/join) and once per chunk. runBackendComparison() times a kernel
+ on every selected backend and thread count, next to that estimated
+ scheduling share and a correctness check supplied by the caller.
+*/
+#ifndef COMMON_PARALLEL_BACKEND_H
+#define COMMON_PARALLEL_BACKEND_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef USE_STD_PAR
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#endif
+
+enum ParallelBackend
+{
+    BACKEND_THREADS,
+    BACKEND_OPENMP,
+    BACKEND_STEALING,
+    BACKEND_STD_PAR
+};
+
+const int NUM_BACKENDS = 4;
+const unsigned ALL_BACKENDS = (1u << NUM_BACKENDS) - 1;
+
+// Empty-body microbenchmark: calls per fork/join estimate, and items (one
+// chunk each) of the per-chunk estimate
+const int OVERHEAD_CALLS = 200;
+const int OVERHEAD_CHUNK_CALLS = 10;
+const long long OVERHEAD_ITEMS = 1 << 16;
+
+// Backoff of an idle stealing worker: pause, then yield, then doubling naps
+const int STEAL_SPIN_ROUNDS = 64;
+const int STEAL_YIELD_ROUNDS = 64;
+const int STEAL_MAX_NAP_US = 64;
+
+inline const char* backendName(ParallelBackend backend)
+{
+    switch (backend)
+    {
+    case BACKEND_THREADS:
+        return "threads";
+    case BACKEND_OPENMP:
+        return "openmp";
+    case BACKEND_STEALING:
+        return "stealing";
+    default:
+        return "par";
+    }
+}
+
+// Whether this build contains the backend
+inline bool backendAvailable(ParallelBackend backend)
+{
+    (void)backend;
+#ifndef _OPENMP
+    if (backend == BACKEND_OPENMP)
+        return false;
+#endif
+#ifndef USE_STD_PAR
+    if (backend == BACKEND_STD_PAR)
+        return false;
+#endif
+    return true;
+}
+
+// What the build needs for a backend it does not contain
+inline const char* backendBuildHint(ParallelBackend backend)
+{
+    return backend == BACKEND_OPENMP ? "compile with -fopenmp" : "compile with -DUSE_STD_PAR and link -ltbb";
+}
+
+// threads | openmp | stealing | par | all, or a comma-separated list
+inline bool parseBackends(const char* names, unsigned* mask)
+{
+    *mask = 0;
+    while (*names != '\0')
+    {
+        const char* end = strchr(names, ',');
+        size_t length = end != NULL ? (size_t)(end - names) : strlen(names);
+        bool known = false;
+        if (length == 3 && strncmp(names, "all", 3) == 0)
+        {
+            *mask |= ALL_BACKENDS;
+            known = true;
+        }
+        for (int b = 0; b < NUM_BACKENDS && !known; b++)
+        {
+            const char* name = backendName((ParallelBackend)b);
+            if (length == strlen(name) && strncmp(names, name, length) == 0)
+            {
+                *mask |= 1u << b;
+                known = true;
+            }
+        }
+        if (!known)
+            return false;
+        names += length;
+        if (*names == ',')
+            names++;
+    }
+    return *mask != 0;
+}
+
+struct StealRange
+{
+    long long first;
+    long long last;
+};
+
+class WorkStealingPool
+{
+public:
+    // numThreads - 1 pool threads; the caller of run() is worker 0
+    explicit WorkStealingPool(int numThreads)
+        : numWorkers(numThreads), queues(numThreads), job(NULL), jobGrain(1), remaining(0), generation(0),
+          finished(0), stopping(false)
+    {
+        for (int w = 1; w < numWorkers; w++)
+            threads.push_back(std::thread(&WorkStealingPool::workerMain, this, w));
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    int size() const { return numWorkers; }
+
+    // body(first, last, worker, numWorkers) on ranges of at most grain items covering [0, n)
+    void run(long long n, long long grain, const std::function<void(long long, long long, int, int)>& body)
+    {
+        if (n <= 0)
+            return;
+        job = &body;
+        jobGrain = grain < 1 ? 1 : grain;
+        remaining.store(n);
+        for (int w = 0; w < numWorkers; w++)
+        {
+            long long first = n * w / numWorkers;
+            long long last = n * (w + 1) / numWorkers;
+            if (first < last)
+                queues[w].ranges.push_back(StealRange{ first, last });
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = 0;
+            generation++;
+        }
+        wake.notify_all();
+
+        execute(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return finished == numWorkers - 1; });
+    }
+
+private:
+    struct alignas(64) StealQueue
+    {
+        std::mutex lock;
+        std::deque<StealRange> ranges;
+    };
+
+    void workerMain(int w)
+    {
+        unsigned long long seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            execute(w);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished++;
+            }
+            done.notify_one();
+        }
+    }
+
+    // Newest range of the worker's own deque: the neighbour of what it just ran
+    bool popRange(int w, StealRange* range)
+    {
+        std::lock_guard<std::mutex> lock(queues[w].lock);
+        if (queues[w].ranges.empty())
+            return false;
+        *range = queues[w].ranges.back();
+        queues[w].ranges.pop_back();
+        return true;
+    }
+
+    // Oldest range of another worker, starting at a random victim
+    bool stealRange(int thief, unsigned long long* seed, StealRange* range)
+    {
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        int start = (int)(*seed % (unsigned long long)numWorkers);
+        for (int k = 0; k < numWorkers; k++)
+        {
+            int victim = (start + k) % numWorkers;
+            if (victim == thief)
+                continue;
+            std::lock_guard<std::mutex> lock(queues[victim].lock);
+            if (!queues[victim].ranges.empty())
+            {
+                *range = queues[victim].ranges.front();
+                queues[victim].ranges.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // One round of waiting for work; idle counts the empty rounds so far
+    static void backOff(int idle)
+    {
+        if (idle < STEAL_SPIN_ROUNDS)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            _mm_pause();
+#endif
+        }
+        else if (idle < STEAL_SPIN_ROUNDS + STEAL_YIELD_ROUNDS)
+            std::this_thread::yield();
+        else
+        {
+            int naps = idle - STEAL_SPIN_ROUNDS - STEAL_YIELD_ROUNDS;
+            int nap = STEAL_MAX_NAP_US;
+            if (naps < 30 && (1 << naps) < nap)
+                nap = 1 << naps;
+            std::this_thread::sleep_for(std::chrono::microseconds(nap));
+        }
+    }
+
+    void execute(int w)
+    {
+        unsigned long long seed = 0x9e3779b97f4a7c15ULL * (unsigned long long)(w + 1);
+        StealRange range;
+        int idle = 0;
+        while (remaining.load(std::memory_order_acquire) > 0)
+        {
+            if (!popRange(w, &range) && !stealRange(w, &seed, &range))
+            {
+                backOff(idle++);
+                continue;
+            }
+            idle = 0;
+            while (range.last - range.first > jobGrain)
+            {
+                long long middle = range.first + (range.last - range.first) / 2;
+                {
+                    std::lock_guard<std::mutex> lock(queues[w].lock);
+                    queues[w].ranges.push_back(StealRange{ middle, range.last });
+                }
+                range.last = middle;
+            }
+            (*job)(range.first, range.last, w, numWorkers);
+            remaining.fetch_sub(range.last - range.first, std::memory_order_acq_rel);
+        }
+    }
+
+    int numWorkers;
+    std::vector<StealQueue> queues;
+    std::vector<std::thread> threads;
+    const std::function<void(long long, long long, int, int)>* job;
+    long long jobGrain;
+    std::atomic<long long> remaining;  // items not yet run in the current job
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    unsigned long long generation;
+    int finished;                      // pool threads done with the current job
+    bool stopping;
+};
+
+// The pool of the last thread count, rebuilt when the count changes
+inline WorkStealingPool& stealingPool(int numThreads)
+{
+    static std::unique_ptr<WorkStealingPool> pool;
+    if (!pool || pool->size() != numThreads)
+    {
+        pool.reset();
+        pool.reset(new WorkStealingPool(numThreads));
+    }
+    return *pool;
+}
+
+// Start what a backend keeps between calls (pool threads, the OpenMP team,
+// the TBB scheduler behind par), so that timings do not include it
+inline void prepareBackend(ParallelBackend backend, int numThreads)
+{
+    if (backend == BACKEND_STEALING)
+        stealingPool(numThreads);
+#ifdef _OPENMP
+    if (backend == BACKEND_OPENMP)
+    {
+        #pragma omp parallel num_threads(numThreads)
+        {
+        }
+    }
+#endif
+#ifdef USE_STD_PAR
+    if (backend == BACKEND_STD_PAR)
+    {
+        std::vector<long long> warmup(numThreads);
+        std::for_each(std::execution::par, warmup.begin(), warmup.end(), [](long long& item) { item++; });
+    }
+#endif
+}
+
+// Ranges body() is called with for n items
+inline long long backendChunkCount(ParallelBackend backend, int numThreads, long long n, long long grain)
+{
+    if (backend == BACKEND_THREADS)
+        return n < numThreads ? n : numThreads;
+    return (n + grain - 1) / grain;
+}
+
+template <typename Body>
+inline void parallelFor(ParallelBackend backend, int numThreads, long long n, long long grain, Body body)
+{
+    if (n <= 0)
+        return;
+    grain = grain < 1 ? 1 : grain;
+    switch (backend)
+    {
+    case BACKEND_THREADS:
+    {
+        std::vector<std::thread> threads;
+        for (int t = 1; t < numThreads; t++)
+        {
+            long long first = n * t / numThreads;
+            long long last = n * (t + 1) / numThreads;
+            if (first < last)
+                threads.push_back(std::thread([&body, first, last, t, numThreads] { body(first, last, t, numThreads); }));
+        }
+        if (n / numThreads > 0)
+            body(0, n / numThreads, 0, numThreads);
+        for (auto& thread : threads)
+            thread.join();
+        break;
+    }
+    case BACKEND_OPENMP:
+    {
+#ifdef _OPENMP
+        long long chunks = (n + grain - 1) / grain;
+        #pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+        for (long long c = 0; c < chunks; c++)
+            body(c * grain, (c + 1) * grain < n ? (c + 1) * grain : n, omp_get_thread_num(), numThreads);
+#endif
+        break;
+    }
+    case BACKEND_STEALING:
+    {
+        std::function<void(long long, long long, int, int)> job = [&body](long long first, long long last, int worker,
+                                                                          int numWorkers)
+        {
+            body(first, last, worker, numWorkers);
+        };
+        stealingPool(numThreads).run(n, grain, job);
+        break;
+    }
+    case BACKEND_STD_PAR:
+    {
+#ifdef USE_STD_PAR
+        std::vector<long long> chunkIndex((n + grain - 1) / grain);
+        std::iota(chunkIndex.begin(), chunkIndex.end(), 0LL);
+        std::for_each(std::execution::par, chunkIndex.begin(), chunkIndex.end(), [&](long long c)
+        {
+            body(c * grain, (c + 1) * grain < n ? (c + 1) * grain : n, (int)(c % numThreads), numThreads);
+        });
+#endif
+        break;
+    }
+    }
+}
+
+struct SchedulingOverhead
+{
+    double callMicroseconds;   // one parallelFor over one item per worker
+    double chunkNanoseconds;   // every further chunk
+};
+
+// Empty-body parallelFor: OVERHEAD_CALLS fork/joins, then OVERHEAD_ITEMS
+// single-item chunks (the threads backend still makes one band per worker)
+inline SchedulingOverhead measureSchedulingOverhead(ParallelBackend backend, int numThreads)
+{
+    auto empty = [](long long first, long long last, int worker, int numWorkers)
+    {
+        (void)first;
+        (void)last;
+        (void)worker;
+        (void)numWorkers;
+    };
+    prepareBackend(backend, numThreads);
+
+    auto startTime = std::chrono::steady_clock::now();
+    for (int call = 0; call < OVERHEAD_CALLS; call++)
+        parallelFor(backend, numThreads, numThreads, 1, empty);
+    double callSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() / OVERHEAD_CALLS;
+
+    startTime = std::chrono::steady_clock::now();
+    for (int call = 0; call < OVERHEAD_CHUNK_CALLS; call++)
+        parallelFor(backend, numThreads, OVERHEAD_ITEMS, 1, empty);
+    double chunkCallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() / OVERHEAD_CHUNK_CALLS;
+
+    SchedulingOverhead overhead;
+    overhead.callMicroseconds = callSeconds * 1e6;
+    long long extraChunks = backendChunkCount(backend, numThreads, OVERHEAD_ITEMS, 1) -
+                            backendChunkCount(backend, numThreads, numThreads, 1);
+    overhead.chunkNanoseconds = extraChunks > 0 && chunkCallSeconds > callSeconds
+                                    ? (chunkCallSeconds - callSeconds) / extraChunks * 1e9 : 0.0;
+    return overhead;
+}
+
+// Time body over n items with the grain on every selected backend and thread
+// count. check() runs after each kernel and says whether its result is right.
+// Returns false if any check failed.
+template <typename Body, typename Check>
+inline bool runBackendComparison(const char* kernel, unsigned backends, const int* threadCounts, int numCounts,
+                                 long long n, long long grain, double work, const char* workUnit,
+                                 Body body, Check check)
+{
+    printf("\n=== Parallel backends: %s, %lld items, grain %lld ===\n", kernel, n, grain);
+    for (int b = 0; b < NUM_BACKENDS; b++)
+    {
+        if ((backends & (1u << b)) && !backendAvailable((ParallelBackend)b))
+        {
+            printf("Backend %s is not in this build (%s), skipped\n", backendName((ParallelBackend)b),
+                   backendBuildHint((ParallelBackend)b));
+            backends &= ~(1u << b);
+        }
+    }
+#ifdef USE_STD_PAR
+    if (backends & (1u << BACKEND_STD_PAR))
+        printf("Backend par uses the thread count of its runtime; its thread column only numbers the colours\n");
+#endif
+
+    printf("\nScheduling overhead (empty body, %d calls and %lld single-item chunks):\n", OVERHEAD_CALLS,
+           OVERHEAD_ITEMS);
+    printf("Backend  | Threads | Fork/join (us) | Per chunk (ns)\n");
+    printf("-------------------------------------------------------\n");
+    std::vector<SchedulingOverhead> overheads(NUM_BACKENDS * numCounts);
+    for (int b = 0; b < NUM_BACKENDS; b++)
+    {
+        if (!(backends & (1u << b)))
+            continue;
+        for (int i = 0; i < numCounts; i++)
+        {
+            SchedulingOverhead& overhead = overheads[b * numCounts + i];
+            overhead = measureSchedulingOverhead((ParallelBackend)b, threadCounts[i]);
+            printf("%-8s | %7d | %14.2f | ", backendName((ParallelBackend)b), threadCounts[i], overhead.callMicroseconds);
+            if (b == BACKEND_THREADS)
+                printf("%14s\n", "- (bands)");
+            else
+                printf("%14.1f\n", overhead.chunkNanoseconds);
+        }
+    }
+
+    printf("\nKernel:\n");
+    printf("Backend  | Threads | Time (s) | Speedup | %s/s | Scheduling | Check\n", workUnit);
+    printf("--------------------------------------------------------------------------\n");
+    bool ok = true;
+    double bestSeconds = 0.0;
+    int bestBackend = -1, bestThreads = 0;
+    for (int b = 0; b < NUM_BACKENDS; b++)
+    {
+        if (!(backends & (1u << b)))
+            continue;
+        double baseSeconds = 0.0;
+        for (int i = 0; i < numCounts; i++)
+        {
+            ParallelBackend backend = (ParallelBackend)b;
+            int numThreads = threadCounts[i];
+            prepareBackend(backend, numThreads);
+            auto startTime = std::chrono::steady_clock::now();
+            parallelFor(backend, numThreads, n, grain, body);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            bool correct = check();
+            ok = ok && correct;
+
+            // Estimated share of scheduling from the empty-body figures
+            const SchedulingOverhead& overhead = overheads[b * numCounts + i];
+            double schedulingSeconds = overhead.callMicroseconds * 1e-6 +
+                                       backendChunkCount(backend, numThreads, n, grain) * overhead.chunkNanoseconds * 1e-9;
+            if (i == 0)
+                baseSeconds = seconds;
+            printf("%-8s | %7d | %8.3f | %6.2fx | %*.2f | %9.3f%% | %s\n", backendName(backend), numThreads, seconds,
+                   baseSeconds / seconds, (int)strlen(workUnit) + 2, work / seconds,
+                   100.0 * schedulingSeconds / seconds, correct ? "OK" : "MISMATCH");
+            if (bestBackend < 0 || seconds < bestSeconds)
+            {
+                bestSeconds = seconds;
+                bestBackend = b;
+                bestThreads = numThreads;
+            }
+        }
+    }
+    if (bestBackend >= 0)
+        printf("Fastest: %s with %d threads (%.3f s)\n", backendName((ParallelBackend)bestBackend), bestThreads,
+               bestSeconds);
+    printf("Results: %s\n", ok ? "all correct" : "MISMATCH");
+    return ok;
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ Perturbation-theory deep zoom for z*z + c.
+ ------------------------------------------
+ One reference orbit Z_n is iterated in BigFixed precision and stored as
+ doubles. Every pixel c = C + dc then only iterates its difference
+   dz_{n+1} = 2 Z_n dz_n + dz_n^2 + dc
+ in plain double, which is enough while dc stays above ~1e-300.
+  - Series approximation: dz_n ~ a_n u + b_n u^2 + c_n u^3 with u = dc / d and
+    d the largest |dc| of the view (coefficients are stored pre-scaled by
+    d, d^2, d^3 so they stay in double range). All pixels start at the last
+    iteration where the cubic term is still negligible.
+  - Glitches / rebasing: when |Z_n + dz_n| < |dz_n| the pixel is closer to 0
+    than to the reference and the delta has lost its precision, so the
+    pixel continues from dz = Z_n + dz_n against Z_0 (Zhuoran's rebasing).
+    The same happens when the reference orbit ends before the pixel does.
+*/
+#ifndef COMMON_PERTURBATION_H
+#define COMMON_PERTURBATION_H
+
+#include <math.h>
+#include <vector>
+#include "bigfixed.h"
+
+// Relative size of the cubic series term that ends the skipped iterations
+const double SERIES_TOLERANCE = 1e-12;
+
+struct ReferenceOrbit
+{
+    BigFixed cx;
+    BigFixed cy;
+    int maxIter;
+    std::vector<double> zx;  // Z_0 .. Z_last as doubles
+    std::vector<double> zy;
+    int last;                // index of the last stored point
+};
+
+struct SeriesApproximation
+{
+    int skip;         // iterations every pixel skips
+    double scale;     // d, the largest |dc| in the view
+    double ax, ay;    // pre-scaled coefficients at iteration `skip`
+    double bx, by;
+    double cx, cy;
+};
+
+struct PerturbationStats
+{
+    long long rebases;  // glitches detected and corrected by rebasing
+    long long iterations;
+};
+
+// Iterate the reference point with arbitrary precision until it escapes or
+// reaches maxIter
+inline void computeReferenceOrbit(const BigFixed& cx, const BigFixed& cy, int maxIter, ReferenceOrbit* orbit)
+{
+    int limbs = cx.limbs;
+    orbit->cx = cx;
+    orbit->cy = cy;
+    orbit->maxIter = maxIter;
+    orbit->zx.assign(1, 0.0);
+    orbit->zy.assign(1, 0.0);
+
+    BigFixed zx, zy, zx2, zy2, zxy, t;
+    bigZero(&zx, limbs);
+    bigZero(&zy, limbs);
+    for (int n = 0; n < maxIter; n++)
+    {
+        bigMul(zx, zx, &zx2);
+        bigMul(zy, zy, &zy2);
+        bigMul(zx, zy, &zxy);
+        bigSub(zx2, zy2, &t);
+        bigAdd(t, cx, &zx);
+        bigAdd(zxy, zxy, &t);
+        bigAdd(t, cy, &zy);
+
+        double x = bigToDouble(zx);
+        double y = bigToDouble(zy);
+        orbit->zx.push_back(x);
+        orbit->zy.push_back(y);
+        if (x * x + y * y > 4.0)
+            break;
+    }
+    orbit->last = (int)orbit->zx.size() - 1;
+}
+
+// Find how many iterations the cubic series can skip for deltas up to `scale`
+inline void computeSeries(const ReferenceOrbit& orbit, double scale, SeriesApproximation* series)
+{
+    double ax = 0.0, ay = 0.0, bx = 0.0, by = 0.0, cx = 0.0, cy = 0.0;
+    series->skip = 0;
+    series->scale = scale;
+    series->ax = ax; series->ay = ay;
+    series->bx = bx; series->by = by;
+    series->cx = cx; series->cy = cy;
+
+    for (int n = 0; n + 1 < orbit.last; n++)
+    {
+        double zx = orbit.zx[n];
+        double zy = orbit.zy[n];
+        // a' = 2 Z a + d,  b' = 2 Z b + a^2,  c' = 2 Z c + 2 a b
+        double nax = 2 * (zx * ax - zy * ay) + scale;
+        double nay = 2 * (zx * ay + zy * ax);
+        double nbx = 2 * (zx * bx - zy * by) + (ax * ax - ay * ay);
+        double nby = 2 * (zx * by + zy * bx) + 2 * ax * ay;
+        double ncx = 2 * (zx * cx - zy * cy) + 2 * (ax * bx - ay * by);
+        double ncy = 2 * (zx * cy + zy * cx) + 2 * (ax * by + ay * bx);
+
+        double aMag = nax * nax + nay * nay;
+        double cMag = ncx * ncx + ncy * ncy;
+        if (!(cMag <= SERIES_TOLERANCE * SERIES_TOLERANCE * aMag))
+            break;
+
+        ax = nax; ay = nay;
+        bx = nbx; by = nby;
+        cx = ncx; cy = ncy;
+        series->skip = n + 1;
+        series->ax = ax; series->ay = ay;
+        series->bx = bx; series->by = by;
+        series->cx = cx; series->cy = cy;
+    }
+}
+
+// Escape iteration of the pixel at dc from the reference point (maxIter if it
+// never escapes); matches  for (it = 0; it < maxIter && |z|^2 < er2; it++)
+inline int perturbPixel(const ReferenceOrbit& orbit, const SeriesApproximation& series,
+                        double dcx, double dcy, int maxIter, double er2, PerturbationStats* stats)
+{
+    int n = series.skip;
+    double dzx = 0.0, dzy = 0.0;
+    if (n > 0)
+    {
+        double ux = dcx / series.scale;
+        double uy = dcy / series.scale;
+        double u2x = ux * ux - uy * uy;
+        double u2y = 2 * ux * uy;
+        double u3x = u2x * ux - u2y * uy;
+        double u3y = u2x * uy + u2y * ux;
+        dzx = series.ax * ux - series.ay * uy + series.bx * u2x - series.by * u2y + series.cx * u3x - series.cy * u3y;
+        dzy = series.ax * uy + series.ay * ux + series.bx * u2y + series.by * u2x + series.cx * u3y + series.cy * u3x;
+    }
+
+    int iteration = n;
+    long long rebases = 0;
+    while (iteration < maxIter)
+    {
+        double zx = orbit.zx[n];
+        double zy = orbit.zy[n];
+        double tx = 2 * (zx * dzx - zy * dzy) + (dzx * dzx - dzy * dzy) + dcx;
+        double ty = 2 * (zx * dzy + zy * dzx) + 2 * dzx * dzy + dcy;
+        dzx = tx;
+        dzy = ty;
+        n++;
+        iteration++;
+
+        double fx = orbit.zx[n] + dzx;
+        double fy = orbit.zy[n] + dzy;
+        double mag = fx * fx + fy * fy;
+        if (mag >= er2)
+            break;
+        if (mag < dzx * dzx + dzy * dzy || n == orbit.last)
+        {
+            dzx = fx;
+            dzy = fy;
+            n = 0;
+            rebases++;
+        }
+    }
+
+    if (stats != NULL)
+    {
+        stats->rebases += rebases;
+        stats->iterations += iteration - series.skip;
+    }
+    return iteration;
+}
+
+#endif
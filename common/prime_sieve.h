@@ -0,0 +1,338 @@
+/*
+ Segmented mod-30 wheel sieve for the Ulam spiral lab.
+ -----------------------------------------------------
+ Multiples of 2, 3 and 5 are never stored: byte b holds one bit for each of
+ the eight numbers 30b + {1, 7, 11, 13, 17, 19, 23, 29} (1 = prime), i.e.
+ ~33 MB per 1e9. The range is cut into L1-sized segments that OpenMP threads
+ sieve independently; a prime p crosses off its multiples p*q, q = w (mod 30),
+ along eight progressions that each advance by p bytes with a fixed bit.
+ After the build the table is only read, so every renderer shares it without
+ synchronisation. A table can also be a window [lo, hi] far from 0 that is
+ sieved on its own with precomputed base primes (the tiled renderer keeps one
+ per ring band of tiles).
+
+ The bitmap can be kept in a versioned cache file (header + raw bytes) that
+ later runs map read-only, so a warm start costs page faults instead of
+ sieving. A run that needs a larger limit extends the file in place and only
+ sieves the new tail; the header's byte count is written last, so an
+ interrupted extension just leaves the old, still valid table.
+*/
+#ifndef COMMON_PRIME_SIEVE_H
+#define COMMON_PRIME_SIEVE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bytes per segment: 32 KB (the size of a typical L1d) = 983040 numbers
+const long long SIEVE_SEGMENT_BYTES = 32 * 1024;
+
+const int WHEEL = 30;
+const int WHEEL_RESIDUES[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+// Bit of residue r = n % 30 inside its byte, -1 if n shares a factor with 30
+const int WHEEL_BIT[WHEEL] =
+{
+    -1, 0, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 3, -1, -1,
+    -1, 4, -1, 5, -1, -1, -1, 6, -1, -1, -1, -1, -1, 7
+};
+
+/* cache file layout: PrimeCacheHeader, then numBytes bitmap bytes */
+const char PRIME_CACHE_MAGIC[8] = { 'U', 'L', 'A', 'M', 'W', 'H', 'L', '\0' };
+const uint32_t PRIME_CACHE_VERSION = 1;
+
+struct PrimeCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t wheel;
+    uint64_t numBytes;
+    uint8_t reserved[40];
+};
+
+enum PrimeTableSource
+{
+    PRIME_TABLE_MEMORY,    // sieved into private memory, no cache file
+    PRIME_TABLE_BUILT,     // sieved into a new cache file
+    PRIME_TABLE_EXTENDED,  // existing cache file grown and its tail sieved
+    PRIME_TABLE_MAPPED     // existing cache file was large enough
+};
+
+struct PrimeTable
+{
+    long long limit;               // largest number the table answers for
+    long long firstByte;           // wheel byte of bytes[0], 0 unless a window
+    const uint8_t* bytes;
+    size_t numBytes;
+    std::vector<uint8_t> owned;    // storage of PRIME_TABLE_MEMORY tables
+    void* mapping;                 // header + bitmap of cache-backed tables
+    size_t mappingBytes;
+    PrimeTableSource source;
+    size_t sievedBytes;            // bytes sieved by this run
+};
+
+// floor(sqrt(n)) without the rounding error of sqrt() near perfect squares;
+// the corrections compare by division, so n up to LLONG_MAX cannot overflow
+inline long long integerSqrt(long long n)
+{
+    if (n <= 0)
+        return 0;
+    long long r = (long long)sqrtl((long double)n);
+    while (r > n / r)
+        r--;
+    while (r + 1 <= n / (r + 1))
+        r++;
+    return r;
+}
+
+// Odd primes up to `limit` with a plain sieve (small: only sqrt of the table)
+inline void sieveBasePrimes(long long limit, std::vector<int>* primes)
+{
+    primes->clear();
+    if (limit < 3)
+        return;
+    std::vector<char> composite((size_t)limit + 1, 0);
+    for (long long p = 3; p <= limit; p += 2)
+    {
+        if (composite[p])
+            continue;
+        primes->push_back((int)p);
+        for (long long m = p * p; m <= limit; m += 2 * p)
+            composite[m] = 1;
+    }
+}
+
+// Sieve wheel bytes [firstByte, endByte) into segment[0 .. endByte - firstByte)
+inline void sieveWheelSegment(const std::vector<int>& primes, long long firstByte, long long endByte, uint8_t* segment)
+{
+    memset(segment, 0xff, (size_t)(endByte - firstByte));
+    if (firstByte == 0)
+        segment[0] &= (uint8_t)~1u;  // 1 is not prime
+
+    long long lo = firstByte * WHEEL;
+    long long hi = endByte * WHEEL;  // exclusive
+    for (size_t i = 0; i < primes.size(); i++)
+    {
+        long long p = primes[i];
+        if (p < 7)
+            continue;
+        if (p * p >= hi)
+            break;
+        long long qMin = (lo + p - 1) / p;
+        if (qMin < p)
+            qMin = p;
+        for (int w = 0; w < 8; w++)
+        {
+            // smallest q >= qMin with q = residue (mod 30)
+            long long q = qMin + ((WHEEL_RESIDUES[w] - qMin % WHEEL) % WHEEL + WHEEL) % WHEEL;
+            long long m = p * q;
+            uint8_t mask = (uint8_t)~(1u << WHEEL_BIT[m % WHEEL]);
+            for (long long b = m / WHEEL; b < endByte; b += p)
+                segment[b - firstByte] &= mask;
+        }
+    }
+}
+
+// Sieve wheel bytes [firstByte, endByte) into out[0 ..) in parallel, one
+// segment per task; `primes` must reach sqrt(endByte * 30)
+inline void sieveWheelRange(const std::vector<int>& primes, long long firstByte, long long endByte,
+                            int numThreads, uint8_t* out)
+{
+    long long numSegments = (endByte - firstByte + SIEVE_SEGMENT_BYTES - 1) / SIEVE_SEGMENT_BYTES;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+    for (long long s = 0; s < numSegments; s++)
+    {
+        long long segFirst = firstByte + s * SIEVE_SEGMENT_BYTES;
+        long long segEnd = segFirst + SIEVE_SEGMENT_BYTES < endByte ? segFirst + SIEVE_SEGMENT_BYTES : endByte;
+        sieveWheelSegment(primes, segFirst, segEnd, out + (segFirst - firstByte));
+    }
+}
+
+inline size_t primeTableBytesFor(long long limit)
+{
+    return (size_t)(limit / WHEEL + 1);
+}
+
+inline void finishPrimeTable(PrimeTable* table, const uint8_t* bytes, size_t numBytes)
+{
+    table->firstByte = 0;
+    table->bytes = bytes;
+    table->numBytes = numBytes;
+    table->limit = (long long)numBytes * WHEEL - 1;
+}
+
+// Sieve into private memory (no cache file)
+inline void buildPrimeTable(long long limit, int numThreads, PrimeTable* table)
+{
+    size_t numBytes = primeTableBytesFor(limit);
+    std::vector<int> primes;
+    sieveBasePrimes(integerSqrt((long long)numBytes * WHEEL), &primes);
+    table->owned.assign(numBytes, 0);
+    sieveWheelRange(primes, 0, (long long)numBytes, numThreads, table->owned.data());
+    table->mapping = NULL;
+    table->mappingBytes = 0;
+    table->source = PRIME_TABLE_MEMORY;
+    table->sievedBytes = numBytes;
+    finishPrimeTable(table, table->owned.data(), numBytes);
+}
+
+// Bitmap bytes of a valid cache file, 0 if the file is missing, truncated or
+// from another version
+inline size_t readPrimeCacheBytes(int fd)
+{
+    PrimeCacheHeader header;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+        return 0;
+    if (memcmp(header.magic, PRIME_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PRIME_CACHE_VERSION || header.wheel != (uint32_t)WHEEL ||
+        (uint64_t)st.st_size < sizeof(header) + header.numBytes)
+        return 0;
+    return (size_t)header.numBytes;
+}
+
+// Map the cache file at `path` covering at least `limit`, extending or
+// creating it as needed; falls back to private memory if the file cannot be
+// used. The table is mapped read-only once it is complete.
+inline void openPrimeTable(const char* path, long long limit, int numThreads, PrimeTable* table)
+{
+    size_t needed = primeTableBytesFor(limit);
+    int fd = path != NULL ? open(path, O_RDWR | O_CREAT, 0644) : -1;
+    if (fd < 0 && path != NULL)
+        fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (path != NULL)
+            printf("Cannot open prime cache %s, sieving in memory\n", path);
+        buildPrimeTable(limit, numThreads, table);
+        return;
+    }
+
+    size_t existing = readPrimeCacheBytes(fd);
+    size_t numBytes = existing >= needed ? existing : needed;
+    size_t mappingBytes = sizeof(PrimeCacheHeader) + numBytes;
+
+    if (existing < needed)
+    {
+        if (ftruncate(fd, (off_t)mappingBytes) != 0)
+        {
+            printf("Cannot extend prime cache %s, sieving in memory\n", path);
+            close(fd);
+            buildPrimeTable(limit, numThreads, table);
+            return;
+        }
+        void* writable = mmap(NULL, mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (writable == MAP_FAILED)
+        {
+            close(fd);
+            buildPrimeTable(limit, numThreads, table);
+            return;
+        }
+        uint8_t* bitmap = (uint8_t*)writable + sizeof(PrimeCacheHeader);
+        std::vector<int> primes;
+        sieveBasePrimes(integerSqrt((long long)numBytes * WHEEL), &primes);
+        sieveWheelRange(primes, (long long)existing, (long long)numBytes, numThreads, bitmap + existing);
+        msync(writable, mappingBytes, MS_SYNC);
+
+        PrimeCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PRIME_CACHE_MAGIC, sizeof(header.magic));
+        header.version = PRIME_CACHE_VERSION;
+        header.wheel = WHEEL;
+        header.numBytes = numBytes;
+        memcpy(writable, &header, sizeof(header));
+        msync(writable, sizeof(header), MS_SYNC);
+        munmap(writable, mappingBytes);
+
+        table->source = existing > 0 ? PRIME_TABLE_EXTENDED : PRIME_TABLE_BUILT;
+        table->sievedBytes = numBytes - existing;
+    }
+    else
+    {
+        table->source = PRIME_TABLE_MAPPED;
+        table->sievedBytes = 0;
+    }
+
+    void* mapping = mmap(NULL, mappingBytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        buildPrimeTable(limit, numThreads, table);
+        return;
+    }
+    table->owned.clear();
+    table->mapping = mapping;
+    table->mappingBytes = mappingBytes;
+    finishPrimeTable(table, (const uint8_t*)mapping + sizeof(PrimeCacheHeader), numBytes);
+}
+
+// Sieve only the numbers [lo, hi] into private memory, reusing the base
+// primes (which must reach sqrt(hi)) across windows
+inline void buildPrimeWindow(long long lo, long long hi, const std::vector<int>& primes, int numThreads, PrimeTable* table)
+{
+    long long firstByte = lo / WHEEL;
+    long long endByte = hi / WHEEL + 1;
+    table->owned.resize((size_t)(endByte - firstByte));
+    sieveWheelRange(primes, firstByte, endByte, numThreads, table->owned.data());
+    table->mapping = NULL;
+    table->mappingBytes = 0;
+    table->source = PRIME_TABLE_MEMORY;
+    table->sievedBytes = table->owned.size();
+    table->firstByte = firstByte;
+    table->bytes = table->owned.data();
+    table->numBytes = table->owned.size();
+    table->limit = endByte * WHEEL - 1;
+}
+
+inline void closePrimeTable(PrimeTable* table)
+{
+    if (table->mapping != NULL)
+        munmap(table->mapping, table->mappingBytes);
+    table->mapping = NULL;
+    table->owned.clear();
+    table->bytes = NULL;
+    table->numBytes = 0;
+    table->limit = 0;
+    table->firstByte = 0;
+}
+
+inline const char* primeTableSourceName(PrimeTableSource source)
+{
+    switch (source)
+    {
+        case PRIME_TABLE_BUILT: return "built cache";
+        case PRIME_TABLE_EXTENDED: return "extended cache";
+        case PRIME_TABLE_MAPPED: return "mapped cache";
+        default: return "in memory";
+    }
+}
+
+inline bool primeTableCovers(const PrimeTable& table, long long n)
+{
+    return n <= table.limit && n / WHEEL >= table.firstByte;
+}
+
+// Only valid if primeTableCovers(table, n)
+inline bool primeTableTest(const PrimeTable& table, long long n)
+{
+    if (n < 7)
+        return n == 2 || n == 3 || n == 5;
+    int bit = WHEEL_BIT[n % WHEEL];
+    if (bit < 0)
+        return false;
+    return (table.bytes[n / WHEEL - table.firstByte] >> bit) & 1;
+}
+
+inline size_t primeTableBytes(const PrimeTable& table)
+{
+    return table.numBytes;
+}
+
+#endif
@@ -0,0 +1,736 @@
+/*
+ Coroutine render pipeline shared by the image labs:
+ compute -> colorize -> encode -> write.
+ ---------------------------------------------------
+ Needs C++20 coroutines (g++ -std=c++20); the labs include it only then.
+ Images are cut into bands of whole rows. Every stage is a group of
+ coroutines on one PipelineExecutor - the same threads that compute - and
+ the stages are joined by bounded PipelineChannels:
+  - compute   one per pool thread: the lab's values of a band (iterations)
+  - colorize  one per pool thread: values -> RGB
+  - encode    one per pool thread: RGB -> QOI ops or a PNG deflate strip
+              (the independent strips of image_encoder.h); PPM passes through
+  - write     one coroutine: puts the bands of each image back in order and
+              appends them to its file, closing the file after its last band
+ A send into a full channel suspends the sender until the next stage has
+ taken something (backpressure), and the thread runs another coroutine
+ meanwhile. A fixed set of band buffers circulates from write back to
+ compute, so memory stays at PIPELINE_BUFFERS_PER_THREAD bands per thread
+ however many images go through. A buffer is taken before a band is
+ claimed, so the oldest unwritten band always owns one and the reordering
+ in write can never starve compute. Every stage yields before each band, so
+ a long compute phase does not shut the downstream stages out of the pool.
+ runSerializedRender() is the flow the labs had before: compute and colour
+ all images, then encode and write them one after another, with the same
+ callbacks and thread count.
+*/
+#ifndef COMMON_RENDER_PIPELINE_H
+#define COMMON_RENDER_PIPELINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#include "image_encoder.h"
+#include "trace.h"
+
+const int PIPELINE_CHANNEL_PER_THREAD = 2;  // channel capacity per pool thread
+const int PIPELINE_BUFFERS_PER_THREAD = 4;  // band buffers per pool thread
+
+struct PipelineImage
+{
+    char filename[256];
+    char comment[128];
+};
+
+// Values (one int per pixel) of rows [firstRow, endRow) of image `image`
+typedef void (*PipelineCompute)(int image, int firstRow, int endRow, int* values);
+// RGB of the same rows; worker 0 .. numWorkers - 1 computed them
+typedef void (*PipelineColorize)(int image, int firstRow, int endRow, int worker, int numWorkers,
+                                 const int* values, unsigned char* rgb);
+
+enum PipelineStageId
+{
+    STAGE_COMPUTE,
+    STAGE_COLORIZE,
+    STAGE_ENCODE,
+    STAGE_WRITE,
+    NUM_PIPELINE_STAGES
+};
+
+const char* const PIPELINE_STAGE_NAMES[NUM_PIPELINE_STAGES] = { "compute", "colorize", "encode", "write" };
+
+struct PipelineStageStats
+{
+    int workers;
+    std::atomic<long long> bands;
+    std::atomic<int64_t> busy;    // ns doing the stage's work
+    std::atomic<int64_t> input;   // ns from the last band to the next: the yield,
+                                  // an empty input (compute: no free buffer)
+    std::atomic<int64_t> output;  // ns suspended on a full output channel
+};
+
+struct PipelineBand
+{
+    int image;
+    int band;
+    int firstRow;
+    int endRow;
+    int worker;
+    std::vector<int> values;
+    std::vector<unsigned char> rgb;
+    EncodedStrip encoded;
+};
+
+inline int64_t pipelineNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fire-and-forget coroutine: created suspended, started with executor.post()
+// and destroyed when it returns
+struct PipelineTask
+{
+    struct promise_type
+    {
+        PipelineTask get_return_object()
+        {
+            return PipelineTask{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Thread pool resuming coroutines in FIFO order
+class PipelineExecutor
+{
+public:
+    explicit PipelineExecutor(int numThreads) : stopping(false)
+    {
+        for (int t = 0; t < numThreads; t++)
+            threads.push_back(std::thread(&PipelineExecutor::run, this, t));
+    }
+
+    ~PipelineExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    PipelineExecutor(const PipelineExecutor&) = delete;
+    PipelineExecutor& operator=(const PipelineExecutor&) = delete;
+
+    // Queue a suspended coroutine; a pool thread resumes it
+    void post(std::coroutine_handle<> handle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(handle);
+        }
+        wake.notify_one();
+    }
+
+    // co_await executor.yield(): go to the back of the ready queue
+    struct Yield
+    {
+        PipelineExecutor* executor;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { executor->post(handle); }
+        void await_resume() const noexcept {}
+    };
+
+    Yield yield() { return Yield{ this }; }
+    int size() const { return (int)threads.size(); }
+
+private:
+    void run(int index)
+    {
+        traceThreadName("pipeline thread %d", index);
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [this] { return stopping || !ready.empty(); });
+            if (ready.empty())
+                return;
+            std::coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            lock.unlock();
+            handle.resume();
+            lock.lock();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::coroutine_handle<> > ready;
+    bool stopping;
+};
+
+// Bounded multi-producer multi-consumer channel between two stages.
+//   co_await channel.send(v)          suspends while the channel is full
+//   co_await channel.receive(&v)      false once every producer closed it
+//                                     and it is drained
+// Suspended coroutines are handed back to the executor, never resumed inline.
+template <typename T>
+class PipelineChannel
+{
+public:
+    PipelineChannel(PipelineExecutor* executor, size_t capacity, int producers)
+        : executor(executor), capacity(capacity > 0 ? capacity : 1), producers(producers) {}
+
+    PipelineChannel(const PipelineChannel&) = delete;
+    PipelineChannel& operator=(const PipelineChannel&) = delete;
+
+    struct SendAwaiter
+    {
+        PipelineChannel* channel;
+        T value;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) { return channel->parkSender(handle, this); }
+        void await_resume() const noexcept {}
+    };
+
+    struct ReceiveAwaiter
+    {
+        PipelineChannel* channel;
+        T* out;
+        bool received;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) { return channel->parkReceiver(handle, this); }
+        bool await_resume() const noexcept { return received; }
+    };
+
+    SendAwaiter send(T value) { return SendAwaiter{ this, value }; }
+    ReceiveAwaiter receive(T* out) { return ReceiveAwaiter{ this, out, false }; }
+
+    // Send from outside a coroutine; false when the channel is full
+    bool push(T value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!receivers.empty())
+        {
+            *receivers.front().second->out = value;
+            receivers.front().second->received = true;
+            executor->post(receivers.front().first);
+            receivers.pop_front();
+            return true;
+        }
+        if (items.size() >= capacity)
+            return false;
+        items.push_back(value);
+        return true;
+    }
+
+    // One producer is done; the last one wakes the idle receivers
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--producers > 0)
+            return;
+        for (size_t i = 0; i < receivers.size(); i++)
+        {
+            receivers[i].second->received = false;
+            executor->post(receivers[i].first);
+        }
+        receivers.clear();
+    }
+
+private:
+    // await_suspend may not touch the awaiter after another thread could
+    // have resumed its coroutine, hence everything happens under the lock
+    bool parkSender(std::coroutine_handle<> handle, SendAwaiter* sender)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!receivers.empty())
+        {
+            std::pair<std::coroutine_handle<>, ReceiveAwaiter*> receiver = receivers.front();
+            receivers.pop_front();
+            *receiver.second->out = sender->value;
+            receiver.second->received = true;
+            executor->post(receiver.first);
+            return false;
+        }
+        if (items.size() < capacity)
+        {
+            items.push_back(sender->value);
+            return false;
+        }
+        senders.push_back(std::make_pair(handle, sender));
+        return true;
+    }
+
+    bool parkReceiver(std::coroutine_handle<> handle, ReceiveAwaiter* receiver)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!items.empty())
+        {
+            *receiver->out = items.front();
+            items.pop_front();
+            receiver->received = true;
+            if (!senders.empty())
+            {
+                items.push_back(senders.front().second->value);
+                executor->post(senders.front().first);
+                senders.pop_front();
+            }
+            return false;
+        }
+        if (producers <= 0)
+        {
+            receiver->received = false;
+            return false;
+        }
+        receivers.push_back(std::make_pair(handle, receiver));
+        return true;
+    }
+
+    PipelineExecutor* executor;
+    size_t capacity;
+    int producers;
+    std::mutex mutex;
+    std::deque<T> items;
+    std::deque<std::pair<std::coroutine_handle<>, SendAwaiter*> > senders;
+    std::deque<std::pair<std::coroutine_handle<>, ReceiveAwaiter*> > receivers;
+};
+
+// Output file of one image, filled band by band in order
+struct PipelineOutput
+{
+    FILE* fp;
+    bool ok;
+    int nextBand;
+    std::vector<PipelineBand*> pending;  // arrived ahead of nextBand
+    unsigned long adler;                 // PNG: Adler-32 of the filtered rows so far
+    double seconds;                      // written this long after the start
+};
+
+class RenderPipeline
+{
+public:
+    RenderPipeline(const std::vector<PipelineImage>& images, int width, int height, int bandRows,
+                   ImageFormat format, int numThreads, PipelineCompute compute, PipelineColorize colorize)
+        : images(images), width(width), height(height), bandRows(bandRows), format(format),
+          compute(compute), colorize(colorize),
+          freeBands(&executor, (size_t)numThreads * PIPELINE_BUFFERS_PER_THREAD, 1),
+          computed(&executor, (size_t)numThreads * PIPELINE_CHANNEL_PER_THREAD, numThreads),
+          colored(&executor, (size_t)numThreads * PIPELINE_CHANNEL_PER_THREAD, numThreads),
+          encoded(&executor, (size_t)numThreads * PIPELINE_CHANNEL_PER_THREAD, numThreads),
+          nextJob(0), running(0), executor(numThreads)
+    {
+        bandsPerImage = (height + bandRows - 1) / bandRows;
+        totalJobs = (long long)bandsPerImage * images.size();
+        int stageWorkers[NUM_PIPELINE_STAGES] = { numThreads, numThreads, numThreads, 1 };
+        for (int s = 0; s < NUM_PIPELINE_STAGES; s++)
+        {
+            stages[s].workers = stageWorkers[s];
+            stages[s].bands = 0;
+            stages[s].busy = 0;
+            stages[s].input = 0;
+            stages[s].output = 0;
+        }
+        outputs.resize(images.size());
+        for (size_t i = 0; i < outputs.size(); i++)
+        {
+            outputs[i].fp = NULL;
+            outputs[i].ok = true;
+            outputs[i].nextBand = 0;
+            outputs[i].pending.assign(bandsPerImage, NULL);
+            outputs[i].adler = adler32(0L, Z_NULL, 0);
+            outputs[i].seconds = 0.0;
+        }
+        buffers.resize((size_t)numThreads * PIPELINE_BUFFERS_PER_THREAD);
+    }
+
+    RenderPipeline(const RenderPipeline&) = delete;
+    RenderPipeline& operator=(const RenderPipeline&) = delete;
+
+    // Render and write every image; returns the wall time in seconds
+    double run(bool* ok);
+
+    const std::vector<PipelineImage>& images;
+    int width;
+    int height;
+    int bandRows;
+    int bandsPerImage;
+    long long totalJobs;
+    ImageFormat format;
+    PipelineCompute compute;
+    PipelineColorize colorize;
+
+    PipelineChannel<PipelineBand*> freeBands;
+    PipelineChannel<PipelineBand*> computed;
+    PipelineChannel<PipelineBand*> colored;
+    PipelineChannel<PipelineBand*> encoded;
+
+    std::vector<PipelineBand> buffers;
+    std::vector<PipelineOutput> outputs;
+    PipelineStageStats stages[NUM_PIPELINE_STAGES];
+    std::atomic<long long> nextJob;
+    int64_t startTime;
+
+    std::mutex doneMutex;
+    std::condition_variable doneWake;
+    int running;  // stage coroutines not finished yet
+
+    // declared last: destroyed first, so its threads are joined while the
+    // channels and buffers still exist
+    PipelineExecutor executor;
+
+    void stageFinished()
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        if (--running == 0)
+            doneWake.notify_all();
+    }
+};
+
+inline PipelineTask pipelineCompute(RenderPipeline* p, int worker)
+{
+    PipelineStageStats& stats = p->stages[STAGE_COMPUTE];
+    PipelineBand* band;
+    for (;;)
+    {
+        int64_t start = pipelineNow();
+        co_await p->executor.yield();
+        co_await p->freeBands.receive(&band);  // never closed
+        stats.input += pipelineNow() - start;
+
+        long long job = p->nextJob++;
+        if (job >= p->totalJobs)
+        {
+            co_await p->freeBands.send(band);  // room for every buffer, never waits
+            break;
+        }
+
+        start = pipelineNow();
+        band->image = (int)(job / p->bandsPerImage);
+        band->band = (int)(job % p->bandsPerImage);
+        band->firstRow = band->band * p->bandRows;
+        band->endRow = band->firstRow + p->bandRows < p->height ? band->firstRow + p->bandRows : p->height;
+        band->worker = worker;
+        {
+            TraceScope span("compute", band->firstRow, band->endRow);
+            p->compute(band->image, band->firstRow, band->endRow, band->values.data());
+        }
+        stats.busy += pipelineNow() - start;
+        stats.bands++;
+
+        start = pipelineNow();
+        co_await p->computed.send(band);
+        stats.output += pipelineNow() - start;
+    }
+    p->computed.close();
+    p->stageFinished();
+}
+
+// Colorize or encode: take a band from `input`, work on it, pass it on
+inline PipelineTask pipelineTransform(RenderPipeline* p, PipelineStageId stage,
+                                      PipelineChannel<PipelineBand*>* input, PipelineChannel<PipelineBand*>* output)
+{
+    PipelineStageStats& stats = p->stages[stage];
+    PipelineBand* band;
+    for (;;)
+    {
+        int64_t start = pipelineNow();
+        co_await p->executor.yield();
+        bool received = co_await input->receive(&band);
+        stats.input += pipelineNow() - start;
+        if (!received)
+            break;
+
+        start = pipelineNow();
+        {
+            TraceScope span(PIPELINE_STAGE_NAMES[stage], band->firstRow, band->endRow);
+            int rows = band->endRow - band->firstRow;
+            if (stage == STAGE_COLORIZE)
+            {
+                p->colorize(band->image, band->firstRow, band->endRow, band->worker, p->stages[STAGE_COMPUTE].workers,
+                            band->values.data(), band->rgb.data());
+            }
+            else if (p->format == FORMAT_QOI)
+            {
+                band->encoded.bytes.clear();
+                encodeQOIStrip(band->rgb.data(), p->width, 0, rows, &band->encoded);
+            }
+            else if (p->format == FORMAT_PNG)
+            {
+                encodePNGStrip(band->rgb.data(), p->width, 0, rows, band->band == p->bandsPerImage - 1, &band->encoded);
+            }
+        }
+        stats.busy += pipelineNow() - start;
+        stats.bands++;
+
+        start = pipelineNow();
+        co_await output->send(band);
+        stats.output += pipelineNow() - start;
+    }
+    output->close();
+    p->stageFinished();
+}
+
+inline bool pipelineWriteBytes(PipelineOutput* out, const unsigned char* data, size_t bytes)
+{
+    out->ok = out->ok && fwrite(data, 1, bytes, out->fp) == bytes;
+    return out->ok;
+}
+
+// Append the next band of its image; the first band creates the file, the
+// last one finishes and closes it
+inline void pipelineWriteBand(RenderPipeline* p, const PipelineBand* band)
+{
+    PipelineOutput* out = &p->outputs[band->image];
+    const PipelineImage& image = p->images[band->image];
+    std::vector<unsigned char> chunk;
+
+    if (band->band == 0)
+    {
+        out->fp = fopen(image.filename, "wb");
+        if (out->fp == NULL)
+        {
+            out->ok = false;
+        }
+        else if (p->format == FORMAT_PPM)
+        {
+            writePPMHeader(out->fp, image.comment, p->width, p->height);
+        }
+        else if (p->format == FORMAT_QOI)
+        {
+            chunk.insert(chunk.end(), {'q', 'o', 'i', 'f'});
+            putBE32(chunk, p->width);
+            putBE32(chunk, p->height);
+            chunk.push_back(3);  /* channels */
+            chunk.push_back(0);  /* colorspace: sRGB */
+            pipelineWriteBytes(out, chunk.data(), chunk.size());
+        }
+        else
+        {
+            // the zlib header goes in an IDAT of its own, every band follows in its own IDAT
+            static const unsigned char zlibHeader[2] = { 0x78, 0x01 };
+            appendPNGHeader(chunk, p->width, p->height);
+            appendPNGChunk(chunk, "IDAT", zlibHeader, 2);
+            pipelineWriteBytes(out, chunk.data(), chunk.size());
+        }
+    }
+    if (out->fp == NULL)
+        return;
+
+    if (p->format == FORMAT_PPM)
+    {
+        pipelineWriteBytes(out, band->rgb.data(), (size_t)(band->endRow - band->firstRow) * p->width * 3);
+    }
+    else if (p->format == FORMAT_QOI)
+    {
+        pipelineWriteBytes(out, band->encoded.bytes.data(), band->encoded.bytes.size());
+    }
+    else
+    {
+        chunk.clear();
+        appendPNGChunk(chunk, "IDAT", band->encoded.bytes.data(), band->encoded.bytes.size());
+        pipelineWriteBytes(out, chunk.data(), chunk.size());
+        out->adler = adler32_combine(out->adler, band->encoded.adler, (z_off_t)band->encoded.rawBytes);
+    }
+
+    if (band->band < p->bandsPerImage - 1)
+        return;
+
+    chunk.clear();
+    if (p->format == FORMAT_QOI)
+    {
+        chunk.insert(chunk.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+    }
+    else if (p->format == FORMAT_PNG)
+    {
+        std::vector<unsigned char> adler;
+        putBE32(adler, out->adler);
+        appendPNGChunk(chunk, "IDAT", adler.data(), adler.size());
+        appendPNGChunk(chunk, "IEND", NULL, 0);
+    }
+    pipelineWriteBytes(out, chunk.data(), chunk.size());
+    if (fclose(out->fp) != 0)
+        out->ok = false;
+    out->fp = NULL;
+    out->seconds = (pipelineNow() - p->startTime) / 1e9;
+}
+
+inline PipelineTask pipelineWrite(RenderPipeline* p)
+{
+    PipelineStageStats& stats = p->stages[STAGE_WRITE];
+    PipelineBand* band;
+    for (;;)
+    {
+        int64_t start = pipelineNow();
+        co_await p->executor.yield();
+        bool received = co_await p->encoded.receive(&band);
+        stats.input += pipelineNow() - start;
+        if (!received)
+            break;
+
+        start = pipelineNow();
+        PipelineOutput& out = p->outputs[band->image];
+        out.pending[band->band] = band;
+        while (out.nextBand < p->bandsPerImage && out.pending[out.nextBand] != NULL)
+        {
+            PipelineBand* next = out.pending[out.nextBand];
+            out.pending[out.nextBand] = NULL;
+            {
+                TraceScope span("write", next->firstRow, next->endRow);
+                pipelineWriteBand(p, next);
+            }
+            out.nextBand++;
+            stats.bands++;
+            co_await p->freeBands.send(next);  // room for every buffer, never waits
+        }
+        stats.busy += pipelineNow() - start;
+    }
+    p->stageFinished();
+}
+
+inline double RenderPipeline::run(bool* ok)
+{
+    size_t bandPixels = (size_t)bandRows * width;
+    running = 3 * executor.size() + 1;
+    startTime = pipelineNow();
+    int64_t regionStart = traceNow();
+
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        buffers[i].values.resize(bandPixels);
+        buffers[i].rgb.resize(bandPixels * 3);
+        freeBands.push(&buffers[i]);
+    }
+
+    std::vector<PipelineTask> tasks;
+    for (int t = 0; t < executor.size(); t++)
+    {
+        tasks.push_back(pipelineCompute(this, t));
+        tasks.push_back(pipelineTransform(this, STAGE_COLORIZE, &computed, &colored));
+        tasks.push_back(pipelineTransform(this, STAGE_ENCODE, &colored, &encoded));
+    }
+    tasks.push_back(pipelineWrite(this));
+    for (size_t i = 0; i < tasks.size(); i++)
+        executor.post(tasks[i].handle);
+
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneWake.wait(lock, [this] { return running == 0; });
+    }
+    double seconds = (pipelineNow() - startTime) / 1e9;
+    traceRegion("pipeline", regionStart);
+
+    *ok = true;
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        if (!outputs[i].ok)
+        {
+            printf("Failed to write %s\n", images[i].filename);
+            *ok = false;
+        }
+    }
+    return seconds;
+}
+
+// The serialized flow: every image computed and coloured band by band on
+// numThreads threads and kept in memory, then encoded and written in turn
+inline double runSerializedRender(const std::vector<PipelineImage>& images, int width, int height, int bandRows,
+                                  ImageFormat format, int numThreads, PipelineCompute compute,
+                                  PipelineColorize colorize, double* computeSeconds)
+{
+    int64_t start = pipelineNow();
+    int bandsPerImage = (height + bandRows - 1) / bandRows;
+    std::vector<std::vector<unsigned char> > rgb(images.size());
+
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        rgb[i].resize((size_t)width * height * 3);
+        std::atomic<int> nextBand(0);
+        auto worker = [&](int t)
+        {
+            std::vector<int> values((size_t)bandRows * width);
+            for (int b = nextBand++; b < bandsPerImage; b = nextBand++)
+            {
+                int firstRow = b * bandRows;
+                int endRow = firstRow + bandRows < height ? firstRow + bandRows : height;
+                compute((int)i, firstRow, endRow, values.data());
+                colorize((int)i, firstRow, endRow, t, numThreads, values.data(),
+                         rgb[i].data() + (size_t)firstRow * width * 3);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; t++)
+            threads.push_back(std::thread(worker, t));
+        for (auto& thread : threads)
+            thread.join();
+    }
+    *computeSeconds = (pipelineNow() - start) / 1e9;
+
+    for (size_t i = 0; i < images.size(); i++)
+        writeImage(images[i].filename, images[i].comment, rgb[i].data(), width, height, format, numThreads, NULL);
+    return (pipelineNow() - start) / 1e9;
+}
+
+// Serialized flow first, then the pipeline (whose files are the ones kept);
+// prints per-stage utilization and both wall times
+inline bool runPipelineComparison(const std::vector<PipelineImage>& images, int width, int height, int bandRows,
+                                  ImageFormat format, int numThreads, PipelineCompute compute,
+                                  PipelineColorize colorize)
+{
+    int bandsPerImage = (height + bandRows - 1) / bandRows;
+    printf("\n=== Render pipeline: %zu image(s) %d x %d, %d bands of %d rows, %d pool threads, %s ===\n",
+           images.size(), width, height, bandsPerImage, bandRows, numThreads, imageFormatExtension(format));
+
+    double serialCompute;
+    double serialSeconds = runSerializedRender(images, width, height, bandRows, format, numThreads, compute,
+                                               colorize, &serialCompute);
+    printf("Serialized: %.3f s (compute and colour %.3f s, then encode and write %.3f s)\n",
+           serialSeconds, serialCompute, serialSeconds - serialCompute);
+
+    RenderPipeline pipeline(images, width, height, bandRows, format, numThreads, compute, colorize);
+    bool ok;
+    double seconds = pipeline.run(&ok);
+    printf("Pipeline:   %.3f s, %zu band buffers of %.1f MB\n", seconds, pipeline.buffers.size(),
+           (double)bandRows * width * (sizeof(int) + 3) / (1024.0 * 1024.0));
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        if (pipeline.outputs[i].ok)
+            printf("  %s written after %.3f s\n", images[i].filename, pipeline.outputs[i].seconds);
+    }
+
+    printf("\nStage    | Workers | Bands | Busy (s) | Utilization | Pool share | Input wait (s) | Output wait (s)\n");
+    printf("---------------------------------------------------------------------------------------------\n");
+    for (int s = 0; s < NUM_PIPELINE_STAGES; s++)
+    {
+        const PipelineStageStats& stage = pipeline.stages[s];
+        double busy = stage.busy / 1e9;
+        printf("%-8s | %7d | %5lld | %8.3f | %10.1f%% | %9.1f%% | %14.3f | %15.3f\n",
+               PIPELINE_STAGE_NAMES[s], stage.workers, stage.bands.load(), busy,
+               100.0 * busy / (seconds * stage.workers), 100.0 * busy / (seconds * numThreads),
+               stage.input / 1e9, stage.output / 1e9);
+    }
+    printf("Utilization = busy / (wall * workers), pool share = busy / (wall * pool threads);\n");
+    printf("waits are summed over the stage's coroutines and include time queued for a pool thread\n");
+    printf("\nWall time: serialized %.3f s, pipeline %.3f s (%.2fx)\n", serialSeconds, seconds, serialSeconds / seconds);
+    return ok;
+}
+
+#endif
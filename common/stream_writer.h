@@ -0,0 +1,191 @@
+/*
+ Streaming PPM output shared by the Mandelbrot labs.
+ ------------------------------------------------
+ Render workers fill fixed-size row blocks inside a bounded ring of slots and
+ a single writer thread appends the blocks to the file strictly in order.
+ Each slot carries two atomic block indices, so neither side takes a lock:
+   slotOwner - index of the block that may be rendered into the slot next
+   slotReady - index of the block whose pixels are complete in the slot (-1 = none)
+ Peak memory is numSlots * blockBytes no matter how large the image is.
+ A writer destroyed without finish() (an early return) cancels its thread,
+ which stops at the next missing block and leaves a truncated file.
+*/
+#ifndef COMMON_STREAM_WRITER_H
+#define COMMON_STREAM_WRITER_H
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "image_encoder.h"
+
+class StreamRing
+{
+public:
+    StreamRing(int numSlots, size_t blockBytes)
+        : numSlots(numSlots), blockBytes(blockBytes)
+    {
+        storage = new unsigned char[(size_t)numSlots * blockBytes];
+        slotOwner = new std::atomic<int>[numSlots];
+        slotReady = new std::atomic<int>[numSlots];
+        for (int s = 0; s < numSlots; s++)
+        {
+            slotOwner[s].store(s, std::memory_order_relaxed);
+            slotReady[s].store(-1, std::memory_order_relaxed);
+        }
+    }
+
+    ~StreamRing()
+    {
+        delete[] storage;
+        delete[] slotOwner;
+        delete[] slotReady;
+    }
+
+    StreamRing(const StreamRing&) = delete;
+    StreamRing& operator=(const StreamRing&) = delete;
+
+    // Producer side: wait until the writer has drained the slot for this block
+    unsigned char* acquire(int block)
+    {
+        int s = block % numSlots;
+        while (slotOwner[s].load(std::memory_order_acquire) != block)
+        {
+            std::this_thread::yield();
+        }
+        return storage + (size_t)s * blockBytes;
+    }
+
+    // Producer side: hand a fully rendered block over to the writer
+    void publish(int block)
+    {
+        slotReady[block % numSlots].store(block, std::memory_order_release);
+    }
+
+    // Consumer side: wait for the next block in file order; NULL once cancel is set
+    const unsigned char* waitReady(int block, const std::atomic<bool>* cancel = NULL)
+    {
+        int s = block % numSlots;
+        while (slotReady[s].load(std::memory_order_acquire) != block)
+        {
+            if (cancel != NULL && cancel->load(std::memory_order_relaxed))
+            {
+                return NULL;
+            }
+            std::this_thread::yield();
+        }
+        return storage + (size_t)s * blockBytes;
+    }
+
+    // Consumer side: the block is on disk, the slot can take block + numSlots
+    void release(int block)
+    {
+        int s = block % numSlots;
+        slotReady[s].store(-1, std::memory_order_relaxed);
+        slotOwner[s].store(block + numSlots, std::memory_order_release);
+    }
+
+    size_t footprint() const { return (size_t)numSlots * blockBytes; }
+
+private:
+    int numSlots;
+    size_t blockBytes;
+    unsigned char* storage;
+    std::atomic<int>* slotOwner;
+    std::atomic<int>* slotReady;
+};
+
+// Writer thread that drains a StreamRing into a P6 file in block order
+class StreamWriter
+{
+public:
+    StreamWriter(const char* filename, const char* comment, int width, int height,
+                 int blockRows, int numSlots)
+        : ring(numSlots, (size_t)blockRows * width * 3),
+          width(width), height(height), blockRows(blockRows)
+    {
+        numBlocks = (height + blockRows - 1) / blockRows;
+        fp = fopen(filename, "wb");
+        if (fp == NULL)
+        {
+            printf("Failed to write %s\n", filename);
+        }
+        else
+        {
+            writePPMHeader(fp, comment, width, height);
+        }
+        writer = std::thread(&StreamWriter::drain, this);
+    }
+
+    // Without finish(), stop the writer instead of leaving it joinable
+    ~StreamWriter()
+    {
+        if (writer.joinable())
+        {
+            cancelled.store(true);
+            writer.join();
+        }
+    }
+
+    StreamWriter(const StreamWriter&) = delete;
+    StreamWriter& operator=(const StreamWriter&) = delete;
+
+    int blockCount() const { return numBlocks; }
+    int firstRow(int block) const { return block * blockRows; }
+    int lastRow(int block) const
+    {
+        int end = (block + 1) * blockRows;
+        return end < height ? end : height;
+    }
+
+    unsigned char* acquire(int block) { return ring.acquire(block); }
+    void publish(int block) { ring.publish(block); }
+    size_t footprint() const { return ring.footprint(); }
+
+    // Wait for the writer to flush the last block and close the file
+    bool finish()
+    {
+        if (writer.joinable())
+        {
+            writer.join();
+        }
+        return ok;
+    }
+
+private:
+    void drain()
+    {
+        for (int b = 0; b < numBlocks; b++)
+        {
+            const unsigned char* data = ring.waitReady(b, &cancelled);
+            if (data == NULL)
+            {
+                ok = false;
+                break;
+            }
+            size_t bytes = (size_t)(lastRow(b) - firstRow(b)) * width * 3;
+            if (fp != NULL && fwrite(data, 1, bytes, fp) != bytes)
+            {
+                ok = false;
+            }
+            ring.release(b);
+        }
+        if (fp == NULL || fclose(fp) != 0)
+        {
+            ok = false;
+        }
+        fp = NULL;
+    }
+
+    StreamRing ring;
+    int width;
+    int height;
+    int blockRows;
+    int numBlocks;
+    FILE* fp;
+    bool ok = true;
+    std::atomic<bool> cancelled{false};
+    std::thread writer;
+};
+
+#endif
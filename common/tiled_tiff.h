@@ -0,0 +1,211 @@
+/*
+ Uncompressed tiled BigTIFF writer for images larger than memory.
+ ----------------------------------------------------------------
+ Every tile is stored full size (edge tiles are padded, as TIFF requires) and
+ uncompressed, so tile (tx, ty) always lives at
+   dataOffset + (ty * tilesAcross + tx) * tileBytes
+ and render threads can pwrite() finished tiles in any order without a
+ writer thread or an index to patch. The header, the single IFD and the
+ TileOffsets/TileByteCounts arrays are written up front; the arrays are
+ generated in chunks so even a 1e6 x 1e6 image needs no large buffer.
+ BigTIFF (64-bit offsets) is used because such files pass 4 GB quickly.
+*/
+#ifndef COMMON_TILED_TIFF_H
+#define COMMON_TILED_TIFF_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+enum TiffType
+{
+    TIFF_ASCII = 2,
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4,
+    TIFF_LONG8 = 16
+};
+
+const int TIFF_INDEX_CHUNK = 65536;  // offsets generated per write
+
+class TiledTiffWriter
+{
+public:
+    TiledTiffWriter() : fd(-1) {}
+
+    ~TiledTiffWriter()
+    {
+        close();
+    }
+
+    TiledTiffWriter(const TiledTiffWriter&) = delete;
+    TiledTiffWriter& operator=(const TiledTiffWriter&) = delete;
+
+    // Create the file and write everything but the tile pixels
+    bool open(const char* filename, const char* description, int width, int height, int tile)
+    {
+        this->width = width;
+        this->height = height;
+        this->tile = tile;
+        tilesAcross = (width + tile - 1) / tile;
+        tilesDown = (height + tile - 1) / tile;
+        tileBytes = (uint64_t)tile * tile * 3;
+        ok = true;
+
+        fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            printf("Failed to write %s\n", filename);
+            return false;
+        }
+
+        uint64_t numTiles = (uint64_t)tilesAcross * tilesDown;
+        const int numEntries = 12;
+        uint64_t ifdOffset = 16;
+        uint64_t descriptionOffset = ifdOffset + 8 + numEntries * 20 + 8;
+        uint64_t descriptionBytes = strlen(description) + 1;
+        uint64_t offsetsOffset = (descriptionOffset + descriptionBytes + 7) & ~(uint64_t)7;
+        uint64_t countsOffset = offsetsOffset + numTiles * 8;
+        dataOffset = (countsOffset + numTiles * 8 + 4095) & ~(uint64_t)4095;
+
+        std::vector<unsigned char> head;
+        put16(head, 0x4949);  // "II", little endian
+        put16(head, 43);      // BigTIFF
+        put16(head, 8);       // offset size
+        put16(head, 0);
+        put64(head, ifdOffset);
+
+        put64(head, numEntries);
+        unsigned char bitsPerSample[8] = { 8, 0, 8, 0, 8, 0, 0, 0 };
+        entry(head, 256, TIFF_LONG, 1, (uint64_t)width);           // ImageWidth
+        entry(head, 257, TIFF_LONG, 1, (uint64_t)height);          // ImageLength
+        entryBytes(head, 258, TIFF_SHORT, 3, bitsPerSample);       // BitsPerSample
+        entry(head, 259, TIFF_SHORT, 1, 1);                        // Compression: none
+        entry(head, 262, TIFF_SHORT, 1, 2);                        // Photometric: RGB
+        entry(head, 270, TIFF_ASCII, descriptionBytes, descriptionOffset);  // ImageDescription
+        entry(head, 277, TIFF_SHORT, 1, 3);                        // SamplesPerPixel
+        entry(head, 284, TIFF_SHORT, 1, 1);                        // PlanarConfiguration: chunky
+        entry(head, 322, TIFF_LONG, 1, (uint64_t)tile);            // TileWidth
+        entry(head, 323, TIFF_LONG, 1, (uint64_t)tile);            // TileLength
+        entry(head, 324, TIFF_LONG8, numTiles, offsetsOffset);     // TileOffsets
+        entry(head, 325, TIFF_LONG8, numTiles, countsOffset);      // TileByteCounts
+        put64(head, 0);  // no next IFD
+        head.insert(head.end(), description, description + descriptionBytes);
+        writeAt(head.data(), head.size(), 0);
+
+        std::vector<uint64_t> chunk;
+        for (uint64_t first = 0; first < numTiles; first += TIFF_INDEX_CHUNK)
+        {
+            uint64_t count = numTiles - first < (uint64_t)TIFF_INDEX_CHUNK ? numTiles - first : TIFF_INDEX_CHUNK;
+            chunk.resize(count);
+            for (uint64_t i = 0; i < count; i++)
+                chunk[i] = dataOffset + (first + i) * tileBytes;
+            writeAt(chunk.data(), count * 8, offsetsOffset + first * 8);
+            for (uint64_t i = 0; i < count; i++)
+                chunk[i] = tileBytes;
+            writeAt(chunk.data(), count * 8, countsOffset + first * 8);
+        }
+
+        // Size the file now so unwritten tiles read back as black
+        if (ftruncate(fd, (off_t)(dataOffset + numTiles * tileBytes)) != 0)
+            ok = false;
+        return ok;
+    }
+
+    // Store one full tile (tile * tile RGB pixels); safe from several threads
+    void writeTile(long long tx, long long ty, const unsigned char* rgb)
+    {
+        writeAt(rgb, tileBytes, dataOffset + ((uint64_t)ty * tilesAcross + tx) * tileBytes);
+    }
+
+    bool close()
+    {
+        if (fd >= 0 && ::close(fd) != 0)
+            ok = false;
+        fd = -1;
+        return ok;
+    }
+
+    long long tilesX() const { return tilesAcross; }
+    long long tilesY() const { return tilesDown; }
+    uint64_t fileBytes() const { return dataOffset + (uint64_t)tilesAcross * tilesDown * tileBytes; }
+
+private:
+    static void put16(std::vector<unsigned char>& out, uint64_t v)
+    {
+        for (int i = 0; i < 2; i++)
+            out.push_back((unsigned char)(v >> (8 * i)));
+    }
+
+    static void put64(std::vector<unsigned char>& out, uint64_t v)
+    {
+        for (int i = 0; i < 8; i++)
+            out.push_back((unsigned char)(v >> (8 * i)));
+    }
+
+    // IFD entry whose value (or offset) fits the 8-byte field
+    static void entry(std::vector<unsigned char>& out, int tag, TiffType type, uint64_t count, uint64_t value)
+    {
+        put16(out, (uint64_t)tag);
+        put16(out, (uint64_t)type);
+        put64(out, count);
+        if (type == TIFF_SHORT && count == 1)
+        {
+            put16(out, value);
+            put16(out, 0);
+            put16(out, 0);
+            put16(out, 0);
+        }
+        else if (type == TIFF_LONG && count == 1)
+        {
+            put16(out, value & 0xffff);
+            put16(out, value >> 16);
+            put16(out, 0);
+            put16(out, 0);
+        }
+        else
+        {
+            put64(out, value);
+        }
+    }
+
+    static void entryBytes(std::vector<unsigned char>& out, int tag, TiffType type, uint64_t count, const unsigned char* value)
+    {
+        put16(out, (uint64_t)tag);
+        put16(out, (uint64_t)type);
+        put64(out, count);
+        out.insert(out.end(), value, value + 8);
+    }
+
+    void writeAt(const void* data, uint64_t bytes, uint64_t offset)
+    {
+        const char* p = (const char*)data;
+        while (bytes > 0)
+        {
+            ssize_t written = pwrite(fd, p, bytes, (off_t)offset);
+            if (written <= 0)
+            {
+                ok = false;
+                return;
+            }
+            p += written;
+            bytes -= (uint64_t)written;
+            offset += (uint64_t)written;
+        }
+    }
+
+    int fd;
+    int width;
+    int height;
+    int tile;
+    long long tilesAcross;
+    long long tilesDown;
+    uint64_t tileBytes;
+    uint64_t dataOffset;
+    std::atomic<bool> ok;
+};
+
+#endif
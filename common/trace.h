@@ -0,0 +1,355 @@
+/*
+ Per-thread timeline tracing, exported as Chrome / Perfetto trace JSON.
+ ----------------------------------------------------------------------
+ Every OS thread that records a span gets its own ring buffer on first use
+ (std::thread workers, OpenMP team members and threads of nested regions
+ alike), so recording takes no lock and touches no shared cache line: two
+ clock reads and a store into the thread's own buffer. When a buffer is full
+ the oldest spans are overwritten and counted as dropped. A thread hands its
+ buffer back when it exits and the next new thread takes it over, so sweeps
+ that start fresh std::threads every round keep reusing the same tracks
+ instead of running into TRACE_MAX_THREADS; a track then holds the spans of
+ the threads that used it one after another.
+  - TraceScope / traceSpan  a named span with a [first, last) row or tile
+                            range, e.g. one row of a schedule(runtime) loop
+  - traceRegion             a timed parallel region, recorded by the thread
+                            that starts and joins it
+ traceWrite() runs after the timed regions. Besides the spans it emits, for
+ every region and every thread that worked in it, a "barrier wait" span from
+ the thread's last span to the end of the region, and prints per region the
+ busy time of the least and most loaded thread. Spans that nest (a leaf
+ inside a task inside a region) show up stacked on the thread's track.
+ With tracing disabled a span costs one relaxed load and a branch.
+*/
+#ifndef COMMON_TRACE_H
+#define COMMON_TRACE_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+const int TRACE_MAX_THREADS = 1024;
+const size_t TRACE_CAPACITY = 1 << 16;   // spans kept per thread
+const size_t TRACE_INITIAL = 1024;       // spans reserved on first use
+
+struct TraceEvent
+{
+    int64_t start;      // ns since traceEnable()
+    int64_t end;
+    const char* name;   // must outlive the trace (string literals)
+    long long first;    // row or tile range [first, last)
+    long long last;
+};
+
+struct TraceBuffer
+{
+    int tid;
+    char name[64];
+    std::vector<TraceEvent> events;
+    uint64_t recorded;  // spans ever recorded; beyond TRACE_CAPACITY the oldest are gone
+    bool released;      // its thread has exited, a new one may take it over
+};
+
+struct TraceRegion
+{
+    std::string name;
+    int tid;
+    int64_t start;
+    int64_t end;
+};
+
+struct TraceState
+{
+    std::atomic<bool> enabled;
+    std::chrono::steady_clock::time_point origin;
+    std::atomic<int> numThreads;
+    std::atomic<TraceBuffer*> threads[TRACE_MAX_THREADS];
+    std::mutex bufferMutex;  // taking and releasing buffers, once per thread
+    std::mutex regionMutex;  // regions are rare, spans never take it
+    std::vector<TraceRegion> regions;
+
+    TraceState() : enabled(false), numThreads(0)
+    {
+        for (int i = 0; i < TRACE_MAX_THREADS; i++)
+            threads[i] = NULL;
+    }
+};
+
+inline TraceState& traceState()
+{
+    static TraceState state;
+    return state;
+}
+
+inline bool traceEnabled()
+{
+    return traceState().enabled.load(std::memory_order_relaxed);
+}
+
+inline void traceEnable()
+{
+    TraceState& state = traceState();
+    state.origin = std::chrono::steady_clock::now();
+    state.enabled = true;
+}
+
+inline int64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceState().origin).count();
+}
+
+// Owner of a thread's buffer; releases it when the thread exits
+struct TraceBufferOwner
+{
+    TraceBuffer* buffer = NULL;
+
+    ~TraceBufferOwner()
+    {
+        if (buffer == NULL)
+            return;
+        std::lock_guard<std::mutex> lock(traceState().bufferMutex);
+        buffer->released = true;
+    }
+};
+
+// The calling thread's buffer: on first use one released by an exited
+// thread, else a new one; NULL once TRACE_MAX_THREADS live threads trace
+inline TraceBuffer* traceBuffer()
+{
+    static thread_local TraceBufferOwner owner;
+    if (owner.buffer == NULL)
+    {
+        TraceState& state = traceState();
+        std::lock_guard<std::mutex> lock(state.bufferMutex);
+        int numThreads = state.numThreads.load();
+        for (int t = 0; t < numThreads && owner.buffer == NULL; t++)
+        {
+            TraceBuffer* buffer = state.threads[t];
+            if (buffer->released)
+            {
+                buffer->released = false;
+                snprintf(buffer->name, sizeof(buffer->name), "thread %d", buffer->tid);
+                owner.buffer = buffer;
+            }
+        }
+        if (owner.buffer == NULL)
+        {
+            if (numThreads >= TRACE_MAX_THREADS)
+                return NULL;
+            TraceBuffer* buffer = new TraceBuffer();
+            buffer->tid = numThreads;
+            snprintf(buffer->name, sizeof(buffer->name), "thread %d", numThreads);
+            buffer->events.reserve(TRACE_INITIAL);
+            buffer->recorded = 0;
+            buffer->released = false;
+            state.threads[numThreads] = buffer;
+            state.numThreads.store(numThreads + 1);
+            owner.buffer = buffer;
+        }
+    }
+    return owner.buffer;
+}
+
+// Label the calling thread's track (printf style)
+inline void traceThreadName(const char* format, ...)
+{
+    if (!traceEnabled())
+        return;
+    TraceBuffer* buffer = traceBuffer();
+    if (buffer == NULL)
+        return;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer->name, sizeof(buffer->name), format, args);
+    va_end(args);
+}
+
+// Record a span that started at `start` (from traceNow()) and ends now
+inline void traceSpan(const char* name, int64_t start, long long first, long long last)
+{
+    if (!traceEnabled())
+        return;
+    TraceBuffer* buffer = traceBuffer();
+    if (buffer == NULL)
+        return;
+    TraceEvent event = { start, traceNow(), name, first, last };
+    if (buffer->events.size() < TRACE_CAPACITY)
+        buffer->events.push_back(event);
+    else
+        buffer->events[buffer->recorded % TRACE_CAPACITY] = event;
+    buffer->recorded++;
+}
+
+// Record a parallel region that started at `start` and ends now
+inline void traceRegion(const char* name, int64_t start)
+{
+    if (!traceEnabled())
+        return;
+    TraceBuffer* buffer = traceBuffer();
+    TraceState& state = traceState();
+    std::lock_guard<std::mutex> lock(state.regionMutex);
+    state.regions.push_back(TraceRegion{ name, buffer != NULL ? buffer->tid : 0, start, traceNow() });
+}
+
+// Span covering the enclosing scope
+class TraceScope
+{
+public:
+    TraceScope(const char* name, long long first, long long last)
+        : name(name), first(first), last(last), start(traceEnabled() ? traceNow() : 0) {}
+
+    ~TraceScope()
+    {
+        traceSpan(name, start, first, last);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    long long first;
+    long long last;
+    int64_t start;
+};
+
+// A JSON string literal: quotes, backslashes and control characters escaped
+inline void traceWriteString(FILE* fp, const char* text)
+{
+    fputc('"', fp);
+    for (const unsigned char* c = (const unsigned char*)text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(fp, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(fp, "\\u%04x", *c);
+        else
+            fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+inline void traceWriteEvent(FILE* fp, bool* firstEvent, const char* name, const char* category, int tid,
+                            int64_t start, int64_t end)
+{
+    fprintf(fp, "%s\n{\"name\":", *firstEvent ? "" : ",");
+    traceWriteString(fp, name);
+    fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+            category, tid, start / 1000.0, (end - start) / 1000.0);
+    *firstEvent = false;
+}
+
+// Export everything recorded so far and print the per-region balance
+inline bool traceWrite(const char* filename)
+{
+    TraceState& state = traceState();
+    FILE* fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Failed to write %s\n", filename);
+        return false;
+    }
+
+    int numThreads = state.numThreads.load();
+    if (numThreads > TRACE_MAX_THREADS)
+        numThreads = TRACE_MAX_THREADS;
+
+    bool firstEvent = true;
+    uint64_t totalSpans = 0, dropped = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int t = 0; t < numThreads; t++)
+    {
+        const TraceBuffer* buffer = state.threads[t];
+        if (buffer == NULL)
+            continue;
+        fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                firstEvent ? "" : ",", buffer->tid);
+        traceWriteString(fp, buffer->name);
+        fprintf(fp, "}}");
+        firstEvent = false;
+        for (size_t i = 0; i < buffer->events.size(); i++)
+        {
+            const TraceEvent& e = buffer->events[i];
+            traceWriteEvent(fp, &firstEvent, e.name, "span", buffer->tid, e.start, e.end);
+            fprintf(fp, ",\"args\":{\"first\":%lld,\"last\":%lld}}", e.first, e.last);
+        }
+        totalSpans += buffer->events.size();
+        dropped += buffer->recorded - buffer->events.size();
+    }
+
+    if (!state.regions.empty())
+        printf("\nTrace regions (busy = time inside spans, wait = last span to region end):\n");
+    for (size_t r = 0; r < state.regions.size(); r++)
+    {
+        const TraceRegion& region = state.regions[r];
+        traceWriteEvent(fp, &firstEvent, region.name.c_str(), "region", region.tid, region.start, region.end);
+        fprintf(fp, "}");
+
+        int workers = 0;
+        int64_t minBusy = 0, maxBusy = 0, totalBusy = 0, maxWait = 0;
+        for (int t = 0; t < numThreads; t++)
+        {
+            const TraceBuffer* buffer = state.threads[t];
+            if (buffer == NULL)
+                continue;
+            std::vector<std::pair<int64_t, int64_t> > spans;
+            for (size_t i = 0; i < buffer->events.size(); i++)
+            {
+                const TraceEvent& e = buffer->events[i];
+                if (e.start >= region.start && e.end <= region.end)
+                    spans.push_back(std::make_pair(e.start, e.end));
+            }
+            if (spans.empty())
+                continue;
+
+            // busy = length of the union, so nested spans count once
+            std::sort(spans.begin(), spans.end());
+            int64_t busy = 0, lastEnd = spans[0].first;
+            for (size_t i = 0; i < spans.size(); i++)
+            {
+                int64_t from = spans[i].first > lastEnd ? spans[i].first : lastEnd;
+                if (spans[i].second > from)
+                    busy += spans[i].second - from;
+                lastEnd = spans[i].second > lastEnd ? spans[i].second : lastEnd;
+            }
+
+            traceWriteEvent(fp, &firstEvent, "barrier wait", "idle", buffer->tid, lastEnd, region.end);
+            fprintf(fp, "}");
+            minBusy = workers == 0 || busy < minBusy ? busy : minBusy;
+            maxBusy = busy > maxBusy ? busy : maxBusy;
+            maxWait = region.end - lastEnd > maxWait ? region.end - lastEnd : maxWait;
+            totalBusy += busy;
+            workers++;
+        }
+        if (workers > 0)
+        {
+            printf("%-30s | %3d threads | busy %8.3f .. %8.3f ms | max wait %8.3f ms | imbalance %.2f\n",
+                   region.name.c_str(), workers, minBusy / 1e6, maxBusy / 1e6, maxWait / 1e6,
+                   (double)maxBusy * workers / (totalBusy > 0 ? totalBusy : 1));
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    bool ok = ferror(fp) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok)
+    {
+        printf("Failed to write %s\n", filename);
+        return false;
+    }
+    printf("Trace written to %s (%d threads, %llu spans", filename, numThreads, (unsigned long long)totalSpans);
+    if (dropped > 0)
+        printf(", %llu oldest dropped", (unsigned long long)dropped);
+    printf(")\n");
+    return true;
+}
+
+#endif